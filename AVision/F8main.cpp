@@ -14,17 +14,110 @@
 #include <iomanip>
 #include <format>
 #include <thread>
+#include <mutex>
 #include <random>
 #include <cstdio>
+#include <cstdlib>
+#include <cstring>
 #include <cmath>
 
+#include <opencv2/core/core.hpp>
+
 using namespace std;
 
 #ifndef M_PI
 #define M_PI 3.14159265358979323846
 #endif
 
-std::atomic<bool> FLAG_STOP, FLAG_RESET_VIEW;
+std::atomic<bool> FLAG_STOP, FLAG_RESET_VIEW, FLAG_RECALIBRATE;
+
+// The optional modes of the tracker, as set in the plugin's settings file; all off by default
+struct TrackerSettings
+{
+    bool threadedCapture = false;
+    bool grayscaleProcessing = false;
+    bool landmarkWarmStart = false;
+    bool localFaceSearch = false;
+    bool asynchronousDetection = false;
+    bool pipelinedExecution = false;
+    enum WebcamHeadTracker::TrackingMode trackingMode = WebcamHeadTracker::Tracking_Detect_Every_Frame;
+    enum WebcamHeadTracker::PoseSolver poseSolver = WebcamHeadTracker::PoseSolver_OpenCV;
+    std::string filterConfigFile;
+    // the driver: each profile has its own calibrated head model
+    std::string profile = "default";
+};
+
+static const struct {
+    const char* key;
+    bool TrackerSettings::*value;
+} settingFlags[] = {
+    { "threaded_capture", &TrackerSettings::threadedCapture },
+    { "grayscale_processing", &TrackerSettings::grayscaleProcessing },
+    { "landmark_warm_start", &TrackerSettings::landmarkWarmStart },
+    { "local_face_search", &TrackerSettings::localFaceSearch },
+    { "asynchronous_detection", &TrackerSettings::asynchronousDetection },
+    { "pipelined_execution", &TrackerSettings::pipelinedExecution }
+};
+
+// in the order of the enums
+static const char* const trackingModeNames[] = { "detect_every_frame", "landmarks", "optical_flow" };
+static const char* const poseSolverNames[] = { "opencv", "head_model", "head_model_robust" };
+
+template<typename E, int N>
+static void ReadSettingName(const cv::FileNode& node, const char* const (&names)[N], E& value)
+{
+    if (!node.isString())
+        return;
+    std::string name = static_cast<std::string>(node);
+    for (int i = 0; i < N; i++)
+    {
+        if (name == names[i])
+            value = static_cast<E>(i);
+    }
+}
+
+// Read the settings file, or write one with the defaults if there is none yet,
+// so that the user can edit it. Missing or invalid entries keep their defaults.
+static void LoadTrackerSettings(const std::string& fileName, TrackerSettings& settings)
+{
+    try
+    {
+        cv::FileStorage fs(fileName, cv::FileStorage::READ);
+        if (fs.isOpened())
+        {
+            for (const auto& f : settingFlags)
+            {
+                cv::FileNode node = fs[f.key];
+                if (node.isInt())
+                    settings.*f.value = (static_cast<int>(node) != 0);
+            }
+            ReadSettingName(fs["tracking_mode"], trackingModeNames, settings.trackingMode);
+            ReadSettingName(fs["pose_solver"], poseSolverNames, settings.poseSolver);
+            if (fs["filter_config_file"].isString())
+                settings.filterConfigFile = static_cast<std::string>(fs["filter_config_file"]);
+            if (fs["profile"].isString() && !static_cast<std::string>(fs["profile"]).empty())
+                settings.profile = static_cast<std::string>(fs["profile"]);
+            return;
+        }
+        cv::FileStorage out(fileName, cv::FileStorage::WRITE);
+        if (!out.isOpened())
+            return;
+        out.writeComment("AVision head tracking: 0 = off, 1 = on; read when tracking starts");
+        for (const auto& f : settingFlags)
+            out << f.key << (settings.*f.value ? 1 : 0);
+        out.writeComment("detect_every_frame, landmarks or optical_flow");
+        out << "tracking_mode" << trackingModeNames[settings.trackingMode];
+        out.writeComment("opencv, head_model or head_model_robust");
+        out << "pose_solver" << poseSolverNames[settings.poseSolver];
+        out.writeComment("a filter file written by AVisionBench tune, or empty");
+        out << "filter_config_file" << settings.filterConfigFile;
+        out.writeComment("the driver; each profile has its own head model, calibrated on first use");
+        out << "profile" << settings.profile;
+    }
+    catch (cv::Exception& e)
+    {
+    }
+}
 
 LRESULT CALLBACK KeyboardHookProc(int nCode, WPARAM wParam, LPARAM lParam)
 {
@@ -57,13 +150,23 @@ class AVisionHeadTrackingPlugin
 private:
     F8MainRibbonTabProxy ribbonTab;
     F8MainRibbonGroupProxy ribbonGroup;
-    F8MainRibbonButtonProxy trackBtn, stopBtn;
+    F8MainRibbonButtonProxy trackBtn, stopBtn, recalibrateBtn;
     F8MainRibbonCheckBoxProxy enableFeedChk;
     void* p_startHandle;
     void* p_stopHandle;
+    void* p_recalibrateHandle;
+    void* p_afterPaintHandle;
 
     int screenWidth, screenHeight;
 
+    // The tracker while TrackHead() runs; the paint hook uses it under the mutex
+    std::mutex trackerMutex;
+    WebcamHeadTracker* activeTracker = NULL;
+    // Paint timing, to predict the head position at the next paint
+    double lastPaintTime = -1.0;
+    double paintInterval = 1.0 / 60.0;
+    float lastPaintPos[3] = { 0.0f, 0.0f, -1.0f };
+
     void MoveMouse(int dx, int dy)
     {
         const int K_FACTOR = 5;
@@ -75,6 +178,29 @@ private:
         SetCursorPos(currentPosition.x, currentPosition.y);
     }
 
+    // A file in the AVision settings of the Windows user
+    std::string AppDataFile(const char* name)
+    {
+        const char* appData = getenv("APPDATA");
+        if (appData == NULL)
+            return std::string();
+        std::string dir = std::string(appData) + "\\AVision";
+        CreateDirectoryA(dir.c_str(), NULL);
+        return dir + "\\" + name;
+    }
+
+    // The head model file of a profile; characters that cannot be in a file name become '_'
+    std::string HeadModelFile(const std::string& profile)
+    {
+        std::string name = profile;
+        for (char& c : name)
+        {
+            if (std::strchr("<>:\"/\\|?*", c) || static_cast<unsigned char>(c) < 32)
+                c = '_';
+        }
+        return AppDataFile(("head-model-" + name + ".yml").c_str());
+    }
+
     void RunKeyboardHook()
     {
         HHOOK hKeyboardHook = SetWindowsHookEx(
@@ -105,6 +231,7 @@ public:
         isCapturing.store(true);
         trackBtn->SetEnabled(!isCapturing.load());
         enableFeedChk->SetEnabled(!isCapturing.load());
+        recalibrateBtn->SetEnabled(isCapturing.load());
 
         thdTrackHead = std::thread(&AVisionHeadTrackingPlugin::TrackHead, this);
         thdTrackHead.detach();
@@ -118,11 +245,71 @@ public:
         isCapturing.store(false);
     }
 
+    // The tracker is not thread-safe: TrackHead() recalibrates it between frames
+    void OnRecalibrateBtnClick()
+    {
+        FLAG_RECALIBRATE.store(true);
+    }
+
+    // Called after each frame the simulator draws: move the view by the head
+    // movement up to the next frame, so that the capture and processing latency
+    // of the tracker is compensated
+    void OnAfterPaint()
+    {
+        double now = WebcamHeadTracker::currentTime();
+        if (lastPaintTime >= 0.0 && now - lastPaintTime < 0.1)
+            paintInterval = 0.9 * paintInterval + 0.1 * (now - lastPaintTime);
+        lastPaintTime = now;
+
+        std::lock_guard<std::mutex> lock(trackerMutex);
+        float pos[3], quaternion[4];
+        if (activeTracker == NULL || !activeTracker->predictPose(now + paintInterval, pos, quaternion))
+            return;
+        pos[0] *= 1000.0f;
+        pos[1] *= 1000.0f;
+        pos[2] *= 1000.0f;
+        if (!FLAG_RESET_VIEW.exchange(false) && lastPaintPos[2] >= 0.0f)
+        {
+            int dx = pos[0] - lastPaintPos[0];
+            int dy = pos[1] - lastPaintPos[1];
+            MoveMouse(dx, dy);
+            // keep the remainder for the next paint
+            pos[0] = lastPaintPos[0] + dx;
+            pos[1] = lastPaintPos[1] + dy;
+        }
+        lastPaintPos[0] = pos[0];
+        lastPaintPos[1] = pos[1];
+        lastPaintPos[2] = pos[2];
+    }
+
     void TrackHead()
     {
         int previewWindow = enableFeedChk->GetChecked();
         WebcamHeadTracker tracker(WebcamHeadTracker::Debug_Window & previewWindow);
 
+        // the optional modes, from %APPDATA%\AVision\settings.yml
+        TrackerSettings settings;
+        std::string settingsFile = AppDataFile("settings.yml");
+        if (!settingsFile.empty())
+            LoadTrackerSettings(settingsFile, settings);
+        if (settings.threadedCapture)
+            tracker.setCaptureMode(WebcamHeadTracker::Capture_Threaded);
+        tracker.setGrayscaleProcessing(settings.grayscaleProcessing);
+        tracker.setLandmarkWarmStart(settings.landmarkWarmStart);
+        if (settings.localFaceSearch)
+            tracker.setFaceSearch(WebcamHeadTracker::FaceSearch_Local);
+        tracker.setTrackingMode(settings.trackingMode);
+        tracker.setPoseSolver(settings.poseSolver);
+        if (settings.asynchronousDetection)
+            tracker.setDetectionMode(WebcamHeadTracker::Detection_Asynchronous);
+        if (settings.pipelinedExecution)
+            tracker.setExecutionMode(WebcamHeadTracker::Execution_Pipelined);
+        if (!settings.filterConfigFile.empty())
+            tracker.setFilterConfigFile(settings.filterConfigFile.c_str());
+        std::string headModelFile = HeadModelFile(settings.profile);
+        if (!headModelFile.empty())
+            tracker.setHeadModelFile(headModelFile.c_str());
+
         if (!tracker.initWebcam())
         {
             MessageBox(NULL, L"No usable webcam found",
@@ -149,6 +336,12 @@ public:
         SetCursorPos(screenWidth / 2, screenHeight / 2);
 
         FLAG_RESET_VIEW.store(true);
+        FLAG_RECALIBRATE.store(false);
+        {
+            std::lock_guard<std::mutex> lock(trackerMutex);
+            activeTracker = &tracker;
+            lastPaintPos[2] = -1.0f;
+        }
 
         while (isCapturing.load() && tracker.isReady() && !FLAG_STOP.load())
         {
@@ -158,6 +351,8 @@ public:
                 SendInput(1, &input, sizeof(INPUT));
             }
 
+            if (FLAG_RECALIBRATE.exchange(false))
+                tracker.recalibrateHeadModel();
             tracker.getNewFrame();
             bool gotPose = tracker.computeHeadPose();
             if (gotPose)
@@ -184,25 +379,22 @@ public:
                 fprintf(stderr, "orientation: rotated %+4.1f degrees around axis (%+4.2f %+4.2f %+4.2f)\n",
                     2.0f * halfAngle / (float)M_PI * 180.0f, axis[0], axis[1], axis[2]);
 
-                if (!FLAG_RESET_VIEW.load())
-                {
-                    int dx = pos[0] - lastPos[0];
-                    int dy = pos[1] - lastPos[1];
-                    MoveMouse(dx, dy);
-                }
-
+                // the view is moved in OnAfterPaint()
                 lastPos[0] = pos[0];
                 lastPos[1] = pos[1];
                 lastPos[2] = pos[2];
-
-                FLAG_RESET_VIEW.store(false);
             }
         }
+        {
+            std::lock_guard<std::mutex> lock(trackerMutex);
+            activeTracker = NULL;
+        }
 
         FLAG_STOP.store(false);
         isCapturing.store(false);
         trackBtn->SetEnabled(!isCapturing.load());
         enableFeedChk->SetEnabled(!isCapturing.load());
+        recalibrateBtn->SetEnabled(isCapturing.load());
 
         input.mi.dwFlags = MOUSEEVENTF_LEFTUP;
         SendInput(1, &input, sizeof(INPUT));
@@ -234,25 +426,40 @@ public:
         callback = std::bind(&AVisionHeadTrackingPlugin::OnStopBtnClick, this);
         p_stopHandle = stopBtn->SetCallbackOnClick(callback);
 
+        recalibrateBtn = btnPanel->CreateButton(L"BtnRecalibrate");
+        recalibrateBtn->SetCaption(L"Recalibrate");
+        recalibrateBtn->SetLeft(trackBtn->GetLeft());
+        recalibrateBtn->SetTop(stopBtn->GetTop() + stopBtn->GetHeight() + 6);
+        recalibrateBtn->SetEnabled(false);
+        callback = std::bind(&AVisionHeadTrackingPlugin::OnRecalibrateBtnClick, this);
+        p_recalibrateHandle = recalibrateBtn->SetCallbackOnClick(callback);
+
         enableFeedChk = chkPanel->CreateCheckBox(L"ChkEnableFeed");
         enableFeedChk->SetCaption(L"Webcam preview");
         enableFeedChk->SetTop(trackBtn->GetTop() + 3);
 
-        btnPanel->SetWidth(trackBtn->GetWidth() + 6);
-        btnPanel->SetHeight(2 * trackBtn->GetHeight() + 6);
+        btnPanel->SetWidth(recalibrateBtn->GetWidth() + 6);
+        btnPanel->SetHeight(3 * trackBtn->GetHeight() + 12);
         chkPanel->SetWidth(enableFeedChk->GetWidth());
         chkPanel->SetHeight(enableFeedChk->GetHeight() + 3);
 
+        Cb_MainFormOpenGLAfterPaint afterPaint = std::bind(&AVisionHeadTrackingPlugin::OnAfterPaint, this);
+        p_afterPaintHandle = mainForm->GetMainOpenGL()->RegisterEventOpenGLAfterPaint(afterPaint);
+
         FLAG_STOP.store(false);
     }
 
     void StopProgram()
     {
+        g_applicationServices->GetMainForm()->GetMainOpenGL()->UnregisterEventOpenGLAfterPaint(p_afterPaintHandle);
+
         trackBtn->UnsetCallbackOnClick(p_startHandle);
         stopBtn->UnsetCallbackOnClick(p_stopHandle);
+        recalibrateBtn->UnsetCallbackOnClick(p_recalibrateHandle);
 
         ribbonGroup->DeleteControl(trackBtn);
         ribbonGroup->DeleteControl(stopBtn);
+        ribbonGroup->DeleteControl(recalibrateBtn);
         ribbonGroup->DeleteControl(enableFeedChk);
 
         ribbonTab->DeleteGroup(ribbonGroup);
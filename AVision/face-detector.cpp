@@ -0,0 +1,175 @@
+#include "face-detector.hpp"
+
+#include <algorithm>
+#include <vector>
+
+#include <opencv2/core/core_c.h>
+#include <opencv2/imgproc/imgproc.hpp>
+#include <opencv2/objdetect/objdetect.hpp>
+
+#include <dlib/opencv.h>
+#include <dlib/image_processing/frontal_face_detector.h>
+
+/* OpenCV cascade classifiers (Haar and LBP) */
+
+class CascadeFaceDetector : public FaceDetector
+{
+private:
+    cv::CascadeClassifier _cascade;
+    std::vector<cv::Rect> _faces;
+
+public:
+    bool load(const std::string& modelFile)
+    {
+        _faces.reserve(16);
+        return _cascade.load(modelFile);
+    }
+
+    bool detect(const cv::Mat& frame, int minSize, int maxSize, cv::Rect& face) override
+    {
+        _cascade.detectMultiScale(frame, _faces, 1.1, 2,
+            cv::CASCADE_SCALE_IMAGE | cv::CASCADE_FIND_BIGGEST_OBJECT,
+            cv::Size(minSize, minSize), cv::Size(maxSize, maxSize));
+        if (_faces.size() < 1)
+            return false;
+        face = _faces[0];
+        return true;
+    }
+};
+
+/* dlib HOG detector */
+
+class HogFaceDetector : public FaceDetector
+{
+private:
+    dlib::frontal_face_detector _detector;
+    std::vector<dlib::rectangle> _faces;
+
+public:
+    HogFaceDetector() : _detector(dlib::get_frontal_face_detector())
+    {
+        _faces.reserve(16);
+    }
+
+    bool detect(const cv::Mat& frame, int minSize, int maxSize, cv::Rect& face) override
+    {
+        // A temporary workaround for a Dlib/OpenCV incompatibility:
+        IplImage iplImg = cvIplImage(frame);
+        if (frame.channels() == 1) {
+            dlib::cv_image<unsigned char> dlibFrame(&iplImg);
+            _faces = _detector(dlibFrame);
+        }
+        else {
+            dlib::cv_image<dlib::bgr_pixel> dlibFrame(&iplImg);
+            _faces = _detector(dlibFrame);
+        }
+        // the detector has no size limits, so pick the biggest face within the limits
+        bool found = false;
+        unsigned long biggestArea = 0;
+        for (size_t i = 0; i < _faces.size(); i++) {
+            const dlib::rectangle& r = _faces[i];
+            long size = std::min(r.width(), r.height());
+            if (size < minSize || (maxSize > 0 && size > maxSize) || r.area() <= biggestArea)
+                continue;
+            biggestArea = r.area();
+            face = cv::Rect(r.left(), r.top(), r.width(), r.height());
+            found = true;
+        }
+        return found;
+    }
+};
+
+/* OpenCV DNN detector with a YuNet model */
+
+class DnnFaceDetector : public FaceDetector
+{
+private:
+    cv::Ptr<cv::FaceDetectorYN> _detector;
+    cv::Size _inputSize;
+    cv::Mat _bgr;
+    cv::Mat _faces;
+
+public:
+    bool load(const std::string& modelFile)
+    {
+        try {
+            _detector = cv::FaceDetectorYN::create(modelFile, "", cv::Size(320, 320), 0.8f, 0.3f, 50);
+        }
+        catch (cv::Exception& e) {
+            return false;
+        }
+        return !_detector.empty();
+    }
+
+    bool detect(const cv::Mat& frame, int minSize, int maxSize, cv::Rect& face) override
+    {
+        const cv::Mat* bgr = &frame;
+        if (frame.channels() == 1) {
+            cv::cvtColor(frame, _bgr, cv::COLOR_GRAY2BGR);
+            bgr = &_bgr;
+        }
+        if (bgr->size() != _inputSize) {
+            _inputSize = bgr->size();
+            _detector->setInputSize(_inputSize);
+        }
+        _detector->detect(*bgr, _faces);
+        // each row: x, y, w, h, 5 landmarks, score
+        bool found = false;
+        float biggestArea = 0.0f;
+        for (int i = 0; i < _faces.rows; i++) {
+            const float* f = _faces.ptr<float>(i);
+            float size = std::min(f[2], f[3]);
+            if (size < minSize || (maxSize > 0 && size > maxSize) || f[2] * f[3] <= biggestArea)
+                continue;
+            biggestArea = f[2] * f[3];
+            face = cv::Rect(cvRound(f[0]), cvRound(f[1]), cvRound(f[2]), cvRound(f[3]));
+            found = true;
+        }
+        return found;
+    }
+};
+
+/* FaceDetector */
+
+FaceDetector* FaceDetector::create(enum Backend backend, const std::string& modelFile)
+{
+    switch (backend) {
+    case Backend_Haar:
+    case Backend_LBP:
+    {
+        CascadeFaceDetector* detector = new CascadeFaceDetector;
+        if (!detector->load(modelFile)) {
+            delete detector;
+            return NULL;
+        }
+        return detector;
+    }
+    case Backend_HOG:
+        return new HogFaceDetector;
+    case Backend_DNN:
+    {
+        DnnFaceDetector* detector = new DnnFaceDetector;
+        if (!detector->load(modelFile)) {
+            delete detector;
+            return NULL;
+        }
+        return detector;
+    }
+    }
+    return NULL;
+}
+
+const char* FaceDetector::backendName(enum Backend backend)
+{
+    switch (backend) {
+    case Backend_Haar:
+        return "Haar";
+    case Backend_LBP:
+        return "LBP";
+    case Backend_HOG:
+        return "HOG";
+    case Backend_DNN:
+        return "DNN";
+    }
+    return "";
+}
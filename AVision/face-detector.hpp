@@ -0,0 +1,57 @@
+#ifndef FACE_DETECTOR_HPP
+#define FACE_DETECTOR_HPP
+
+#include <string>
+
+/*! \cond */
+namespace cv {
+    class Mat;
+    template<typename _Tp> class Rect_;
+    typedef Rect_<int> Rect2i;
+    typedef Rect2i Rect;
+}
+/*! \endcond */
+
+/*!
+ * \brief Face detector interface for the \a WebcamHeadTracker
+ *
+ * Use \a FaceDetector::create() to get one of the built-in backends.
+ */
+class FaceDetector
+{
+public:
+    /*! \brief Built-in face detector backends */
+    enum Backend {
+        /*! \brief OpenCV Haar cascade, e.g. `haarcascade_frontalface_alt.xml` */
+        Backend_Haar,
+        /*! \brief OpenCV LBP cascade, e.g. `lbpcascade_frontalface_improved.xml` */
+        Backend_LBP,
+        /*! \brief dlib HOG frontal face detector (no model file needed) */
+        Backend_HOG,
+        /*! \brief OpenCV DNN face detector using a YuNet model, e.g. `face_detection_yunet_2022mar.onnx` (CPU only) */
+        Backend_DNN
+    };
+
+    /*! \brief Create a face detector
+     * \param backend   The backend
+     * \param modelFile The model file of the backend (ignored for \a Backend_HOG)
+     *
+     * Returns NULL if the model file cannot be loaded. */
+    static FaceDetector* create(enum Backend backend, const std::string& modelFile = std::string());
+
+    /*! \brief Name of a backend, for benchmark output */
+    static const char* backendName(enum Backend backend);
+
+    virtual ~FaceDetector() {}
+
+    /*! \brief Detect the biggest face
+     * \param frame     BGR or 8-bit grayscale frame
+     * \param minSize   Minimum face width and height in pixels
+     * \param maxSize   Maximum face width and height in pixels, or 0 for no limit
+     * \param face      The biggest face that was found
+     *
+     * Returns false if no face was found. */
+    virtual bool detect(const cv::Mat& frame, int minSize, int maxSize, cv::Rect& face) = 0;
+};
+
+#endif
@@ -0,0 +1,875 @@
+#include "face-landmarks.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#if defined(_M_X64) || defined(_M_IX86) || defined(__x86_64__) || defined(__i386__)
+#define FACE_LANDMARKS_X86
+#include <immintrin.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#define TARGET_SSE41
+#define TARGET_AVX2
+#else
+#define TARGET_SSE41 __attribute__((target("sse4.1")))
+#define TARGET_AVX2 __attribute__((target("avx2")))
+#endif
+#endif
+
+#include <opencv2/core/core.hpp>
+
+#include <dlib/serialize.h>
+#include <dlib/image_processing/shape_predictor.h>
+
+static const char faceLandmarkFileMagic[8] = { 'A', 'V', 'L', 'M', 'A', 'R', 'K', 0 };
+static const uint32_t faceLandmarkFileVersion = 2;
+
+static uint64_t alignTo(uint64_t x, uint64_t alignment)
+{
+    return (x + alignment - 1) / alignment * alignment;
+}
+
+/* Size and last modification time of a file, which tell whether a precompiled
+ * file was converted from it. The time is in the units of the platform. */
+static bool fileStamp(const std::string& fileName, uint64_t& size, uint64_t& modificationTime)
+{
+#ifdef _WIN32
+    WIN32_FILE_ATTRIBUTE_DATA attributes;
+    if (!GetFileAttributesExA(fileName.c_str(), GetFileExInfoStandard, &attributes))
+        return false;
+    size = (uint64_t(attributes.nFileSizeHigh) << 32) | attributes.nFileSizeLow;
+    modificationTime = (uint64_t(attributes.ftLastWriteTime.dwHighDateTime) << 32)
+        | attributes.ftLastWriteTime.dwLowDateTime;
+#else
+    struct stat statBuf;
+    if (::stat(fileName.c_str(), &statBuf) != 0)
+        return false;
+    size = statBuf.st_size;
+    modificationTime = statBuf.st_mtime;
+#endif
+    return true;
+}
+
+/* Replace a file with another file in the same directory, in one step. On Windows,
+ * this fails while another process maps the file that is replaced. */
+static bool replaceFile(const std::string& from, const std::string& to)
+{
+#ifdef _WIN32
+    return MoveFileExA(from.c_str(), to.c_str(), MOVEFILE_REPLACE_EXISTING) != 0;
+#else
+    return std::rename(from.c_str(), to.c_str()) == 0;
+#endif
+}
+
+/* Evaluation kernels
+ *
+ * The cascade spends its time in three loops per stage: computing the pixel
+ * position of each feature, walking each tree to a leaf, and adding the leaf
+ * values of all trees to the shape. Each loop has a scalar version and
+ * vectorized versions. The vectorized versions perform the same floating point
+ * operations in the same order, so all kernels give bit-identical results.
+ * Pixels are still read one by one: a gather of single bytes is not faster.
+ *
+ * This needs every multiplication and addition to be rounded on its own. The
+ * compiler must not contract them into fused multiply-adds, which it may do in
+ * one kernel and not in another, e.g. when the build targets AVX2.
+ */
+
+#if defined(_MSC_VER) && !defined(__clang__)
+#pragma fp_contract(off)
+#elif defined(__clang__)
+#pragma clang fp contract(off)
+#elif defined(__GNUC__)
+#pragma GCC optimize("fp-contract=off")
+#endif
+
+typedef FaceLandmarkModel::Split Split;
+
+struct FeatureGeometry
+{
+    float m[4];             // similarity transform of the feature deltas
+    double x0, y0;          // face rectangle origin
+    double sx, sy;          // face rectangle size minus one, as in dlib
+    int cols, rows;
+    int step, channels;
+};
+
+/* Byte offset of a feature pixel in the frame, or -1 if it is outside. */
+static inline int featureOffset(const FeatureGeometry& g, float u, float v)
+{
+    // round to the nearest pixel, as dlib does
+    int x = int(std::floor(g.x0 + u * g.sx + 0.5));
+    int y = int(std::floor(g.y0 + v * g.sy + 0.5));
+    if (x < 0 || y < 0 || x >= g.cols || y >= g.rows)
+        return -1;
+    return y * g.step + x * g.channels;
+}
+
+static void featureOffsetsScalar(const FeatureGeometry& g, const float* shape,
+    const uint16_t* anchors, const float* deltas, int begin, int end, int* offsets)
+{
+    for (int f = begin; f < end; f++) {
+        float dx = deltas[2 * f + 0];
+        float dy = deltas[2 * f + 1];
+        float u = g.m[0] * dx + g.m[1] * dy + shape[2 * anchors[f] + 0];
+        float v = g.m[2] * dx + g.m[3] * dy + shape[2 * anchors[f] + 1];
+        offsets[f] = featureOffset(g, u, v);
+    }
+}
+
+static void findLeavesScalar(const float* values, const Split* splits, int splitsPerTree,
+    int begin, int end, int* leaves)
+{
+    for (int t = begin; t < end; t++) {
+        const Split* s = splits + size_t(t) * splitsPerTree;
+        int i = 0;
+        while (i < splitsPerTree)
+            i = (values[s[i].idx1] - values[s[i].idx2] > s[i].thresh) ? 2 * i + 1 : 2 * i + 2;
+        leaves[t] = i - splitsPerTree;
+    }
+}
+
+static void accumulateLeavesScalar(float* shape, const float* const* leaves, int count,
+    int begin, int end)
+{
+    for (int t = 0; t < count; t++) {
+        const float* leaf = leaves[t];
+        for (int j = begin; j < end; j++)
+            shape[j] += leaf[j];
+    }
+}
+
+#ifdef FACE_LANDMARKS_X86
+
+/* Rounded pixel coordinates of four features along one axis */
+TARGET_SSE41 static inline __m128i pixelCoordsSSE41(__m128 u, __m128d origin, __m128d scale)
+{
+    const __m128d half = _mm_set1_pd(0.5);
+    __m128d lo = _mm_cvtps_pd(u);
+    __m128d hi = _mm_cvtps_pd(_mm_movehl_ps(u, u));
+    lo = _mm_floor_pd(_mm_add_pd(_mm_add_pd(origin, _mm_mul_pd(lo, scale)), half));
+    hi = _mm_floor_pd(_mm_add_pd(_mm_add_pd(origin, _mm_mul_pd(hi, scale)), half));
+    return _mm_unpacklo_epi64(_mm_cvttpd_epi32(lo), _mm_cvttpd_epi32(hi));
+}
+
+TARGET_SSE41 static void featureOffsetsSSE41(const FeatureGeometry& g, const float* shape,
+    const uint16_t* anchors, const float* deltas, int count, int* offsets)
+{
+    const __m128 m0 = _mm_set1_ps(g.m[0]), m1 = _mm_set1_ps(g.m[1]);
+    const __m128 m2 = _mm_set1_ps(g.m[2]), m3 = _mm_set1_ps(g.m[3]);
+    const __m128d x0 = _mm_set1_pd(g.x0), y0 = _mm_set1_pd(g.y0);
+    const __m128d sx = _mm_set1_pd(g.sx), sy = _mm_set1_pd(g.sy);
+    const __m128i cols = _mm_set1_epi32(g.cols), rows = _mm_set1_epi32(g.rows);
+    const __m128i step = _mm_set1_epi32(g.step), channels = _mm_set1_epi32(g.channels);
+    const __m128i minusOne = _mm_set1_epi32(-1);
+    int f = 0;
+    for (; f + 4 <= count; f += 4) {
+        __m128 d01 = _mm_loadu_ps(deltas + 2 * f);
+        __m128 d23 = _mm_loadu_ps(deltas + 2 * f + 4);
+        __m128 dx = _mm_shuffle_ps(d01, d23, _MM_SHUFFLE(2, 0, 2, 0));
+        __m128 dy = _mm_shuffle_ps(d01, d23, _MM_SHUFFLE(3, 1, 3, 1));
+        const float* a0 = shape + 2 * anchors[f + 0];
+        const float* a1 = shape + 2 * anchors[f + 1];
+        const float* a2 = shape + 2 * anchors[f + 2];
+        const float* a3 = shape + 2 * anchors[f + 3];
+        __m128 ax = _mm_set_ps(a3[0], a2[0], a1[0], a0[0]);
+        __m128 ay = _mm_set_ps(a3[1], a2[1], a1[1], a0[1]);
+        __m128 u = _mm_add_ps(_mm_add_ps(_mm_mul_ps(m0, dx), _mm_mul_ps(m1, dy)), ax);
+        __m128 v = _mm_add_ps(_mm_add_ps(_mm_mul_ps(m2, dx), _mm_mul_ps(m3, dy)), ay);
+        __m128i x = pixelCoordsSSE41(u, x0, sx);
+        __m128i y = pixelCoordsSSE41(v, y0, sy);
+        __m128i inside = _mm_and_si128(
+            _mm_and_si128(_mm_cmpgt_epi32(x, minusOne), _mm_cmpgt_epi32(y, minusOne)),
+            _mm_and_si128(_mm_cmplt_epi32(x, cols), _mm_cmplt_epi32(y, rows)));
+        __m128i offset = _mm_add_epi32(_mm_mullo_epi32(y, step), _mm_mullo_epi32(x, channels));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(offsets + f), _mm_blendv_epi8(minusOne, offset, inside));
+    }
+    featureOffsetsScalar(g, shape, anchors, deltas, f, count, offsets);
+}
+
+TARGET_SSE41 static void accumulateLeavesSSE41(float* shape, const float* const* leaves, int count, int size)
+{
+    int j = 0;
+    for (; j + 4 <= size; j += 4) {
+        __m128 sum = _mm_loadu_ps(shape + j);
+        for (int t = 0; t < count; t++)
+            sum = _mm_add_ps(sum, _mm_loadu_ps(leaves[t] + j));
+        _mm_storeu_ps(shape + j, sum);
+    }
+    accumulateLeavesScalar(shape, leaves, count, j, size);
+}
+
+/* Rounded pixel coordinates of eight features along one axis */
+TARGET_AVX2 static inline __m256i pixelCoordsAVX2(__m256 u, __m256d origin, __m256d scale)
+{
+    const __m256d half = _mm256_set1_pd(0.5);
+    __m256d lo = _mm256_cvtps_pd(_mm256_castps256_ps128(u));
+    __m256d hi = _mm256_cvtps_pd(_mm256_extractf128_ps(u, 1));
+    lo = _mm256_floor_pd(_mm256_add_pd(_mm256_add_pd(origin, _mm256_mul_pd(lo, scale)), half));
+    hi = _mm256_floor_pd(_mm256_add_pd(_mm256_add_pd(origin, _mm256_mul_pd(hi, scale)), half));
+    return _mm256_inserti128_si256(_mm256_castsi128_si256(_mm256_cvttpd_epi32(lo)), _mm256_cvttpd_epi32(hi), 1);
+}
+
+TARGET_AVX2 static void featureOffsetsAVX2(const FeatureGeometry& g, const float* shape,
+    const uint16_t* anchors, const float* deltas, int count, int* offsets)
+{
+    const __m256 m0 = _mm256_set1_ps(g.m[0]), m1 = _mm256_set1_ps(g.m[1]);
+    const __m256 m2 = _mm256_set1_ps(g.m[2]), m3 = _mm256_set1_ps(g.m[3]);
+    const __m256d x0 = _mm256_set1_pd(g.x0), y0 = _mm256_set1_pd(g.y0);
+    const __m256d sx = _mm256_set1_pd(g.sx), sy = _mm256_set1_pd(g.sy);
+    const __m256i cols = _mm256_set1_epi32(g.cols), rows = _mm256_set1_epi32(g.rows);
+    const __m256i step = _mm256_set1_epi32(g.step), channels = _mm256_set1_epi32(g.channels);
+    const __m256i minusOne = _mm256_set1_epi32(-1);
+    const __m256i even = _mm256_setr_epi32(0, 2, 4, 6, 8, 10, 12, 14);
+    int f = 0;
+    for (; f + 8 <= count; f += 8) {
+        __m256 dx = _mm256_i32gather_ps(deltas + 2 * f + 0, even, 4);
+        __m256 dy = _mm256_i32gather_ps(deltas + 2 * f + 1, even, 4);
+        __m256i a = _mm256_slli_epi32(_mm256_cvtepu16_epi32(
+            _mm_loadu_si128(reinterpret_cast<const __m128i*>(anchors + f))), 1);
+        __m256 ax = _mm256_i32gather_ps(shape + 0, a, 4);
+        __m256 ay = _mm256_i32gather_ps(shape + 1, a, 4);
+        __m256 u = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(m0, dx), _mm256_mul_ps(m1, dy)), ax);
+        __m256 v = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(m2, dx), _mm256_mul_ps(m3, dy)), ay);
+        __m256i x = pixelCoordsAVX2(u, x0, sx);
+        __m256i y = pixelCoordsAVX2(v, y0, sy);
+        __m256i inside = _mm256_and_si256(
+            _mm256_and_si256(_mm256_cmpgt_epi32(x, minusOne), _mm256_cmpgt_epi32(y, minusOne)),
+            _mm256_and_si256(_mm256_cmpgt_epi32(cols, x), _mm256_cmpgt_epi32(rows, y)));
+        __m256i offset = _mm256_add_epi32(_mm256_mullo_epi32(y, step), _mm256_mullo_epi32(x, channels));
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(offsets + f), _mm256_blendv_epi8(minusOne, offset, inside));
+    }
+    featureOffsetsScalar(g, shape, anchors, deltas, f, count, offsets);
+}
+
+/* Walks eight complete trees of the given depth at once: in each level, the
+ * splits of the current nodes and their feature values are gathered. */
+TARGET_AVX2 static void findLeavesAVX2(const float* values, const Split* splits, int splitsPerTree,
+    int depth, int count, int* leaves)
+{
+    // a split is {uint16_t idx1, idx2; float thresh}: gather it as an int and a float
+    const int* splitIndices = reinterpret_cast<const int*>(splits);
+    const float* splitThresholds = reinterpret_cast<const float*>(splits) + 1;
+    const __m256i lowHalf = _mm256_set1_epi32(0xffff);
+    const __m256i two = _mm256_set1_epi32(2);
+    const __m256i treeStep = _mm256_set1_epi32(8 * splitsPerTree);
+    __m256i base = _mm256_mullo_epi32(_mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7), _mm256_set1_epi32(splitsPerTree));
+    int t = 0;
+    for (; t + 8 <= count; t += 8) {
+        __m256i i = _mm256_setzero_si256();
+        for (int level = 0; level < depth; level++) {
+            __m256i split = _mm256_add_epi32(base, i);
+            __m256i indices = _mm256_i32gather_epi32(splitIndices, split, 8);
+            __m256 thresh = _mm256_i32gather_ps(splitThresholds, split, 8);
+            __m256 v1 = _mm256_i32gather_ps(values, _mm256_and_si256(indices, lowHalf), 4);
+            __m256 v2 = _mm256_i32gather_ps(values, _mm256_srli_epi32(indices, 16), 4);
+            __m256i greater = _mm256_castps_si256(_mm256_cmp_ps(_mm256_sub_ps(v1, v2), thresh, _CMP_GT_OQ));
+            // 2i+1 where greater (the mask is -1), 2i+2 elsewhere
+            i = _mm256_add_epi32(_mm256_add_epi32(_mm256_add_epi32(i, i), two), greater);
+        }
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(leaves + t),
+            _mm256_sub_epi32(i, _mm256_set1_epi32(splitsPerTree)));
+        base = _mm256_add_epi32(base, treeStep);
+    }
+    findLeavesScalar(values, splits, splitsPerTree, t, count, leaves);
+}
+
+TARGET_AVX2 static void accumulateLeavesAVX2(float* shape, const float* const* leaves, int count, int size)
+{
+    int j = 0;
+    for (; j + 8 <= size; j += 8) {
+        __m256 sum = _mm256_loadu_ps(shape + j);
+        for (int t = 0; t < count; t++)
+            sum = _mm256_add_ps(sum, _mm256_loadu_ps(leaves[t] + j));
+        _mm256_storeu_ps(shape + j, sum);
+    }
+    accumulateLeavesScalar(shape, leaves, count, j, size);
+}
+
+#endif
+
+static bool cpuSupports(enum FaceLandmarkModel::Kernel kernel)
+{
+    if (kernel == FaceLandmarkModel::Kernel_Scalar)
+        return true;
+#ifdef FACE_LANDMARKS_X86
+#ifdef _MSC_VER
+    int info[4];
+    __cpuid(info, 0);
+    int maxLeaf = info[0];
+    __cpuid(info, 1);
+    bool sse41 = (info[2] & (1 << 19)) != 0;
+    // AVX needs OS support for saving the ymm registers (OSXSAVE and XCR0)
+    bool avx = (info[2] & (1 << 27)) && (info[2] & (1 << 28)) && (_xgetbv(0) & 6) == 6;
+    bool avx2 = false;
+    if (avx && maxLeaf >= 7) {
+        __cpuidex(info, 7, 0);
+        avx2 = (info[1] & (1 << 5)) != 0;
+    }
+#else
+    __builtin_cpu_init();
+    bool sse41 = __builtin_cpu_supports("sse4.1");
+    bool avx2 = __builtin_cpu_supports("avx2");
+#endif
+    return (kernel == FaceLandmarkModel::Kernel_SSE41 && sse41)
+        || (kernel == FaceLandmarkModel::Kernel_AVX2 && avx2);
+#else
+    return false;
+#endif
+}
+
+FaceLandmarkModel::FaceLandmarkModel() :
+    _kernel(Kernel_Scalar),
+    _landmarkCount(0),
+    _stageCount(0),
+    _treesPerStage(0),
+    _splitsPerTree(0),
+    _featuresPerStage(0),
+    _treeDepth(0),
+    _data(NULL),
+    _mappedSize(0),
+#ifdef _WIN32
+    _fileHandle(INVALID_HANDLE_VALUE),
+    _mappingHandle(NULL),
+#endif
+    _initialShape(NULL),
+    _anchors(NULL),
+    _deltas(NULL),
+    _splits(NULL),
+    _leafValues(NULL),
+    _initialShapeVariance(0.0f)
+{
+    static_assert(sizeof(Split) == 8, "unexpected padding in Split");
+    std::memset(&_header, 0, sizeof(_header));
+    setKernel(Kernel_Auto);
+}
+
+FaceLandmarkModel::~FaceLandmarkModel()
+{
+    _unload();
+}
+
+bool FaceLandmarkModel::setKernel(enum Kernel kernel)
+{
+    if (kernel == Kernel_Auto) {
+        _kernel = cpuSupports(Kernel_AVX2) ? Kernel_AVX2
+            : cpuSupports(Kernel_SSE41) ? Kernel_SSE41 : Kernel_Scalar;
+        return true;
+    }
+    if (!cpuSupports(kernel))
+        return false;
+    _kernel = kernel;
+    return true;
+}
+
+const char* FaceLandmarkModel::kernelName(enum Kernel kernel)
+{
+    switch (kernel) {
+    case Kernel_Auto:
+        return "auto";
+    case Kernel_Scalar:
+        return "scalar";
+    case Kernel_SSE41:
+        return "SSE4.1";
+    case Kernel_AVX2:
+        return "AVX2";
+    }
+    return "unknown";
+}
+
+void FaceLandmarkModel::_unload()
+{
+#ifdef _WIN32
+    if (_mappedSize > 0)
+        UnmapViewOfFile(_data);
+    if (_mappingHandle)
+        CloseHandle(_mappingHandle);
+    if (_fileHandle != INVALID_HANDLE_VALUE)
+        CloseHandle(_fileHandle);
+    _mappingHandle = NULL;
+    _fileHandle = INVALID_HANDLE_VALUE;
+#else
+    if (_mappedSize > 0)
+        ::munmap(const_cast<unsigned char*>(_data), _mappedSize);
+#endif
+    _data = NULL;
+    _mappedSize = 0;
+    std::vector<uint64_t>().swap(_buffer);
+    std::memset(&_header, 0, sizeof(_header));
+    _initialShape = NULL;
+    _anchors = NULL;
+    _deltas = NULL;
+    _splits = NULL;
+    _leafValues = NULL;
+    _landmarkCount = 0;
+    _stageCount = 0;
+    _treesPerStage = 0;
+    _splitsPerTree = 0;
+    _featuresPerStage = 0;
+    _treeDepth = 0;
+}
+
+bool FaceLandmarkModel::load(const std::string& fileName, const std::string& cacheFileName)
+{
+    _unload();
+    if (!cacheFileName.empty()) {
+        uint64_t sourceFileSize, sourceFileTime;
+        if (fileStamp(fileName, sourceFileSize, sourceFileTime) && _map(cacheFileName)
+            && _header.sourceFileSize == sourceFileSize && _header.sourceFileTime == sourceFileTime)
+            return true;
+        _unload();
+    }
+    if (_map(fileName))
+        return true;
+    _unload();
+    if (!_import(fileName)) {
+        _unload();
+        return false;
+    }
+    if (!cacheFileName.empty())
+        save(cacheFileName);
+    return true;
+}
+
+bool FaceLandmarkModel::save(const std::string& fileName) const
+{
+    if (!_data)
+        return false;
+    // Write a temporary file in the same directory, then replace the file with it,
+    // so that other processes map either the old or the new file, never a partial one.
+#ifdef _WIN32
+    unsigned long processId = GetCurrentProcessId();
+#else
+    unsigned long processId = ::getpid();
+#endif
+    std::string tempFileName = fileName + "." + std::to_string(processId) + ".tmp";
+    std::ofstream out(tempFileName, std::ios::binary);
+    out.write(reinterpret_cast<const char*>(_data), _header.fileSize);
+    out.close();
+    if (!out || !replaceFile(tempFileName, fileName)) {
+        std::remove(tempFileName.c_str());
+        return false;
+    }
+    return true;
+}
+
+bool FaceLandmarkModel::_map(const std::string& fileName)
+{
+    // map read-only and shared, so that all users of the file share its pages
+#ifdef _WIN32
+    _fileHandle = CreateFileA(fileName.c_str(), GENERIC_READ, FILE_SHARE_READ, NULL,
+        OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+    if (_fileHandle == INVALID_HANDLE_VALUE)
+        return false;
+    LARGE_INTEGER fileSize;
+    if (!GetFileSizeEx(_fileHandle, &fileSize) || fileSize.QuadPart < LONGLONG(sizeof(FaceLandmarkFileHeader)))
+        return false;
+    _mappingHandle = CreateFileMapping(_fileHandle, NULL, PAGE_READONLY, 0, 0, NULL);
+    if (!_mappingHandle)
+        return false;
+    _data = static_cast<const unsigned char*>(MapViewOfFile(_mappingHandle, FILE_MAP_READ, 0, 0, 0));
+    if (!_data)
+        return false;
+    _mappedSize = fileSize.QuadPart;
+#else
+    int fd = ::open(fileName.c_str(), O_RDONLY);
+    if (fd < 0)
+        return false;
+    struct stat statBuf;
+    if (::fstat(fd, &statBuf) != 0 || statBuf.st_size < off_t(sizeof(FaceLandmarkFileHeader))) {
+        ::close(fd);
+        return false;
+    }
+    void* data = ::mmap(NULL, statBuf.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    ::close(fd);
+    if (data == MAP_FAILED)
+        return false;
+    _data = static_cast<const unsigned char*>(data);
+    _mappedSize = statBuf.st_size;
+#endif
+    FaceLandmarkFileHeader header;
+    std::memcpy(&header, _data, sizeof(header));
+    return std::memcmp(header.magic, faceLandmarkFileMagic, sizeof(header.magic)) == 0
+        && _setup(header, _mappedSize);
+}
+
+bool FaceLandmarkModel::_import(const std::string& fileName)
+{
+    // This reads the members of dlib::shape_predictor in the order of its serialize() function.
+    int version;
+    dlib::matrix<float, 0, 1> initialShape;
+    std::vector<std::vector<dlib::impl::regression_tree>> forests;
+    std::vector<std::vector<unsigned long>> anchorIdx;
+    std::vector<std::vector<dlib::vector<float, 2>>> deltas;
+    uint64_t sourceFileSize, sourceFileTime;
+    if (!fileStamp(fileName, sourceFileSize, sourceFileTime))
+        return false;
+    try {
+        std::ifstream in(fileName, std::ios::binary);
+        if (!in)
+            return false;
+        dlib::deserialize(version, in);
+        if (version != 1)
+            return false;
+        dlib::deserialize(initialShape, in);
+        dlib::deserialize(forests, in);
+        dlib::deserialize(anchorIdx, in);
+        dlib::deserialize(deltas, in);
+    }
+    catch (std::exception& e) {
+        return false;
+    }
+
+    // check that all stages and trees have the same size, so that they fit into flat arrays
+    int landmarkCount = initialShape.size() / 2;
+    int stageCount = forests.size();
+    if (landmarkCount < 2 || stageCount < 1
+        || anchorIdx.size() != forests.size() || deltas.size() != forests.size()
+        || forests[0].empty() || anchorIdx[0].empty())
+        return false;
+    int treesPerStage = forests[0].size();
+    int splitsPerTree = forests[0][0].splits.size();
+    int featuresPerStage = anchorIdx[0].size();
+    for (int s = 0; s < stageCount; s++) {
+        if (int(forests[s].size()) != treesPerStage
+            || int(anchorIdx[s].size()) != featuresPerStage
+            || int(deltas[s].size()) != featuresPerStage)
+            return false;
+        for (int t = 0; t < treesPerStage; t++) {
+            const dlib::impl::regression_tree& tree = forests[s][t];
+            if (int(tree.splits.size()) != splitsPerTree
+                || int(tree.leaf_values.size()) != splitsPerTree + 1)
+                return false;
+            for (int l = 0; l <= splitsPerTree; l++) {
+                if (tree.leaf_values[l].size() != initialShape.size())
+                    return false;
+            }
+        }
+    }
+
+    // lay out the arrays as in a precompiled file
+    FaceLandmarkFileHeader header;
+    std::memset(&header, 0, sizeof(header));
+    std::memcpy(header.magic, faceLandmarkFileMagic, sizeof(header.magic));
+    header.version = faceLandmarkFileVersion;
+    header.landmarkCount = landmarkCount;
+    header.stageCount = stageCount;
+    header.treesPerStage = treesPerStage;
+    header.splitsPerTree = splitsPerTree;
+    header.featuresPerStage = featuresPerStage;
+    header.sourceFileSize = sourceFileSize;
+    header.sourceFileTime = sourceFileTime;
+    uint64_t features = uint64_t(stageCount) * featuresPerStage;
+    uint64_t trees = uint64_t(stageCount) * treesPerStage;
+    header.initialShapeOffset = alignTo(sizeof(header), 64);
+    header.anchorsOffset = alignTo(header.initialShapeOffset + 2 * landmarkCount * sizeof(float), 64);
+    header.deltasOffset = alignTo(header.anchorsOffset + features * sizeof(uint16_t), 64);
+    header.splitsOffset = alignTo(header.deltasOffset + 2 * features * sizeof(float), 64);
+    header.leafValuesOffset = alignTo(header.splitsOffset + trees * splitsPerTree * sizeof(Split), 4096);
+    header.fileSize = header.leafValuesOffset + trees * (splitsPerTree + 1) * 2 * landmarkCount * sizeof(float);
+    _buffer.assign((header.fileSize + sizeof(uint64_t) - 1) / sizeof(uint64_t), 0);
+    unsigned char* data = reinterpret_cast<unsigned char*>(_buffer.data());
+    std::memcpy(data, &header, sizeof(header));
+    float* initialShapeData = reinterpret_cast<float*>(data + header.initialShapeOffset);
+    uint16_t* anchorsData = reinterpret_cast<uint16_t*>(data + header.anchorsOffset);
+    float* deltasData = reinterpret_cast<float*>(data + header.deltasOffset);
+    Split* splitsData = reinterpret_cast<Split*>(data + header.splitsOffset);
+    float* leafValuesData = reinterpret_cast<float*>(data + header.leafValuesOffset);
+    std::copy(initialShape.begin(), initialShape.end(), initialShapeData);
+    for (int s = 0; s < stageCount; s++) {
+        for (int f = 0; f < featuresPerStage; f++) {
+            size_t feature = size_t(s) * featuresPerStage + f;
+            anchorsData[feature] = anchorIdx[s][f];
+            deltasData[2 * feature + 0] = deltas[s][f].x();
+            deltasData[2 * feature + 1] = deltas[s][f].y();
+        }
+        for (int t = 0; t < treesPerStage; t++) {
+            const dlib::impl::regression_tree& tree = forests[s][t];
+            size_t treeIndex = size_t(s) * treesPerStage + t;
+            for (int i = 0; i < splitsPerTree; i++) {
+                Split& split = splitsData[treeIndex * splitsPerTree + i];
+                split.idx1 = tree.splits[i].idx1;
+                split.idx2 = tree.splits[i].idx2;
+                split.thresh = tree.splits[i].thresh;
+            }
+            for (int l = 0; l <= splitsPerTree; l++) {
+                std::copy(tree.leaf_values[l].begin(), tree.leaf_values[l].end(),
+                    leafValuesData + (treeIndex * (splitsPerTree + 1) + l) * 2 * landmarkCount);
+            }
+        }
+    }
+    // the index ranges are checked by _setup()
+    _data = data;
+    return _setup(header, header.fileSize);
+}
+
+bool FaceLandmarkModel::_setup(const FaceLandmarkFileHeader& header, size_t dataSize)
+{
+    uint64_t features = uint64_t(header.stageCount) * header.featuresPerStage;
+    uint64_t trees = uint64_t(header.stageCount) * header.treesPerStage;
+    if (header.version != faceLandmarkFileVersion
+        || header.landmarkCount < 2 || header.landmarkCount > 65535
+        || header.stageCount < 1 || header.treesPerStage < 1
+        || header.featuresPerStage < 1 || header.featuresPerStage > 65535
+        || header.splitsPerTree > 65535
+        || header.fileSize > dataSize
+        || header.initialShapeOffset % 64 != 0 || header.anchorsOffset % 64 != 0
+        || header.deltasOffset % 64 != 0 || header.splitsOffset % 64 != 0
+        || header.leafValuesOffset % 64 != 0
+        || header.initialShapeOffset + 2 * header.landmarkCount * sizeof(float) > header.fileSize
+        || header.anchorsOffset + features * sizeof(uint16_t) > header.fileSize
+        || header.deltasOffset + 2 * features * sizeof(float) > header.fileSize
+        || header.splitsOffset + trees * header.splitsPerTree * sizeof(Split) > header.fileSize
+        || header.leafValuesOffset + trees * (header.splitsPerTree + 1) * 2 * header.landmarkCount * sizeof(float)
+            > header.fileSize)
+        return false;
+    const float* initialShape = reinterpret_cast<const float*>(_data + header.initialShapeOffset);
+    const uint16_t* anchors = reinterpret_cast<const uint16_t*>(_data + header.anchorsOffset);
+    const Split* splits = reinterpret_cast<const Split*>(_data + header.splitsOffset);
+    // check the indices, so that a broken file cannot make predict() read out of bounds
+    for (uint64_t i = 0; i < features; i++) {
+        if (anchors[i] >= header.landmarkCount)
+            return false;
+    }
+    for (uint64_t i = 0; i < trees * header.splitsPerTree; i++) {
+        if (splits[i].idx1 >= header.featuresPerStage || splits[i].idx2 >= header.featuresPerStage)
+            return false;
+    }
+
+    _header = header;
+    _landmarkCount = header.landmarkCount;
+    _stageCount = header.stageCount;
+    _treesPerStage = header.treesPerStage;
+    _splitsPerTree = header.splitsPerTree;
+    _featuresPerStage = header.featuresPerStage;
+    _initialShape = initialShape;
+    _anchors = anchors;
+    _deltas = reinterpret_cast<const float*>(_data + header.deltasOffset);
+    _splits = splits;
+    _leafValues = reinterpret_cast<const float*>(_data + header.leafValuesOffset);
+    // the AVX2 kernel walks trees level by level, which needs complete trees,
+    // and gathers splits with 32 bit offsets
+    _treeDepth = 0;
+    if (((_splitsPerTree + 1) & _splitsPerTree) == 0 && _splitsPerTree > 0
+        && uint64_t(_treesPerStage) * _splitsPerTree * sizeof(Split) < (uint64_t(1) << 31)) {
+        while ((1 << _treeDepth) < _splitsPerTree + 1)
+            _treeDepth++;
+    }
+
+    // the initial shape relative to its centroid, for the similarity transform
+    float cx = 0.0f, cy = 0.0f;
+    for (int i = 0; i < _landmarkCount; i++) {
+        cx += _initialShape[2 * i + 0];
+        cy += _initialShape[2 * i + 1];
+    }
+    cx /= _landmarkCount;
+    cy /= _landmarkCount;
+    _centeredInitialShape.resize(2 * _landmarkCount);
+    _initialShapeVariance = 0.0f;
+    for (int i = 0; i < _landmarkCount; i++) {
+        float x = _initialShape[2 * i + 0] - cx;
+        float y = _initialShape[2 * i + 1] - cy;
+        _centeredInitialShape[2 * i + 0] = x;
+        _centeredInitialShape[2 * i + 1] = y;
+        _initialShapeVariance += x * x + y * y;
+    }
+
+    _shape.resize(2 * _landmarkCount);
+    _stageStartShape.resize(2 * _landmarkCount);
+    _featureOffsets.resize(_featuresPerStage);
+    _featureValues.resize(_featuresPerStage);
+    _leafIndices.resize(_treesPerStage);
+    _leaves.resize(_treesPerStage);
+    return true;
+}
+
+/* The rotation and scale part of the least squares similarity transform from
+ * the initial shape to the current shape, as a row-major 2x2 matrix.
+ * This is what dlib's find_tform_between_shapes() computes with an SVD; for
+ * the 2D case without reflection there is a closed form. */
+void FaceLandmarkModel::_similarityTransform(float* m) const
+{
+    const float* shape = _shape.data();
+    const float* from = _centeredInitialShape.data();
+    double cx = 0.0, cy = 0.0;
+    for (int i = 0; i < _landmarkCount; i++) {
+        cx += shape[2 * i + 0];
+        cy += shape[2 * i + 1];
+    }
+    cx /= _landmarkCount;
+    cy /= _landmarkCount;
+    double a = 0.0, b = 0.0;
+    for (int i = 0; i < _landmarkCount; i++) {
+        double x = shape[2 * i + 0] - cx;
+        double y = shape[2 * i + 1] - cy;
+        a += from[2 * i + 0] * x + from[2 * i + 1] * y;
+        b += from[2 * i + 0] * y - from[2 * i + 1] * x;
+    }
+    a /= _initialShapeVariance;
+    b /= _initialShapeVariance;
+    m[0] = a;
+    m[1] = -b;
+    m[2] = b;
+    m[3] = a;
+}
+
+void FaceLandmarkModel::_extractFeatures(const cv::Mat& frame, const cv::Rect& face, int stage)
+{
+    FeatureGeometry g;
+    _similarityTransform(g.m);
+    // map from coordinates relative to the face rectangle to pixel coordinates;
+    // the rectangle spans face.width - 1 pixels, as in dlib
+    g.x0 = face.x;
+    g.y0 = face.y;
+    g.sx = face.width - 1;
+    g.sy = face.height - 1;
+    g.cols = frame.cols;
+    g.rows = frame.rows;
+    g.step = int(frame.step);
+    g.channels = frame.channels();
+    const float* shape = _shape.data();
+    const uint16_t* anchors = _anchors + stage * _featuresPerStage;
+    const float* deltas = _deltas + 2 * stage * _featuresPerStage;
+    int* offsets = _featureOffsets.data();
+    switch (_kernel) {
+#ifdef FACE_LANDMARKS_X86
+    case Kernel_AVX2:
+        featureOffsetsAVX2(g, shape, anchors, deltas, _featuresPerStage, offsets);
+        break;
+    case Kernel_SSE41:
+        featureOffsetsSSE41(g, shape, anchors, deltas, _featuresPerStage, offsets);
+        break;
+#endif
+    default:
+        featureOffsetsScalar(g, shape, anchors, deltas, 0, _featuresPerStage, offsets);
+        break;
+    }
+
+    const unsigned char* data = frame.data;
+    float* values = _featureValues.data();
+    if (g.channels == 1) {
+        for (int f = 0; f < _featuresPerStage; f++)
+            values[f] = (offsets[f] < 0 ? 0 : data[offsets[f]]);
+    }
+    else {
+        for (int f = 0; f < _featuresPerStage; f++) {
+            const unsigned char* p = data + offsets[f];
+            values[f] = (offsets[f] < 0 ? 0 : (p[0] + p[1] + p[2]) / 3);
+        }
+    }
+}
+
+/* One stage of the cascade. With a subset, the last stage only updates the
+ * landmarks in the subset. */
+void FaceLandmarkModel::_runStage(const cv::Mat& frame, const cv::Rect& face, int stage,
+    const int* subset, int subsetSize)
+{
+    const int shapeSize = 2 * _landmarkCount;
+    const int leavesPerTree = _splitsPerTree + 1;
+    _extractFeatures(frame, face, stage);
+    const float* values = _featureValues.data();
+    const Split* splits = _splits + size_t(stage) * _treesPerStage * _splitsPerTree;
+    int* leafIndices = _leafIndices.data();
+    switch (_kernel) {
+#ifdef FACE_LANDMARKS_X86
+    case Kernel_AVX2:
+        if (_treeDepth > 0) {
+            findLeavesAVX2(values, splits, _splitsPerTree, _treeDepth, _treesPerStage, leafIndices);
+            break;
+        }
+        // fall through
+#endif
+    default:
+        findLeavesScalar(values, splits, _splitsPerTree, 0, _treesPerStage, leafIndices);
+        break;
+    }
+    const float* leafValues = _leafValues + size_t(stage) * _treesPerStage * leavesPerTree * shapeSize;
+    for (int t = 0; t < _treesPerStage; t++)
+        _leaves[t] = leafValues + (size_t(t) * leavesPerTree + leafIndices[t]) * shapeSize;
+
+    float* shape = _shape.data();
+    if (subset && stage == _stageCount - 1) {
+        for (int t = 0; t < _treesPerStage; t++) {
+            const float* leaf = _leaves[t];
+            for (int j = 0; j < subsetSize; j++) {
+                shape[2 * subset[j] + 0] += leaf[2 * subset[j] + 0];
+                shape[2 * subset[j] + 1] += leaf[2 * subset[j] + 1];
+            }
+        }
+        return;
+    }
+    switch (_kernel) {
+#ifdef FACE_LANDMARKS_X86
+    case Kernel_AVX2:
+        accumulateLeavesAVX2(shape, _leaves.data(), _treesPerStage, shapeSize);
+        break;
+    case Kernel_SSE41:
+        accumulateLeavesSSE41(shape, _leaves.data(), _treesPerStage, shapeSize);
+        break;
+#endif
+    default:
+        accumulateLeavesScalar(shape, _leaves.data(), _treesPerStage, 0, shapeSize);
+        break;
+    }
+}
+
+void FaceLandmarkModel::_getLandmarks(const cv::Rect& face, cv::Point2f* landmarks) const
+{
+    float sx = face.width - 1;
+    float sy = face.height - 1;
+    for (int i = 0; i < _landmarkCount; i++) {
+        landmarks[i].x = face.x + _shape[2 * i + 0] * sx;
+        landmarks[i].y = face.y + _shape[2 * i + 1] * sy;
+    }
+}
+
+void FaceLandmarkModel::predict(const cv::Mat& frame, const cv::Rect& face, cv::Point2f* landmarks,
+    const int* subset, int subsetSize)
+{
+    std::copy(_initialShape, _initialShape + 2 * _landmarkCount, _shape.begin());
+    for (int s = 0; s < _stageCount; s++)
+        _runStage(frame, face, s, subset, subsetSize);
+    _getLandmarks(face, landmarks);
+}
+
+bool FaceLandmarkModel::predictFrom(const cv::Mat& frame, const cv::Rect& face, const cv::Point2f* initial,
+    int stages, float maxMotion, cv::Point2f* landmarks, const int* subset, int subsetSize)
+{
+    // the cascade works in coordinates relative to the face rectangle
+    float sx = face.width - 1;
+    float sy = face.height - 1;
+    for (int i = 0; i < _landmarkCount; i++) {
+        _shape[2 * i + 0] = (initial[i].x - face.x) / sx;
+        _shape[2 * i + 1] = (initial[i].y - face.y) / sy;
+    }
+    int firstStage = std::max(_stageCount - stages, 0);
+    std::copy(_shape.begin(), _shape.end(), _stageStartShape.begin());
+    // the first stage updates all landmarks, so that its motion is measured on all of them
+    _runStage(frame, face, firstStage, NULL, 0);
+    double sumOfSquares = 0.0;
+    for (int j = 0; j < 2 * _landmarkCount; j++) {
+        float d = _shape[j] - _stageStartShape[j];
+        sumOfSquares += d * d;
+    }
+    float motion = std::sqrt(sumOfSquares / _landmarkCount);
+    if (motion > maxMotion) {
+        predict(frame, face, landmarks, subset, subsetSize);
+        return false;
+    }
+    for (int s = firstStage + 1; s < _stageCount; s++)
+        _runStage(frame, face, s, subset, subsetSize);
+    _getLandmarks(face, landmarks);
+    return true;
+}
@@ -0,0 +1,196 @@
+#ifndef FACE_LANDMARKS_HPP
+#define FACE_LANDMARKS_HPP
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+/*! \cond */
+namespace cv {
+    class Mat;
+    template<typename _Tp> class Rect_;
+    typedef Rect_<int> Rect2i;
+    typedef Rect2i Rect;
+    template<typename _Tp> class Point_;
+    typedef Point_<float> Point2f;
+}
+/*! \endcond */
+
+/*!
+ * \brief Header of a precompiled face landmark model file
+ *
+ * The file holds the model arrays in the layout in which \a FaceLandmarkModel evaluates
+ * them. Each array starts at the given offset, which is a multiple of 64 bytes; the leaf
+ * values, which make up almost all of the file, start at a multiple of the page size.
+ * All values are stored in little endian byte order.
+ */
+struct FaceLandmarkFileHeader
+{
+    char magic[8];                  // "AVLMARK\0"
+    uint32_t version;               // 2
+    uint32_t landmarkCount;
+    uint32_t stageCount;
+    uint32_t treesPerStage;
+    uint32_t splitsPerTree;
+    uint32_t featuresPerStage;
+    uint64_t sourceFileSize;        // size of the dlib file this was converted from
+    uint64_t sourceFileTime;        // last modification time of that file, in the units of the platform
+    uint64_t initialShapeOffset;    // float[2 * landmarkCount]
+    uint64_t anchorsOffset;         // uint16_t[stageCount * featuresPerStage]
+    uint64_t deltasOffset;          // float[2 * stageCount * featuresPerStage]
+    uint64_t splitsOffset;          // {uint16_t idx1, idx2; float thresh}[stageCount * treesPerStage * splitsPerTree]
+    uint64_t leafValuesOffset;      // float[stageCount * treesPerStage * (splitsPerTree + 1) * 2 * landmarkCount]
+    uint64_t fileSize;
+};
+
+/*!
+ * \brief Face landmark model for the \a WebcamHeadTracker
+ *
+ * This evaluates the cascade of regression forests of a dlib shape predictor
+ * (e.g. `shape_predictor_68_face_landmarks.dat`) on its own, with the same
+ * features, transforms and trees as `dlib::shape_predictor`. The results match
+ * dlib up to floating point rounding, except that landmarks are not rounded to
+ * whole pixels.
+ *
+ * In addition, the evaluation can be restricted to a subset of the landmarks.
+ *
+ * A model can be saved in a precompiled flat format (see \a FaceLandmarkFileHeader)
+ * that is memory-mapped and evaluated in place, so that loading it takes no time,
+ * and all trackers and processes that use it share one physical copy.
+ *
+ * On x86 CPUs, the evaluation uses SSE4.1 or AVX2 kernels, chosen at runtime
+ * (see \a setKernel()). All kernels give exactly the same results.
+ */
+class FaceLandmarkModel
+{
+public:
+    /*! \brief Implementation of the evaluation */
+    enum Kernel {
+        Kernel_Auto,    /*!< \brief The fastest kernel that the CPU supports */
+        Kernel_Scalar,  /*!< \brief Plain C++ */
+        Kernel_SSE41,   /*!< \brief SSE4.1: vectorized feature coordinates and leaf accumulation */
+        Kernel_AVX2     /*!< \brief AVX2: additionally walks eight trees at once with gathers */
+    };
+
+    /*! \brief Layout of a tree split in the model data */
+    struct Split {
+        uint16_t idx1;
+        uint16_t idx2;
+        float thresh;
+    };
+
+    FaceLandmarkModel();
+    ~FaceLandmarkModel();
+
+    /*! \brief Load a model
+     * \param fileName          A dlib shape predictor file, or a precompiled model file
+     * \param cacheFileName     Optional: a precompiled model file that is used instead of a
+     *                          dlib file if it was converted from it (same size and modification
+     *                          time), and that is created from it otherwise.
+     *
+     * Returns false if the file cannot be read, or if its trees do not all have the same depth.
+     * Failure to write the cache file is ignored; the model is then used from memory. */
+    bool load(const std::string& fileName, const std::string& cacheFileName = std::string());
+
+    /*! \brief Save the model in the precompiled format
+     *
+     * The model is written to a temporary file in the same directory, which then replaces
+     * the file in one step, so that other processes never map a partially written file.
+     * Returns false if the file cannot be written or replaced; on Windows, a file cannot be
+     * replaced while another process maps it. */
+    bool save(const std::string& fileName) const;
+
+    /*! \brief Choose the implementation of the evaluation
+     *
+     * Returns false, and keeps the current kernel, if the CPU does not support the kernel.
+     * The default is \a Kernel_Auto. */
+    bool setKernel(enum Kernel kernel);
+
+    /*! \brief The kernel in use; never \a Kernel_Auto */
+    enum Kernel kernel() const { return _kernel; }
+
+    /*! \brief Name of a kernel, for diagnostics */
+    static const char* kernelName(enum Kernel kernel);
+
+    /*! \brief Number of landmarks of the model, or 0 if no model is loaded */
+    int landmarkCount() const { return _landmarkCount; }
+
+    /*! \brief Estimate the landmarks of a face
+     * \param frame         8-bit grayscale or BGR frame
+     * \param face          Face rectangle, as found by the face detector
+     * \param landmarks     Array of \a landmarkCount() points that receives the landmarks
+     * \param subset        Indices of the landmarks that are needed, or NULL for all landmarks
+     * \param subsetSize    Number of indices in \a subset (without duplicates)
+     *
+     * With a subset, the last cascade stage only updates the landmarks in the subset. All other
+     * landmarks keep the estimate of the second-to-last stage, which is good enough for e.g. a
+     * bounding box. Earlier stages cannot be restricted, since their features depend on the
+     * similarity transform of the complete shape. */
+    void predict(const cv::Mat& frame, const cv::Rect& face, cv::Point2f* landmarks,
+        const int* subset = NULL, int subsetSize = 0);
+
+    /*! \brief Estimate the landmarks of a face, starting from a previous estimate
+     * \param frame         8-bit grayscale or BGR frame
+     * \param face          Face rectangle
+     * \param initial       Array of \a landmarkCount() points: the initial shape, e.g. the landmarks
+     *                      of the previous frame, placed for \a face. This may be \a landmarks.
+     * \param stages        Number of cascade stages to run; these are the last (finest) stages
+     * \param maxMotion     Maximum RMS landmark update of the first stage that is run, relative
+     *                      to the face width
+     * \param landmarks     Array of \a landmarkCount() points that receives the landmarks
+     * \param subset        See \a predict()
+     * \param subsetSize    See \a predict()
+     *
+     * A larger update of the first stage means that the initial shape is too far off for the
+     * fine stages. In that case, all stages are run from the mean shape, as in \a predict(),
+     * and false is returned. */
+    bool predictFrom(const cv::Mat& frame, const cv::Rect& face, const cv::Point2f* initial,
+        int stages, float maxMotion, cv::Point2f* landmarks,
+        const int* subset = NULL, int subsetSize = 0);
+
+private:
+    enum Kernel _kernel;
+    FaceLandmarkFileHeader _header;
+    int _landmarkCount;
+    int _stageCount;
+    int _treesPerStage;
+    int _splitsPerTree;
+    int _featuresPerStage;
+    int _treeDepth;                 // if all trees are complete binary trees, else 0
+    // the model data in the layout of a precompiled file: either mapped from such a file,
+    // or converted from a dlib file into _buffer (of uint64_t, for alignment)
+    const unsigned char* _data;
+    std::vector<uint64_t> _buffer;
+    size_t _mappedSize;
+#ifdef _WIN32
+    void* _fileHandle;
+    void* _mappingHandle;
+#endif
+    // views of the model data
+    const float* _initialShape;     // initial (mean) shape, relative to the face rectangle
+    const uint16_t* _anchors;       // per stage and feature: the landmark it is anchored to
+    const float* _deltas;           // per stage and feature: its offset from that landmark
+    const Split* _splits;           // per stage and tree: the splits
+    const float* _leafValues;       // per stage, tree and leaf: 2 * landmarkCount floats
+    // centered initial shape and its sum of squared norms, for the similarity transform
+    std::vector<float> _centeredInitialShape;
+    float _initialShapeVariance;
+    // per-call buffers
+    std::vector<float> _shape;
+    std::vector<float> _stageStartShape;
+    std::vector<int> _featureOffsets;
+    std::vector<float> _featureValues;
+    std::vector<int> _leafIndices;
+    std::vector<const float*> _leaves;
+
+    void _unload();
+    bool _map(const std::string& fileName);
+    bool _import(const std::string& fileName);
+    bool _setup(const FaceLandmarkFileHeader& header, size_t dataSize);
+    void _similarityTransform(float* m) const;
+    void _extractFeatures(const cv::Mat& frame, const cv::Rect& face, int stage);
+    void _runStage(const cv::Mat& frame, const cv::Rect& face, int stage, const int* subset, int subsetSize);
+    void _getLandmarks(const cv::Rect& face, cv::Point2f* landmarks) const;
+};
+
+#endif
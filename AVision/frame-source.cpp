@@ -0,0 +1,228 @@
+#include "frame-source.hpp"
+
+#include <algorithm>
+#include <cctype>
+#include <thread>
+
+#include <opencv2/core/core.hpp>
+#include <opencv2/imgcodecs/imgcodecs.hpp>
+#include <opencv2/videoio/videoio.hpp>
+
+static double steadyClockSeconds()
+{
+    return std::chrono::duration<double>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+/* CameraFrameSource */
+
+CameraFrameSource::CameraFrameSource(int index, int width, int height) :
+    _capture(new cv::VideoCapture(index))
+{
+    if (_capture->isOpened()) {
+        _capture->set(cv::CAP_PROP_FRAME_WIDTH, width);
+        _capture->set(cv::CAP_PROP_FRAME_HEIGHT, height);
+    }
+}
+
+CameraFrameSource::~CameraFrameSource()
+{
+    delete _capture;
+}
+
+bool CameraFrameSource::isOpened() const
+{
+    return _capture->isOpened();
+}
+
+int CameraFrameSource::width() const
+{
+    return _capture->get(cv::CAP_PROP_FRAME_WIDTH);
+}
+
+int CameraFrameSource::height() const
+{
+    return _capture->get(cv::CAP_PROP_FRAME_HEIGHT);
+}
+
+float CameraFrameSource::fps() const
+{
+    return _capture->get(cv::CAP_PROP_FPS);
+}
+
+bool CameraFrameSource::read(cv::Mat& frame, double& timestamp)
+{
+    bool ok = _capture->read(frame);
+    timestamp = steadyClockSeconds();
+    return ok;
+}
+
+/* ReplayFrameSource */
+
+ReplayFrameSource::ReplayFrameSource() :
+    _pacing(Pacing_Real_Time),
+    _loop(false),
+    _atEnd(false),
+    _started(false),
+    _timestampOffset(0.0),
+    _lastTimestamp(0.0)
+{
+}
+
+bool ReplayFrameSource::read(cv::Mat& frame, double& timestamp)
+{
+    if (_atEnd)
+        return false;
+    double recordedTimestamp;
+    if (!readRecorded(frame, recordedTimestamp)) {
+        if (!_loop || !rewind() || !readRecorded(frame, recordedTimestamp)) {
+            _atEnd = true;
+            return false;
+        }
+        // continue one nominal frame interval after the last frame
+        float f = fps();
+        _timestampOffset = _lastTimestamp + (f > 0.0f ? 1.0 / f : 0.0) - recordedTimestamp;
+    }
+    timestamp = recordedTimestamp + _timestampOffset;
+    _lastTimestamp = timestamp;
+    if (!_started) {
+        _startTime = std::chrono::steady_clock::now() - std::chrono::duration_cast<std::chrono::steady_clock::duration>(
+            std::chrono::duration<double>(timestamp));
+        _started = true;
+    }
+    if (_pacing == Pacing_Real_Time) {
+        std::this_thread::sleep_until(_startTime + std::chrono::duration_cast<std::chrono::steady_clock::duration>(
+            std::chrono::duration<double>(timestamp)));
+    }
+    return true;
+}
+
+/* VideoFileFrameSource */
+
+VideoFileFrameSource::VideoFileFrameSource(const std::string& fileName) :
+    _capture(new cv::VideoCapture(fileName)),
+    _fps(0.0f),
+    _index(0)
+{
+    if (_capture->isOpened())
+        _fps = _capture->get(cv::CAP_PROP_FPS);
+    if (_fps <= 0.0f)
+        _fps = 30.0f;
+}
+
+VideoFileFrameSource::~VideoFileFrameSource()
+{
+    delete _capture;
+}
+
+bool VideoFileFrameSource::isOpened() const
+{
+    return _capture->isOpened();
+}
+
+int VideoFileFrameSource::width() const
+{
+    return _capture->get(cv::CAP_PROP_FRAME_WIDTH);
+}
+
+int VideoFileFrameSource::height() const
+{
+    return _capture->get(cv::CAP_PROP_FRAME_HEIGHT);
+}
+
+float VideoFileFrameSource::fps() const
+{
+    return _fps;
+}
+
+bool VideoFileFrameSource::readRecorded(cv::Mat& frame, double& timestamp)
+{
+    if (!_capture->read(frame))
+        return false;
+    // container timestamps are not reliable for all formats, so use the frame index
+    timestamp = _index / _fps;
+    _index++;
+    return true;
+}
+
+bool VideoFileFrameSource::rewind()
+{
+    _index = 0;
+    return _capture->set(cv::CAP_PROP_POS_FRAMES, 0);
+}
+
+/* ImageSequenceFrameSource */
+
+static bool isImageFileName(const std::string& fileName)
+{
+    static const char* extensions[] = { ".png", ".jpg", ".jpeg", ".bmp", ".pgm", ".ppm", ".tif", ".tiff" };
+    std::string lower = fileName;
+    std::transform(lower.begin(), lower.end(), lower.begin(), [](unsigned char c) { return std::tolower(c); });
+    for (const char* ext : extensions) {
+        size_t n = std::char_traits<char>::length(ext);
+        if (lower.size() > n && lower.compare(lower.size() - n, n, ext) == 0)
+            return true;
+    }
+    return false;
+}
+
+ImageSequenceFrameSource::ImageSequenceFrameSource(const std::string& directory, float fps) :
+    _fps(fps > 0.0f ? fps : 30.0f),
+    _w(0), _h(0),
+    _index(0)
+{
+    std::vector<cv::String> fileNames;
+    try {
+        cv::glob(directory, fileNames, false);
+    }
+    catch (cv::Exception& e) {
+        return;
+    }
+    for (size_t i = 0; i < fileNames.size(); i++) {
+        if (isImageFileName(fileNames[i]))
+            _fileNames.push_back(fileNames[i]);
+    }
+    std::sort(_fileNames.begin(), _fileNames.end());
+    if (!_fileNames.empty()) {
+        cv::Mat first = cv::imread(_fileNames[0], cv::IMREAD_COLOR);
+        _w = first.cols;
+        _h = first.rows;
+    }
+}
+
+bool ImageSequenceFrameSource::isOpened() const
+{
+    return _w > 0 && _h > 0;
+}
+
+int ImageSequenceFrameSource::width() const
+{
+    return _w;
+}
+
+int ImageSequenceFrameSource::height() const
+{
+    return _h;
+}
+
+float ImageSequenceFrameSource::fps() const
+{
+    return _fps;
+}
+
+bool ImageSequenceFrameSource::readRecorded(cv::Mat& frame, double& timestamp)
+{
+    while (_index < _fileNames.size()) {
+        frame = cv::imread(_fileNames[_index], cv::IMREAD_COLOR);
+        timestamp = _index / _fps;
+        _index++;
+        if (!frame.empty())
+            return true;
+    }
+    return false;
+}
+
+bool ImageSequenceFrameSource::rewind()
+{
+    _index = 0;
+    return !_fileNames.empty();
+}
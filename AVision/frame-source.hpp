@@ -0,0 +1,178 @@
+#ifndef FRAME_SOURCE_HPP
+#define FRAME_SOURCE_HPP
+
+#include <string>
+#include <vector>
+#include <chrono>
+
+/*! \cond */
+namespace cv {
+    class VideoCapture;
+    class Mat;
+}
+/*! \endcond */
+
+/*!
+ * \brief Source of frames for the \a WebcamHeadTracker
+ *
+ * A frame source delivers BGR frames together with their capture timestamps.
+ * Timestamps are in seconds. Live sources use the steady clock, replay sources
+ * use the position of the frame in the recording.
+ */
+class FrameSource
+{
+public:
+    virtual ~FrameSource() {}
+
+    /*! \brief Returns true if the source could be opened */
+    virtual bool isOpened() const = 0;
+
+    /*! \brief Frame width in pixels */
+    virtual int width() const = 0;
+    /*! \brief Frame height in pixels */
+    virtual int height() const = 0;
+    /*! \brief Nominal frame rate in frames per second, or 0 if unknown */
+    virtual float fps() const = 0;
+
+    /*! \brief Read the next frame
+     * \param frame     The frame
+     * \param timestamp The capture time of the frame in seconds
+     *
+     * Returns false if no frame could be read. */
+    virtual bool read(cv::Mat& frame, double& timestamp) = 0;
+
+    /*! \brief Returns true if a replay source has delivered all of its frames.
+     *
+     * Live sources never end. */
+    virtual bool atEnd() const { return false; }
+};
+
+/*!
+ * \brief Live camera
+ */
+class CameraFrameSource : public FrameSource
+{
+public:
+    /*! \brief Constructor
+     * \param index     OpenCV camera index
+     * \param width     Requested frame width
+     * \param height    Requested frame height */
+    CameraFrameSource(int index = 0, int width = 640, int height = 480);
+    ~CameraFrameSource();
+
+    bool isOpened() const override;
+    int width() const override;
+    int height() const override;
+    float fps() const override;
+    bool read(cv::Mat& frame, double& timestamp) override;
+
+private:
+    cv::VideoCapture* _capture;
+};
+
+/*!
+ * \brief Base class for sources that replay recorded frames
+ *
+ * Replay sources either reproduce the timing of the recording, or deliver
+ * frames as fast as the consumer reads them (useful for benchmarks).
+ * In both cases the timestamps correspond to the recording, so that the
+ * tracker sees the same frame intervals as during capture.
+ */
+class ReplayFrameSource : public FrameSource
+{
+public:
+    /*! \brief Replay pacing */
+    enum Pacing {
+        /*! \brief Deliver each frame at the time it was recorded, relative to the first read */
+        Pacing_Real_Time,
+        /*! \brief Deliver frames as fast as they are read */
+        Pacing_As_Fast_As_Possible
+    };
+
+    /*! \brief Set the replay pacing. The default is \a Pacing_Real_Time. */
+    void setPacing(enum Pacing pacing) { _pacing = pacing; }
+
+    /*! \brief Set whether to restart at the first frame after the last one. The default is false. */
+    void setLoop(bool loop) { _loop = loop; }
+
+    bool read(cv::Mat& frame, double& timestamp) override;
+    bool atEnd() const override { return _atEnd; }
+
+protected:
+    ReplayFrameSource();
+
+    /*! \brief Read the next recorded frame and its timestamp relative to the start of the recording.
+     *
+     * Returns false at the end of the recording. */
+    virtual bool readRecorded(cv::Mat& frame, double& timestamp) = 0;
+    /*! \brief Restart at the first frame */
+    virtual bool rewind() = 0;
+
+private:
+    enum Pacing _pacing;
+    bool _loop;
+    bool _atEnd;
+    bool _started;
+    std::chrono::steady_clock::time_point _startTime;
+    // added to recorded timestamps so that they keep increasing when looping
+    double _timestampOffset;
+    double _lastTimestamp;
+};
+
+/*!
+ * \brief Replay of a video file
+ */
+class VideoFileFrameSource : public ReplayFrameSource
+{
+public:
+    /*! \brief Constructor
+     * \param fileName  Name of a video file that OpenCV can decode */
+    VideoFileFrameSource(const std::string& fileName);
+    ~VideoFileFrameSource();
+
+    bool isOpened() const override;
+    int width() const override;
+    int height() const override;
+    float fps() const override;
+
+protected:
+    bool readRecorded(cv::Mat& frame, double& timestamp) override;
+    bool rewind() override;
+
+private:
+    cv::VideoCapture* _capture;
+    float _fps;
+    int _index;
+};
+
+/*!
+ * \brief Replay of a directory of images
+ *
+ * All image files in the directory are used in lexicographical order
+ * of their file names.
+ */
+class ImageSequenceFrameSource : public ReplayFrameSource
+{
+public:
+    /*! \brief Constructor
+     * \param directory Directory containing the images
+     * \param fps       Frame rate of the image sequence */
+    ImageSequenceFrameSource(const std::string& directory, float fps = 30.0f);
+
+    bool isOpened() const override;
+    int width() const override;
+    int height() const override;
+    float fps() const override;
+
+protected:
+    bool readRecorded(cv::Mat& frame, double& timestamp) override;
+    bool rewind() override;
+
+private:
+    std::vector<std::string> _fileNames;
+    float _fps;
+    int _w, _h;
+    size_t _index;
+};
+
+#endif
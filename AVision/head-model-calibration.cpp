@@ -0,0 +1,552 @@
+#include "head-model-calibration.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+
+#include <opencv2/core/core.hpp>
+
+/* Frames: at least this many, each rotated by at least this angle against the previous one */
+static const int minFrames = 20;
+static const double minRotationChange = 0.02;  // radians, about 1 degree
+
+/* Bundle adjustment: at most this many Levenberg-Marquardt iterations, or until
+ * the error hardly decreases */
+static const int maxIterations = 50;
+static const double minCostDecrease = 1e-8;    // relative
+
+/* Regularization: the squared distance of each model coordinate from its average
+ * value is added to the squared reprojection errors with this weight (in squared
+ * pixels per squared mm; a single frame at 50 cm distance weighs about 1). */
+static const double priorWeight = 0.05;
+
+/* Plausibility: no calibrated point may be farther from its average position (mm) */
+static const double maxDeviation = 25.0;
+
+/* The free coordinates of the mirror symmetric model, for each model point:
+ * the parameter indices of its coordinates, and the sign of its x coordinate.
+ * The eye corners and the tragions share their parameters with their mirror
+ * images; the points on the midline have x = 0. */
+static const int parameterCount = 12;
+struct PointParameters {
+    int x, y, z;    // parameter indices; -1 for a coordinate that is always 0
+    double sign;    // sign of the x coordinate
+};
+static const PointParameters pointParameters[HeadPoseSolver::pointCount] = {
+    { 0, 1, 2, -1.0 },      // left eye corner
+    { 0, 1, 2, -1.0 },
+    { 0, 1, 2, +1.0 },      // right eye corner
+    { 0, 1, 2, +1.0 },
+    { -1, 3, 4, 0.0 },      // sellion
+    { -1, 5, 6, 0.0 },      // subnasale
+    { -1, 7, 8, 0.0 },      // stomion
+    { 9, 10, 11, -1.0 },    // left tragion
+    { 9, 10, 11, +1.0 }     // right tragion
+};
+
+static void modelFromParameters(const double* parameters, double (*model)[3])
+{
+    for (int p = 0; p < HeadPoseSolver::pointCount; p++) {
+        const PointParameters& pp = pointParameters[p];
+        model[p][0] = (pp.x < 0 ? 0.0 : pp.sign * parameters[pp.x]);
+        model[p][1] = parameters[pp.y];
+        model[p][2] = parameters[pp.z];
+    }
+}
+
+static void parametersFromModel(const double (*model)[3], double* parameters)
+{
+    for (int p = HeadPoseSolver::pointCount - 1; p >= 0; p--) {
+        const PointParameters& pp = pointParameters[p];
+        if (pp.x >= 0)
+            parameters[pp.x] = pp.sign * model[p][0];
+        parameters[pp.y] = model[p][1];
+        parameters[pp.z] = model[p][2];
+    }
+}
+
+/* Solve the symmetric positive definite n x n system A x = b (n <= parameterCount)
+ * with a Cholesky decomposition. Returns false if A is not positive definite. */
+static bool solveCholesky(int n, const double* A, const double* b, double* x)
+{
+    double L[parameterCount * parameterCount];
+    for (int i = 0; i < n; i++) {
+        for (int j = 0; j <= i; j++) {
+            double sum = A[n * i + j];
+            for (int k = 0; k < j; k++)
+                sum -= L[n * i + k] * L[n * j + k];
+            if (i == j) {
+                if (!(sum > 0.0))
+                    return false;
+                L[n * i + i] = std::sqrt(sum);
+            }
+            else {
+                L[n * i + j] = sum / L[n * j + j];
+            }
+        }
+    }
+    double y[parameterCount];
+    for (int i = 0; i < n; i++) {
+        double sum = b[i];
+        for (int k = 0; k < i; k++)
+            sum -= L[n * i + k] * y[k];
+        y[i] = sum / L[n * i + i];
+    }
+    for (int i = n - 1; i >= 0; i--) {
+        double sum = y[i];
+        for (int k = i + 1; k < n; k++)
+            sum -= L[n * k + i] * x[k];
+        x[i] = sum / L[n * i + i];
+    }
+    return true;
+}
+
+/* Eigenvector of the largest eigenvalue of the symmetric 4x4 matrix A,
+ * with the Jacobi method. A is destroyed. */
+static void largestEigenvector4(double (*A)[4], double* v)
+{
+    double V[4][4] = { { 1, 0, 0, 0 }, { 0, 1, 0, 0 }, { 0, 0, 1, 0 }, { 0, 0, 0, 1 } };
+    for (int sweep = 0; sweep < 10; sweep++) {
+        for (int p = 0; p < 3; p++) {
+            for (int q = p + 1; q < 4; q++) {
+                if (A[p][q] == 0.0)
+                    continue;
+                // the rotation in the (p, q) plane that zeroes A[p][q]
+                double theta = (A[q][q] - A[p][p]) / (2.0 * A[p][q]);
+                double t = 1.0 / (std::abs(theta) + std::sqrt(theta * theta + 1.0));
+                if (theta < 0.0)
+                    t = -t;
+                double c = 1.0 / std::sqrt(t * t + 1.0);
+                double s = t * c;
+                for (int k = 0; k < 4; k++) {
+                    double akp = A[k][p], akq = A[k][q];
+                    A[k][p] = c * akp - s * akq;
+                    A[k][q] = s * akp + c * akq;
+                }
+                for (int k = 0; k < 4; k++) {
+                    double apk = A[p][k], aqk = A[q][k];
+                    A[p][k] = c * apk - s * aqk;
+                    A[q][k] = s * apk + c * aqk;
+                }
+                for (int k = 0; k < 4; k++) {
+                    double vkp = V[k][p], vkq = V[k][q];
+                    V[k][p] = c * vkp - s * vkq;
+                    V[k][q] = s * vkp + c * vkq;
+                }
+            }
+        }
+    }
+    int largest = 0;
+    for (int i = 1; i < 4; i++) {
+        if (A[i][i] > A[largest][largest])
+            largest = i;
+    }
+    for (int i = 0; i < 4; i++)
+        v[i] = V[i][largest];
+}
+
+HeadModelCalibration::HeadModelCalibration(const cv::Point3f* averageModel) :
+    _initialRmsError(0.0),
+    _rmsError(0.0)
+{
+    for (int i = 0; i < HeadPoseSolver::pointCount; i++) {
+        _averageModel[i][0] = averageModel[i].x;
+        _averageModel[i][1] = averageModel[i].y;
+        _averageModel[i][2] = averageModel[i].z;
+    }
+}
+
+void HeadModelCalibration::reset()
+{
+    _frames.clear();
+}
+
+bool HeadModelCalibration::addFrame(const CameraIntrinsics& camera, const cv::Point2f* imagePoints,
+    const double* rvec, const double* tvec)
+{
+    if (!_frames.empty()) {
+        // the angle between two rotations follows from the trace of R0^T R1
+        double R0[9], R1[9];
+        HeadPoseSolver::rotationMatrix(_frames.back().rvec, R0);
+        HeadPoseSolver::rotationMatrix(rvec, R1);
+        double trace = 0.0;
+        for (int i = 0; i < 9; i++)
+            trace += R0[i] * R1[i];
+        if (0.5 * (trace - 1.0) > std::cos(minRotationChange))
+            return false;
+    }
+    Frame frame;
+    frame.camera = camera;
+    for (int i = 0; i < HeadPoseSolver::pointCount; i++) {
+        frame.imagePoints[i][0] = imagePoints[i].x;
+        frame.imagePoints[i][1] = imagePoints[i].y;
+    }
+    for (int i = 0; i < 3; i++) {
+        frame.rvec[i] = rvec[i];
+        frame.tvec[i] = tvec[i];
+    }
+    _frames.push_back(frame);
+    return true;
+}
+
+/* Sum of the squared reprojection errors over all frames for the model
+ * parameters and the poses, plus the regularization. If U is given, the
+ * normal equations of a Gauss-Newton step are computed, too: for the model
+ * parameters U = Jm^T Jm (12x12) and gm = Jm^T r, and for each frame f its
+ * pose block V[f] = Jp^T Jp (6x6), the mixed block W[f] = Jm^T Jp (12x6)
+ * and gp[f] = Jp^T r. The poses are updated like in HeadPoseSolver, with
+ * R <- exp(w) R and t <- t + dt. Returns infinity if a point is not in front
+ * of the camera. */
+double HeadModelCalibration::_normalEquations(const double* parameters, const std::vector<Pose>& poses,
+    double* U, double* gm, double* V, double* W, double* gp) const
+{
+    const int n = parameterCount;
+    double model[HeadPoseSolver::pointCount][3];
+    modelFromParameters(parameters, model);
+    double average[parameterCount];
+    parametersFromModel(_averageModel, average);
+    double cost = 0.0;
+    for (int i = 0; i < n; i++)
+        cost += priorWeight * (parameters[i] - average[i]) * (parameters[i] - average[i]);
+    if (U) {
+        for (int i = 0; i < n * n; i++)
+            U[i] = 0.0;
+        for (int i = 0; i < n; i++) {
+            U[n * i + i] = priorWeight;
+            gm[i] = priorWeight * (parameters[i] - average[i]);
+        }
+    }
+    for (size_t f = 0; f < poses.size(); f++) {
+        const double* R = poses[f].R;
+        const double* t = poses[f].t;
+        double* Vf = (U ? V + 36 * f : NULL);
+        double* Wf = (U ? W + 6 * n * f : NULL);
+        double* gpf = (U ? gp + 6 * f : NULL);
+        if (U) {
+            for (int i = 0; i < 36; i++)
+                Vf[i] = 0.0;
+            for (int i = 0; i < 6 * n; i++)
+                Wf[i] = 0.0;
+            for (int i = 0; i < 6; i++)
+                gpf[i] = 0.0;
+        }
+        for (int p = 0; p < HeadPoseSolver::pointCount; p++) {
+            const double* M = model[p];
+            double r[3], P[3];
+            for (int i = 0; i < 3; i++) {
+                r[i] = R[3 * i] * M[0] + R[3 * i + 1] * M[1] + R[3 * i + 2] * M[2];
+                P[i] = r[i] + t[i];
+            }
+            if (!(P[2] > 0.0))
+                return std::numeric_limits<double>::infinity();
+            double pixel[2], dP[6];
+            HeadPoseSolver::project(_frames[f].camera, P, pixel, U ? dP : NULL);
+            double e[2] = { pixel[0] - _frames[f].imagePoints[p][0], pixel[1] - _frames[f].imagePoints[p][1] };
+            cost += e[0] * e[0] + e[1] * e[1];
+            if (!U)
+                continue;
+
+            // pose: d/dw = -dP [R M]x and d/dt = dP, as in HeadPoseSolver
+            double Jp[2][6];
+            for (int k = 0; k < 2; k++) {
+                const double* d = dP + 3 * k;
+                Jp[k][0] = d[2] * r[1] - d[1] * r[2];
+                Jp[k][1] = d[0] * r[2] - d[2] * r[0];
+                Jp[k][2] = d[1] * r[0] - d[0] * r[1];
+                Jp[k][3] = d[0];
+                Jp[k][4] = d[1];
+                Jp[k][5] = d[2];
+            }
+            // model parameters: dP R, mapped to the parameters of the point
+            const PointParameters& pp = pointParameters[p];
+            double Jm[2][parameterCount] = { { 0.0 } };
+            for (int k = 0; k < 2; k++) {
+                const double* d = dP + 3 * k;
+                double JM[3];
+                for (int c = 0; c < 3; c++)
+                    JM[c] = d[0] * R[c] + d[1] * R[3 + c] + d[2] * R[6 + c];
+                if (pp.x >= 0)
+                    Jm[k][pp.x] += pp.sign * JM[0];
+                Jm[k][pp.y] += JM[1];
+                Jm[k][pp.z] += JM[2];
+            }
+            for (int k = 0; k < 2; k++) {
+                for (int i = 0; i < n; i++) {
+                    if (Jm[k][i] == 0.0)
+                        continue;
+                    for (int j = 0; j < n; j++)
+                        U[n * i + j] += Jm[k][i] * Jm[k][j];
+                    for (int j = 0; j < 6; j++)
+                        Wf[6 * i + j] += Jm[k][i] * Jp[k][j];
+                    gm[i] += Jm[k][i] * e[k];
+                }
+                for (int i = 0; i < 6; i++) {
+                    for (int j = 0; j < 6; j++)
+                        Vf[6 * i + j] += Jp[k][i] * Jp[k][j];
+                    gpf[i] += Jp[k][i] * e[k];
+                }
+            }
+        }
+    }
+    return cost;
+}
+
+/* Fix what the frames cannot determine: scale, rotate and move the model to
+ * best match the average model (Horn's closed-form absolute orientation with
+ * unit quaternions). The poses would change accordingly, but they are not
+ * needed anymore. */
+void HeadModelCalibration::_alignToAverage(double (*model)[3]) const
+{
+    const int n = HeadPoseSolver::pointCount;
+    double modelCenter[3] = { 0.0, 0.0, 0.0 };
+    double averageCenter[3] = { 0.0, 0.0, 0.0 };
+    for (int p = 0; p < n; p++) {
+        for (int i = 0; i < 3; i++) {
+            modelCenter[i] += model[p][i] / n;
+            averageCenter[i] += _averageModel[p][i] / n;
+        }
+    }
+    double S[3][3] = { { 0.0 } };
+    double modelVariance = 0.0;
+    for (int p = 0; p < n; p++) {
+        double a[3], b[3];
+        for (int i = 0; i < 3; i++) {
+            a[i] = model[p][i] - modelCenter[i];
+            b[i] = _averageModel[p][i] - averageCenter[i];
+            modelVariance += a[i] * a[i];
+        }
+        for (int i = 0; i < 3; i++) {
+            for (int j = 0; j < 3; j++)
+                S[i][j] += a[i] * b[j];
+        }
+    }
+    double N[4][4] = {
+        { S[0][0] + S[1][1] + S[2][2], S[1][2] - S[2][1], S[2][0] - S[0][2], S[0][1] - S[1][0] },
+        { S[1][2] - S[2][1], S[0][0] - S[1][1] - S[2][2], S[0][1] + S[1][0], S[2][0] + S[0][2] },
+        { S[2][0] - S[0][2], S[0][1] + S[1][0], -S[0][0] + S[1][1] - S[2][2], S[1][2] + S[2][1] },
+        { S[0][1] - S[1][0], S[2][0] + S[0][2], S[1][2] + S[2][1], -S[0][0] - S[1][1] + S[2][2] }
+    };
+    double q[4];
+    largestEigenvector4(N, q);
+    double w = q[0], x = q[1], y = q[2], z = q[3];
+    double R[9] = {
+        w * w + x * x - y * y - z * z, 2.0 * (x * y - w * z), 2.0 * (x * z + w * y),
+        2.0 * (x * y + w * z), w * w - x * x + y * y - z * z, 2.0 * (y * z - w * x),
+        2.0 * (x * z - w * y), 2.0 * (y * z + w * x), w * w - x * x - y * y + z * z
+    };
+    // the scale that best maps the rotated model onto the average model
+    double correlation = 0.0;
+    double aligned[HeadPoseSolver::pointCount][3];
+    for (int p = 0; p < n; p++) {
+        double a[3] = { model[p][0] - modelCenter[0], model[p][1] - modelCenter[1], model[p][2] - modelCenter[2] };
+        for (int i = 0; i < 3; i++) {
+            aligned[p][i] = R[3 * i] * a[0] + R[3 * i + 1] * a[1] + R[3 * i + 2] * a[2];
+            correlation += aligned[p][i] * (_averageModel[p][i] - averageCenter[i]);
+        }
+    }
+    double scale = correlation / modelVariance;
+    for (int p = 0; p < n; p++) {
+        for (int i = 0; i < 3; i++)
+            model[p][i] = scale * aligned[p][i] + averageCenter[i];
+    }
+}
+
+bool HeadModelCalibration::solve(cv::Point3f* model)
+{
+    const int n = parameterCount;
+    const int pointCount = HeadPoseSolver::pointCount;
+    if (frameCount() < minFrames)
+        return false;
+
+    // poses for the average model, from the poses that the frames came with
+    std::vector<Pose> poses(_frames.size());
+    cv::Point3f averagePoints[HeadPoseSolver::pointCount];
+    for (int p = 0; p < pointCount; p++)
+        averagePoints[p] = cv::Point3f(_averageModel[p][0], _averageModel[p][1], _averageModel[p][2]);
+    HeadPoseSolver solver(averagePoints);
+    for (size_t f = 0; f < _frames.size(); f++) {
+        cv::Point2f imagePoints[HeadPoseSolver::pointCount];
+        for (int p = 0; p < pointCount; p++)
+            imagePoints[p] = cv::Point2f(_frames[f].imagePoints[p][0], _frames[f].imagePoints[p][1]);
+        double rvec[3] = { _frames[f].rvec[0], _frames[f].rvec[1], _frames[f].rvec[2] };
+        double tvec[3] = { _frames[f].tvec[0], _frames[f].tvec[1], _frames[f].tvec[2] };
+        if (!solver.solve(_frames[f].camera, imagePoints, rvec, tvec))
+            return false;
+        HeadPoseSolver::rotationMatrix(rvec, poses[f].R);
+        for (int i = 0; i < 3; i++)
+            poses[f].t[i] = tvec[i];
+    }
+
+    // Levenberg-Marquardt on the model parameters and the poses. The poses only
+    // couple through the model, so they are eliminated from the normal equations
+    // (Schur complement), which leaves a 12x12 system.
+    double parameters[parameterCount];
+    parametersFromModel(_averageModel, parameters);
+    std::vector<double> V(36 * poses.size()), W(6 * n * poses.size()), gp(6 * poses.size());
+    double U[parameterCount * parameterCount], gm[parameterCount];
+    double cost = _normalEquations(parameters, poses, U, gm, V.data(), W.data(), gp.data());
+    if (cost == std::numeric_limits<double>::infinity())
+        return false;
+    double initialCost = cost;
+    std::vector<Pose> newPoses(poses.size());
+    std::vector<double> Vinv(36 * poses.size());
+    double lambda = 1e-3;
+    for (int iteration = 0; iteration < maxIterations; iteration++) {
+        // S = U - sum W V^-1 W^T and b = -gm + sum W V^-1 gp, with damped diagonals
+        double S[parameterCount * parameterCount], b[parameterCount];
+        for (int i = 0; i < n * n; i++)
+            S[i] = U[i];
+        for (int i = 0; i < n; i++) {
+            S[n * i + i] *= 1.0 + lambda;
+            b[i] = -gm[i];
+        }
+        bool solvable = true;
+        for (size_t f = 0; f < poses.size() && solvable; f++) {
+            double Vf[36];
+            for (int i = 0; i < 36; i++)
+                Vf[i] = V[36 * f + i];
+            for (int i = 0; i < 6; i++)
+                Vf[7 * i] *= 1.0 + lambda;
+            // the columns of the inverse of the damped V
+            double* inv = &Vinv[36 * f];
+            for (int j = 0; j < 6 && solvable; j++) {
+                double unit[6] = { 0.0, 0.0, 0.0, 0.0, 0.0, 0.0 };
+                unit[j] = 1.0;
+                double column[6];
+                solvable = solveCholesky(6, Vf, unit, column);
+                for (int i = 0; i < 6; i++)
+                    inv[6 * i + j] = column[i];
+            }
+            const double* Wf = &W[6 * n * f];
+            for (int i = 0; i < n; i++) {
+                double Y[6];    // row i of W V^-1
+                for (int j = 0; j < 6; j++) {
+                    Y[j] = 0.0;
+                    for (int k = 0; k < 6; k++)
+                        Y[j] += Wf[6 * i + k] * inv[6 * k + j];
+                }
+                for (int j = 0; j < n; j++) {
+                    for (int k = 0; k < 6; k++)
+                        S[n * i + j] -= Y[k] * Wf[6 * j + k];
+                }
+                for (int k = 0; k < 6; k++)
+                    b[i] += Y[k] * gp[6 * f + k];
+            }
+        }
+        double step[parameterCount];
+        if (!solvable || !solveCholesky(n, S, b, step)) {
+            lambda *= 10.0;
+            if (lambda > 1e10)
+                break;
+            continue;
+        }
+        // back-substitute the pose steps: dp = V^-1 (-gp - W^T dm)
+        double newParameters[parameterCount];
+        for (int i = 0; i < n; i++)
+            newParameters[i] = parameters[i] + step[i];
+        for (size_t f = 0; f < poses.size(); f++) {
+            const double* Wf = &W[6 * n * f];
+            const double* inv = &Vinv[36 * f];
+            double rhs[6], poseStep[6];
+            for (int k = 0; k < 6; k++) {
+                rhs[k] = -gp[6 * f + k];
+                for (int i = 0; i < n; i++)
+                    rhs[k] -= Wf[6 * i + k] * step[i];
+            }
+            for (int k = 0; k < 6; k++) {
+                poseStep[k] = 0.0;
+                for (int j = 0; j < 6; j++)
+                    poseStep[k] += inv[6 * k + j] * rhs[j];
+            }
+            double E[9];
+            HeadPoseSolver::rotationMatrix(poseStep, E);
+            for (int i = 0; i < 3; i++) {
+                for (int j = 0; j < 3; j++) {
+                    newPoses[f].R[3 * i + j] = E[3 * i] * poses[f].R[j]
+                        + E[3 * i + 1] * poses[f].R[3 + j] + E[3 * i + 2] * poses[f].R[6 + j];
+                }
+                newPoses[f].t[i] = poses[f].t[i] + poseStep[3 + i];
+            }
+        }
+        double newCost = _normalEquations(newParameters, newPoses, NULL, NULL, NULL, NULL, NULL);
+        if (!(newCost <= cost)) {
+            lambda *= 10.0;
+            if (lambda > 1e10)
+                break;
+            continue;
+        }
+        double decrease = (cost - newCost) / cost;
+        for (int i = 0; i < n; i++)
+            parameters[i] = newParameters[i];
+        poses.swap(newPoses);
+        lambda = std::max(lambda * 0.1, 1e-9);
+        if (decrease < minCostDecrease) {
+            cost = newCost;
+            break;
+        }
+        cost = _normalEquations(parameters, poses, U, gm, V.data(), W.data(), gp.data());
+    }
+    // the regularization is part of the costs, but not of the reprojection errors
+    double calibrated[HeadPoseSolver::pointCount][3];
+    modelFromParameters(parameters, calibrated);
+    double average[parameterCount];
+    parametersFromModel(_averageModel, average);
+    double prior = 0.0;
+    for (int i = 0; i < n; i++)
+        prior += priorWeight * (parameters[i] - average[i]) * (parameters[i] - average[i]);
+    _initialRmsError = std::sqrt(initialCost / (_frames.size() * pointCount));
+    _rmsError = std::sqrt(std::max(cost - prior, 0.0) / (_frames.size() * pointCount));
+    if (!(cost < initialCost))
+        return false;
+
+    _alignToAverage(calibrated);
+    for (int p = 0; p < pointCount; p++) {
+        double dx = calibrated[p][0] - _averageModel[p][0];
+        double dy = calibrated[p][1] - _averageModel[p][1];
+        double dz = calibrated[p][2] - _averageModel[p][2];
+        if (!(std::sqrt(dx * dx + dy * dy + dz * dz) <= maxDeviation))
+            return false;
+    }
+    for (int p = 0; p < pointCount; p++)
+        model[p] = cv::Point3f(calibrated[p][0], calibrated[p][1], calibrated[p][2]);
+    return true;
+}
+
+bool HeadModelCalibration::load(const std::string& fileName, cv::Point3f* model)
+{
+    cv::Mat points;
+    try {
+        cv::FileStorage fs(fileName, cv::FileStorage::READ);
+        if (!fs.isOpened())
+            return false;
+        fs["head_model"] >> points;
+    }
+    catch (cv::Exception& e) {
+        return false;
+    }
+    if (points.rows != HeadPoseSolver::pointCount || points.cols != 3 || points.type() != CV_32F)
+        return false;
+    for (int p = 0; p < HeadPoseSolver::pointCount; p++)
+        model[p] = cv::Point3f(points.at<float>(p, 0), points.at<float>(p, 1), points.at<float>(p, 2));
+    return true;
+}
+
+bool HeadModelCalibration::save(const std::string& fileName, const cv::Point3f* model)
+{
+    cv::Mat points(HeadPoseSolver::pointCount, 3, CV_32F);
+    for (int p = 0; p < HeadPoseSolver::pointCount; p++) {
+        points.at<float>(p, 0) = model[p].x;
+        points.at<float>(p, 1) = model[p].y;
+        points.at<float>(p, 2) = model[p].z;
+    }
+    try {
+        cv::FileStorage fs(fileName, cv::FileStorage::WRITE);
+        if (!fs.isOpened())
+            return false;
+        fs << "head_model" << points;
+    }
+    catch (cv::Exception& e) {
+        return false;
+    }
+    return true;
+}
@@ -0,0 +1,99 @@
+#ifndef HEAD_MODEL_CALIBRATION_HPP
+#define HEAD_MODEL_CALIBRATION_HPP
+
+#include <string>
+#include <vector>
+
+#include "head-pose-solver.hpp"
+
+/*!
+ * \brief Fits the head model of the \a WebcamHeadTracker to the face of one user
+ *
+ * The default head model holds average landmark positions. Faces that differ from
+ * the average get a biased pose, and the pose solver needs more iterations for them.
+ * This class collects the landmarks and poses of a number of frames, and then refines
+ * the model points and all poses together so that the model explains the landmarks
+ * of all frames best (bundle adjustment, with Levenberg-Marquardt steps that eliminate
+ * the poses with the Schur complement).
+ *
+ * The calibrated model is mirror symmetric, so only 12 model coordinates are free. It
+ * is pulled slightly towards the average model, which matters for the directions in
+ * which the frames hardly constrain it, e.g. the depth of the points if the head never
+ * turns. A single camera cannot tell the size of a head from its distance, so finally
+ * the result is scaled, rotated and moved to match the average model as well as possible.
+ * This keeps the units and the head reference point.
+ */
+class HeadModelCalibration
+{
+public:
+    /*! \brief Constructor
+     * \param averageModel  Array of \a HeadPoseSolver::pointCount points: the default
+     *                      head model, in the point order of head-model.hpp */
+    HeadModelCalibration(const cv::Point3f* averageModel);
+
+    /*! \brief Forget all frames */
+    void reset();
+
+    /*! \brief Add the landmarks of a frame and their pose
+     * \param camera        The camera
+     * \param imagePoints   Array of \a HeadPoseSolver::pointCount image points
+     * \param rvec          Rotation of the head, as computed with the default model
+     * \param tvec          Translation of the head
+     *
+     * Frames whose rotation barely differs from the last added frame add little
+     * information; they are ignored. Returns whether the frame was added. */
+    bool addFrame(const CameraIntrinsics& camera, const cv::Point2f* imagePoints,
+        const double* rvec, const double* tvec);
+
+    /*! \brief Number of frames added since the last \a reset() */
+    int frameCount() const { return static_cast<int>(_frames.size()); }
+
+    /*! \brief Compute the calibrated head model
+     * \param model     Array of \a HeadPoseSolver::pointCount points that receives the model
+     *
+     * Returns false if there are too few frames, or if the result is implausible: if it
+     * does not fit the frames better than the default model, or if a point ends up far
+     * from its average position. */
+    bool solve(cv::Point3f* model);
+
+    /*! \brief RMS reprojection error in pixels over all frames with the default model,
+     *  as of the last \a solve() */
+    double initialRmsError() const { return _initialRmsError; }
+
+    /*! \brief RMS reprojection error in pixels over all frames with the calibrated model,
+     *  as of the last \a solve() */
+    double rmsError() const { return _rmsError; }
+
+    /*! \brief Load a head model from a file written by \a save()
+     *
+     * Returns false if the file does not exist or does not hold a head model. */
+    static bool load(const std::string& fileName, cv::Point3f* model);
+
+    /*! \brief Save a head model of \a HeadPoseSolver::pointCount points
+     *
+     * Returns false if the file cannot be written. */
+    static bool save(const std::string& fileName, const cv::Point3f* model);
+
+private:
+    struct Frame {
+        CameraIntrinsics camera;
+        float imagePoints[HeadPoseSolver::pointCount][2];
+        double rvec[3];
+        double tvec[3];
+    };
+    struct Pose {
+        double R[9];
+        double t[3];
+    };
+
+    double _averageModel[HeadPoseSolver::pointCount][3];
+    std::vector<Frame> _frames;
+    double _initialRmsError;
+    double _rmsError;
+
+    double _normalEquations(const double* parameters, const std::vector<Pose>& poses,
+        double* U, double* gm, double* V, double* W, double* gp) const;
+    void _alignToAverage(double (*model)[3]) const;
+};
+
+#endif
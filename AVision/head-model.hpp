@@ -0,0 +1,67 @@
+#ifndef HEAD_MODEL_HPP
+#define HEAD_MODEL_HPP
+
+#include <opencv2/core/core.hpp>
+
+/* Face model
+ * Used by the tracker and by the benchmarks.
+ *
+ * A subset of landmarks for which we have good guesses for
+ * average positions from <https://en.wikipedia.org/wiki/Human_head>.
+ * Everything must be in mm to be consistent with OpenCV assumptions.
+ * We use landmarks that tend not to change too much with varying
+ * facial expressions. The eye corners are used twice to give them
+ * more weight.
+ */
+
+static const cv::Point3f landmarkLeftEctocanthi(-60.0f, 0.0f, 0.0f);
+static const cv::Point3f landmarkRightEctocanthi(+60.0f, 0.0f, 0.0f);
+static const cv::Point3f landmarkSellion(0.0f, 5.0f, -20.0f);
+static const cv::Point3f landmarkSubnasale(0.0f, -42.0f, -30.0f);
+static const cv::Point3f landmarkStomion(0.0f, -67.0f, -32.0f);
+static const cv::Point3f landmarkLeftTragion(-70.0f, 0.0f, 99.9f);
+static const cv::Point3f landmarkRightTragion(+70.0f, 0.0f, 99.9f);
+static const int landmarkLeftEctocanthiIndex = 36;
+static const int landmarkRightEctocanthiIndex = 45;
+static const int landmarkSellionIndex = 27;
+static const int landmarkSubnasaleIndex = 33;
+static const int landmarkStomionIndex = 51;
+static const int landmarkLeftTragionIndex = 0;
+static const int landmarkRightTragionIndex = 16;
+
+static const cv::Point3f modelLandmarkPositions[] = {
+    landmarkLeftEctocanthi,
+    landmarkLeftEctocanthi,
+    landmarkRightEctocanthi,
+    landmarkRightEctocanthi,
+    landmarkSellion,
+    landmarkSubnasale,
+    landmarkStomion,
+    landmarkLeftTragion,
+    landmarkRightTragion
+};
+static const int modelLandmarkIndices[] = {
+    landmarkLeftEctocanthiIndex,
+    landmarkLeftEctocanthiIndex,
+    landmarkRightEctocanthiIndex,
+    landmarkRightEctocanthiIndex,
+    landmarkSellionIndex,
+    landmarkSubnasaleIndex,
+    landmarkStomionIndex,
+    landmarkLeftTragionIndex,
+    landmarkRightTragionIndex
+};
+static const int modelLandmarkCount = sizeof(modelLandmarkIndices) / sizeof(modelLandmarkIndices[0]);
+// the same landmarks without duplicates
+static const int poseLandmarkIndices[] = {
+    landmarkLeftEctocanthiIndex,
+    landmarkRightEctocanthiIndex,
+    landmarkSellionIndex,
+    landmarkSubnasaleIndex,
+    landmarkStomionIndex,
+    landmarkLeftTragionIndex,
+    landmarkRightTragionIndex
+};
+static const int poseLandmarkCount = sizeof(poseLandmarkIndices) / sizeof(poseLandmarkIndices[0]);
+
+#endif
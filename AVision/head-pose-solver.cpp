@@ -0,0 +1,333 @@
+#include "head-pose-solver.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+
+#include <opencv2/core/core.hpp>
+
+/* Termination, as in cv::solvePnP(): at most 20 iterations, or a step below these sizes */
+static const int maxIterations = 20;
+static const double minRotationStep = 1e-7;    // radians
+static const double minTranslationStep = 1e-4; // model units
+
+/* Rotations: the solver keeps a rotation matrix and updates it with small
+ * rotations R <- exp(w) R, which makes the Jacobian with respect to w simple.
+ * The Rodrigues vector is only needed at the start and at the end. */
+
+static void rodriguesToMatrix(const double* r, double* R)
+{
+    double theta = std::sqrt(r[0] * r[0] + r[1] * r[1] + r[2] * r[2]);
+    double a, b;        // sin(theta) / theta and (1 - cos(theta)) / theta^2
+    if (theta < 1e-8) {
+        a = 1.0;
+        b = 0.5;
+    }
+    else {
+        a = std::sin(theta) / theta;
+        b = (1.0 - std::cos(theta)) / (theta * theta);
+    }
+    double x = r[0], y = r[1], z = r[2];
+    R[0] = 1.0 - b * (y * y + z * z);
+    R[1] = b * x * y - a * z;
+    R[2] = b * x * z + a * y;
+    R[3] = b * x * y + a * z;
+    R[4] = 1.0 - b * (x * x + z * z);
+    R[5] = b * y * z - a * x;
+    R[6] = b * x * z - a * y;
+    R[7] = b * y * z + a * x;
+    R[8] = 1.0 - b * (x * x + y * y);
+}
+
+static void matrixToRodrigues(const double* R, double* r)
+{
+    double wx = R[7] - R[5];
+    double wy = R[2] - R[6];
+    double wz = R[3] - R[1];
+    double s = 0.5 * std::sqrt(wx * wx + wy * wy + wz * wz);   // sin(theta)
+    double c = 0.5 * (R[0] + R[4] + R[8] - 1.0);                // cos(theta)
+    double theta = std::atan2(s, c);
+    if (s > 1e-5) {
+        double f = theta / (2.0 * s);
+        r[0] = f * wx;
+        r[1] = f * wy;
+        r[2] = f * wz;
+    }
+    else if (c > 0.0) {
+        // theta is close to 0
+        r[0] = 0.5 * wx;
+        r[1] = 0.5 * wy;
+        r[2] = 0.5 * wz;
+    }
+    else {
+        // theta is close to pi: R is close to 2 a a^T - I for the axis a
+        int i = (R[0] >= R[4] && R[0] >= R[8]) ? 0 : R[4] >= R[8] ? 1 : 2;
+        double a[3];
+        a[i] = std::sqrt(std::max(0.5 * (R[4 * i] + 1.0), 0.0));
+        for (int j = 0; j < 3; j++) {
+            if (j != i)
+                a[j] = (R[3 * i + j] + R[3 * j + i]) / (4.0 * a[i]);
+        }
+        double norm = std::sqrt(a[0] * a[0] + a[1] * a[1] + a[2] * a[2]);
+        // the sign of the axis follows the remaining antisymmetric part
+        if (a[0] * wx + a[1] * wy + a[2] * wz < 0.0)
+            norm = -norm;
+        r[0] = theta * a[0] / norm;
+        r[1] = theta * a[1] / norm;
+        r[2] = theta * a[2] / norm;
+    }
+}
+
+/* R <- exp(w) R */
+static void rotate(const double* w, double* R)
+{
+    double E[9], Rw[9];
+    rodriguesToMatrix(w, E);
+    for (int i = 0; i < 3; i++) {
+        for (int j = 0; j < 3; j++)
+            Rw[3 * i + j] = E[3 * i + 0] * R[0 + j] + E[3 * i + 1] * R[3 + j] + E[3 * i + 2] * R[6 + j];
+    }
+    for (int i = 0; i < 9; i++)
+        R[i] = Rw[i];
+}
+
+/* Solve the symmetric positive definite 6x6 system A x = b with a Cholesky
+ * decomposition. Returns false if A is not positive definite. */
+static bool solve6(const double* A, const double* b, double* x)
+{
+    double L[36];
+    for (int i = 0; i < 6; i++) {
+        for (int j = 0; j <= i; j++) {
+            double sum = A[6 * i + j];
+            for (int k = 0; k < j; k++)
+                sum -= L[6 * i + k] * L[6 * j + k];
+            if (i == j) {
+                if (!(sum > 0.0))
+                    return false;
+                L[6 * i + i] = std::sqrt(sum);
+            }
+            else {
+                L[6 * i + j] = sum / L[6 * j + j];
+            }
+        }
+    }
+    double y[6];
+    for (int i = 0; i < 6; i++) {
+        double sum = b[i];
+        for (int k = 0; k < i; k++)
+            sum -= L[6 * i + k] * y[k];
+        y[i] = sum / L[6 * i + i];
+    }
+    for (int i = 5; i >= 0; i--) {
+        double sum = y[i];
+        for (int k = i + 1; k < 6; k++)
+            sum -= L[6 * k + i] * x[k];
+        x[i] = sum / L[6 * i + i];
+    }
+    return true;
+}
+
+void HeadPoseSolver::rotationMatrix(const double* rvec, double* R)
+{
+    rodriguesToMatrix(rvec, R);
+}
+
+void HeadPoseSolver::project(const CameraIntrinsics& camera, const double* P, double* pixel, double* J)
+{
+    double iz = 1.0 / P[2];
+    double x = P[0] * iz;
+    double y = P[1] * iz;
+    double x2 = x * x, y2 = y * y, xy = x * y;
+    double r2 = x2 + y2;
+    double radial = 1.0 + r2 * (camera.k1 + r2 * (camera.k2 + r2 * camera.k3));
+    double xd = x * radial + 2.0 * camera.p1 * xy + camera.p2 * (r2 + 2.0 * x2);
+    double yd = y * radial + camera.p1 * (r2 + 2.0 * y2) + 2.0 * camera.p2 * xy;
+    pixel[0] = camera.fx * xd + camera.cx;
+    pixel[1] = camera.fy * yd + camera.cy;
+    if (!J)
+        return;
+
+    // derivatives of the distorted coordinates with respect to the normalized ones
+    double dRadial = 2.0 * (camera.k1 + r2 * (2.0 * camera.k2 + 3.0 * camera.k3 * r2));
+    double dxd_dx = radial + x2 * dRadial + 2.0 * camera.p1 * y + 6.0 * camera.p2 * x;
+    double dxd_dy = xy * dRadial + 2.0 * camera.p1 * x + 2.0 * camera.p2 * y;
+    double dyd_dx = xy * dRadial + 2.0 * camera.p1 * x + 2.0 * camera.p2 * y;
+    double dyd_dy = radial + y2 * dRadial + 6.0 * camera.p1 * y + 2.0 * camera.p2 * x;
+    // derivatives of the pixel coordinates with respect to the camera coordinates
+    J[0] = camera.fx * dxd_dx * iz;
+    J[1] = camera.fx * dxd_dy * iz;
+    J[2] = -camera.fx * (dxd_dx * x + dxd_dy * y) * iz;
+    J[3] = camera.fy * dyd_dx * iz;
+    J[4] = camera.fy * dyd_dy * iz;
+    J[5] = -camera.fy * (dyd_dx * x + dyd_dy * y) * iz;
+}
+
+HeadPoseSolver::HeadPoseSolver(const cv::Point3f* modelPoints) :
+    _huberThreshold(0.0),
+    _iterations(0),
+    _rmsError(0.0)
+{
+    setModel(modelPoints);
+    for (int i = 0; i < pointCount; i++)
+        _residuals[i] = 0.0;
+}
+
+void HeadPoseSolver::setModel(const cv::Point3f* modelPoints)
+{
+    for (int i = 0; i < pointCount; i++) {
+        _model[i][0] = modelPoints[i].x;
+        _model[i][1] = modelPoints[i].y;
+        _model[i][2] = modelPoints[i].z;
+    }
+}
+
+/* Loss of the reprojection errors for the pose (R, t): the sum of squares, or
+ * of the Huber loss. The residuals receive the reprojection error of each point.
+ * If JtJ and Jtr are given, they receive J^T W J (6x6, row-major) and J^T W r,
+ * where J is the Jacobian of the residuals r with respect to (w, t) for the
+ * update R <- exp(w) R, and W holds the Huber weights.
+ * Returns infinity if a point is not in front of the camera. */
+double HeadPoseSolver::_normalEquations(const CameraIntrinsics& camera, const cv::Point2f* imagePoints,
+    const double* R, const double* t, double* residuals, double* JtJ, double* Jtr) const
+{
+    if (JtJ) {
+        for (int i = 0; i < 36; i++)
+            JtJ[i] = 0.0;
+        for (int i = 0; i < 6; i++)
+            Jtr[i] = 0.0;
+    }
+    double cost = 0.0;
+    for (int p = 0; p < pointCount; p++) {
+        const double* M = _model[p];
+        // the rotated point and the point in camera coordinates
+        double rx = R[0] * M[0] + R[1] * M[1] + R[2] * M[2];
+        double ry = R[3] * M[0] + R[4] * M[1] + R[5] * M[2];
+        double rz = R[6] * M[0] + R[7] * M[1] + R[8] * M[2];
+        double P[3] = { rx + t[0], ry + t[1], rz + t[2] };
+        if (!(P[2] > 0.0))
+            return std::numeric_limits<double>::infinity();
+        double pixel[2], dP[6];
+        project(camera, P, pixel, JtJ ? dP : NULL);
+        double ex = pixel[0] - imagePoints[p].x;
+        double ey = pixel[1] - imagePoints[p].y;
+        double e2 = ex * ex + ey * ey;
+        residuals[p] = std::sqrt(e2);
+        // the Huber loss is e^2 up to the threshold k, and 2 k |e| - k^2 beyond it,
+        // which is a squared error with weight k / |e|
+        double weight = 1.0;
+        if (_huberThreshold > 0.0 && residuals[p] > _huberThreshold) {
+            weight = _huberThreshold / residuals[p];
+            cost += 2.0 * _huberThreshold * residuals[p] - _huberThreshold * _huberThreshold;
+        }
+        else {
+            cost += e2;
+        }
+        if (!JtJ)
+            continue;
+
+        const double* du_dP = dP;
+        const double* dv_dP = dP + 3;
+        // The camera coordinates change by w x (R M) + dt, so d/dw = -[R M]x and d/dt = I.
+        double J[2][6];
+        J[0][0] = du_dP[2] * ry - du_dP[1] * rz;
+        J[0][1] = du_dP[0] * rz - du_dP[2] * rx;
+        J[0][2] = du_dP[1] * rx - du_dP[0] * ry;
+        J[0][3] = du_dP[0];
+        J[0][4] = du_dP[1];
+        J[0][5] = du_dP[2];
+        J[1][0] = dv_dP[2] * ry - dv_dP[1] * rz;
+        J[1][1] = dv_dP[0] * rz - dv_dP[2] * rx;
+        J[1][2] = dv_dP[1] * rx - dv_dP[0] * ry;
+        J[1][3] = dv_dP[0];
+        J[1][4] = dv_dP[1];
+        J[1][5] = dv_dP[2];
+        for (int i = 0; i < 6; i++) {
+            for (int j = 0; j <= i; j++)
+                JtJ[6 * i + j] += weight * (J[0][i] * J[0][j] + J[1][i] * J[1][j]);
+            Jtr[i] += weight * (J[0][i] * ex + J[1][i] * ey);
+        }
+    }
+    if (JtJ) {
+        for (int i = 0; i < 6; i++) {
+            for (int j = i + 1; j < 6; j++)
+                JtJ[6 * i + j] = JtJ[6 * j + i];
+        }
+    }
+    return cost;
+}
+
+/* Gauss-Newton with Levenberg-Marquardt damping: a step that does not reduce
+ * the error is retried with more damping. Close to the solution, the damping
+ * is negligible and each step is a Gauss-Newton step. With the Huber loss, the
+ * weights are recomputed in each step. */
+bool HeadPoseSolver::solve(const CameraIntrinsics& camera, const cv::Point2f* imagePoints, double* rvec, double* tvec)
+{
+    double R[9], t[3];
+    rodriguesToMatrix(rvec, R);
+    t[0] = tvec[0];
+    t[1] = tvec[1];
+    t[2] = tvec[2];
+    double residuals[pointCount], newResiduals[pointCount];
+    double JtJ[36], Jtr[6];
+    double cost = _normalEquations(camera, imagePoints, R, t, residuals, JtJ, Jtr);
+    _iterations = 0;
+    if (cost == std::numeric_limits<double>::infinity())
+        return false;
+
+    double lambda = 1e-3;
+    while (_iterations < maxIterations) {
+        _iterations++;
+        double A[36], step[6], negJtr[6];
+        for (int i = 0; i < 36; i++)
+            A[i] = JtJ[i];
+        for (int i = 0; i < 6; i++) {
+            A[7 * i] *= 1.0 + lambda;
+            negJtr[i] = -Jtr[i];
+        }
+        if (!solve6(A, negJtr, step)) {
+            lambda *= 10.0;
+            continue;
+        }
+        double newR[9], newT[3];
+        for (int i = 0; i < 9; i++)
+            newR[i] = R[i];
+        rotate(step, newR);
+        newT[0] = t[0] + step[3];
+        newT[1] = t[1] + step[4];
+        newT[2] = t[2] + step[5];
+        double newCost = _normalEquations(camera, imagePoints, newR, newT, newResiduals, NULL, NULL);
+        if (!(newCost <= cost)) {
+            lambda *= 10.0;
+            if (lambda > 1e10)
+                break;
+            continue;
+        }
+        for (int i = 0; i < 9; i++)
+            R[i] = newR[i];
+        t[0] = newT[0];
+        t[1] = newT[1];
+        t[2] = newT[2];
+        for (int i = 0; i < pointCount; i++)
+            residuals[i] = newResiduals[i];
+        lambda = std::max(lambda * 0.1, 1e-9);
+        double rotationStep = std::sqrt(step[0] * step[0] + step[1] * step[1] + step[2] * step[2]);
+        double translationStep = std::sqrt(step[3] * step[3] + step[4] * step[4] + step[5] * step[5]);
+        if (rotationStep < minRotationStep && translationStep < minTranslationStep) {
+            cost = newCost;
+            break;
+        }
+        cost = _normalEquations(camera, imagePoints, R, t, residuals, JtJ, Jtr);
+    }
+
+    matrixToRodrigues(R, rvec);
+    tvec[0] = t[0];
+    tvec[1] = t[1];
+    tvec[2] = t[2];
+    double sumOfSquares = 0.0;
+    for (int i = 0; i < pointCount; i++) {
+        _residuals[i] = residuals[i];
+        sumOfSquares += residuals[i] * residuals[i];
+    }
+    _rmsError = std::sqrt(sumOfSquares / pointCount);
+    return true;
+}
@@ -0,0 +1,104 @@
+#ifndef HEAD_POSE_SOLVER_HPP
+#define HEAD_POSE_SOLVER_HPP
+
+#include <cstddef>
+
+/*! \cond */
+namespace cv {
+    template<typename _Tp> class Point_;
+    typedef Point_<float> Point2f;
+    template<typename _Tp> class Point3_;
+    typedef Point3_<float> Point3f;
+}
+/*! \endcond */
+
+/*!
+ * \brief Pinhole camera with OpenCV's five distortion coefficients
+ */
+struct CameraIntrinsics
+{
+    double fx, fy;          // focal lengths in pixels
+    double cx, cy;          // principal point
+    double k1, k2, p1, p2, k3;
+};
+
+/*!
+ * \brief Perspective-n-point solver for the head model of the \a WebcamHeadTracker
+ *
+ * This computes the same least squares pose as `cv::solvePnP()` with
+ * `SOLVEPNP_ITERATIVE` and an extrinsic guess, but for a fixed number of points,
+ * with fixed-size arrays on the stack and analytic Jacobians. It needs no memory
+ * allocations and no input validation, and its run time hardly varies.
+ *
+ * Optionally, the solver minimizes the Huber loss instead of the squared error
+ * (see \a setHuberThreshold()), so that a few mislocated points cannot pull the
+ * pose far. This is iteratively reweighted least squares: each iteration weights
+ * the points by their current residuals.
+ *
+ * Rotations are Rodrigues vectors and translations are in model units, as in OpenCV.
+ */
+class HeadPoseSolver
+{
+public:
+    /*! \brief Number of model points */
+    static const int pointCount = 9;
+
+    /*! \brief Constructor
+     * \param modelPoints   Array of \a pointCount model points */
+    HeadPoseSolver(const cv::Point3f* modelPoints);
+
+    /*! \brief Replace the model points, e.g. with a calibrated head model
+     * \param modelPoints   Array of \a pointCount model points */
+    void setModel(const cv::Point3f* modelPoints);
+
+    /*! \brief Set the residual in pixels above which the Huber loss grows only linearly
+     *
+     * Points with larger residuals get correspondingly less weight. 0 (the default)
+     * means plain least squares. */
+    void setHuberThreshold(double threshold) { _huberThreshold = threshold; }
+
+    /*! \brief Compute the pose that best maps the model points onto the image points
+     * \param camera        The camera
+     * \param imagePoints   Array of \a pointCount image points
+     * \param rvec          Rotation: the initial guess, replaced by the result
+     * \param tvec          Translation: the initial guess, replaced by the result
+     *
+     * Returns false if the guess puts model points behind the camera, or if the
+     * iteration leads there. The pose is unchanged in that case. */
+    bool solve(const CameraIntrinsics& camera, const cv::Point2f* imagePoints, double* rvec, double* tvec);
+
+    /*! \brief Rotation matrix (row-major) of a Rodrigues vector */
+    static void rotationMatrix(const double* rvec, double* R);
+
+    /*! \brief Project a point with the camera
+     * \param camera    The camera
+     * \param P         Point in camera coordinates, in front of the camera
+     * \param pixel     Receives the pixel coordinates
+     * \param J         Optional: receives the 2x3 Jacobian (row-major) of the pixel
+     *                  coordinates with respect to \a P */
+    static void project(const CameraIntrinsics& camera, const double* P, double* pixel, double* J = NULL);
+
+    /*! \brief Number of iterations of the last \a solve() */
+    int iterations() const { return _iterations; }
+
+    /*! \brief RMS reprojection error in pixels of the last \a solve() */
+    double rmsError() const { return _rmsError; }
+
+    /*! \brief Reprojection error in pixels of the given point after the last \a solve() */
+    double residual(int i) const { return _residuals[i]; }
+
+    /*! \brief Whether the residual of the given point is within the Huber threshold, if any */
+    bool isInlier(int i) const { return !(_huberThreshold > 0.0) || _residuals[i] <= _huberThreshold; }
+
+private:
+    double _model[pointCount][3];
+    double _huberThreshold;
+    int _iterations;
+    double _rmsError;
+    double _residuals[pointCount];
+
+    double _normalEquations(const CameraIntrinsics& camera, const cv::Point2f* imagePoints,
+        const double* R, const double* t, double* residuals, double* JtJ, double* Jtr) const;
+};
+
+#endif
@@ -0,0 +1,697 @@
+#include "pose-filter.hpp"
+#include "pose-kalman-filter.hpp"
+
+#include <algorithm>
+#include <cmath>
+
+#include <opencv2/core/core.hpp>
+
+#ifndef M_PI
+#define M_PI 3.14159265358979323846
+#endif
+#ifndef M_PI_2
+#define M_PI_2 1.57079632679489661923
+#endif
+#ifndef M_SQRT1_2
+#define M_SQRT1_2 0.70710678118654752440
+#endif
+
+/* Quaternion helpers for the filters
+ * Quaternions are stored as (x, y, z, w).
+ */
+
+static inline double dot4(const double* v, const double* w)
+{
+    return (v[0] * w[0] + v[1] * w[1] + v[2] * w[2] + v[3] * w[3]);
+}
+
+static inline void normalize4(double* v)
+{
+    double s = std::sqrt(dot4(v, v));
+    v[0] /= s;
+    v[1] /= s;
+    v[2] /= s;
+    v[3] /= s;
+}
+
+static inline void slerp(double* result, double alpha, const double* q, const double* r)
+{
+    double w[4] = { r[0], r[1], r[2], r[3] };
+    double cosHalfAngle = dot4(q, r);
+    if (cosHalfAngle < 0.0) {
+        // quat(x, y, z, w) and quat(-x, -y, -z, -w) represent the same rotation
+        w[0] = -w[0]; w[1] = -w[1]; w[2] = -w[2]; w[3] = -w[3];
+        cosHalfAngle = -cosHalfAngle;
+    }
+    double tmpQ, tmpW;
+    if (std::fabs(cosHalfAngle) >= 1.0) {
+        // angle is zero => rotations are identical
+        tmpQ = 1.0;
+        tmpW = 0.0;
+    }
+    else {
+        double halfAngle = acos(cosHalfAngle);
+        double sinHalfAngle = sqrt(1.0 - cosHalfAngle * cosHalfAngle);
+        if (std::fabs(sinHalfAngle) < 0.001) {
+            // angle is 180 degrees => result is not clear
+            tmpQ = 0.5;
+            tmpW = 0.5;
+        }
+        else {
+            tmpQ = std::sin((1.0 - alpha) * halfAngle) / sinHalfAngle;
+            tmpW = sin(alpha * halfAngle) / sinHalfAngle;
+        }
+    }
+    result[0] = q[0] * tmpQ + w[0] * tmpW;
+    result[1] = q[1] * tmpQ + w[1] * tmpW;
+    result[2] = q[2] * tmpQ + w[2] * tmpW;
+    result[3] = q[3] * tmpQ + w[3] * tmpW;
+}
+
+/* Double Exponential Smoothing
+ * This implements double exponential smoothing-based prediction
+ * as described in Sec. 2 of "Double Exponential Smoothing: An alternative to
+ * Kalman Filter-Based Predictive Tracking" by Joseph J. LaViola Jr.
+ */
+
+class DoubleExponentialSmoothing
+{
+private:
+    bool _isInitialized;
+    double _lastAlpha;
+    double _lastVecS[3], _lastVecS2[3];
+    double _lastQuatS[4], _lastQuatS2[4];
+
+    inline void copy3(double* result, const double* value)
+    {
+        result[0] = value[0];
+        result[1] = value[1];
+        result[2] = value[2];
+    }
+
+    inline void copy4(double* result, const double* value)
+    {
+        result[0] = value[0];
+        result[1] = value[1];
+        result[2] = value[2];
+        result[3] = value[3];
+    }
+
+    inline double mix(double alpha, double x, double y)
+    {
+        return alpha * y + (1.0 - alpha) * x;
+    }
+
+    inline void mix3(double* result, double alpha, const double* v, const double* w)
+    {
+        result[0] = mix(alpha, v[0], w[0]);
+        result[1] = mix(alpha, v[1], w[1]);
+        result[2] = mix(alpha, v[2], w[2]);
+    }
+
+    inline void mix4(double* result, double alpha, const double* v, const double* w)
+    {
+        result[0] = mix(alpha, v[0], w[0]);
+        result[1] = mix(alpha, v[1], w[1]);
+        result[2] = mix(alpha, v[2], w[2]);
+        result[3] = mix(alpha, v[3], w[3]);
+    }
+
+public:
+    DoubleExponentialSmoothing() : _isInitialized(false), _lastAlpha(0.0) {}
+
+    void step(const double* vec, const double* quat,
+        double alpha, double tau, double* estimatedVec, double* estimatedQuat)
+    {
+        if (!_isInitialized) {
+            copy3(_lastVecS, vec);
+            copy3(_lastVecS2, vec);
+            copy4(_lastQuatS, quat);
+            copy4(_lastQuatS2, quat);
+            _isInitialized = true;
+        }
+        double vecS[3], vecS2[3], quatS[4], quatS2[4];
+        // Eq. (1), (2)
+        mix3(vecS, alpha, _lastVecS, vec);
+        mix3(vecS2, alpha, _lastVecS2, vecS);
+        mix4(quatS, alpha, _lastQuatS, quat);
+        mix4(quatS2, alpha, _lastQuatS2, quatS);
+        copy3(_lastVecS, vecS);
+        copy3(_lastVecS2, vecS2);
+        copy4(_lastQuatS, quatS);
+        copy4(_lastQuatS2, quatS2);
+        _lastAlpha = alpha;
+        predict(tau, estimatedVec, estimatedQuat);
+    }
+
+    /* Predict tau steps ahead of the last step */
+    void predict(double tau, double* estimatedVec, double* estimatedQuat)
+    {
+        double alpha = _lastAlpha;
+        const double* vecS = _lastVecS;
+        const double* vecS2 = _lastVecS2;
+        const double* quatS = _lastQuatS;
+        const double* quatS2 = _lastQuatS2;
+        // Eq. (6) for floor(tau) and ceil(tau)
+        double floorTau = std::floor(tau);
+        double betaFloorTau = 2.0 + alpha * floorTau / (1.0 - alpha);
+        double estimatedVecFloorTau[3], estimatedQuatFloorTau[4];
+        mix3(estimatedVecFloorTau, betaFloorTau, vecS2, vecS);
+        mix4(estimatedQuatFloorTau, betaFloorTau, quatS2, quatS);
+        normalize4(estimatedQuatFloorTau);
+        double ceilTau = std::ceil(tau);
+        double betaCeilTau = 2.0 + alpha * ceilTau / (1.0 - alpha);
+        double estimatedVecCeilTau[3], estimatedQuatCeilTau[4];
+        mix3(estimatedVecCeilTau, betaCeilTau, vecS2, vecS);
+        mix4(estimatedQuatCeilTau, betaCeilTau, quatS2, quatS);
+        normalize4(estimatedQuatCeilTau);
+        // mix results for floor(tau) and ceil(tau)
+        mix3(estimatedVec, tau - floorTau, estimatedVecCeilTau, estimatedVecFloorTau);
+        slerp(estimatedQuat, tau - floorTau, estimatedQuatCeilTau, estimatedQuatFloorTau);
+    }
+};
+
+/* One Euro Filter
+ * This implements the speed-based low-pass filter described in
+ * "1 Euro Filter: A Simple Speed-based Low-pass Filter for Noisy Input in
+ * Interactive Systems" by G. Casiez, N. Roussel and D. Vogel.
+ * The cutoff frequency grows with the (low-pass filtered) speed, so that a
+ * still head is smoothed strongly and fast movements pass with little lag.
+ * The position is filtered as a vector, with the length of its velocity as
+ * the speed. The orientation is filtered by slerp, with the angular speed.
+ * As in the authors' reference implementation, the velocities are taken from
+ * the raw values, so that they also serve for extrapolation.
+ */
+
+class OneEuroFilter
+{
+private:
+    bool _isInitialized;
+    double _lastVec[3], _lastRawVec[3], _lastVecVelocity[3];
+    double _lastQuat[4], _lastRawQuat[4], _lastQuatVelocity[3];
+
+    // weight of the new value in a low-pass filter with the given cutoff frequency
+    static double smoothingFactor(double dt, double cutoff)
+    {
+        double tau = 1.0 / (2.0 * M_PI * cutoff);
+        return 1.0 / (1.0 + tau / dt);
+    }
+
+    static double length3(const double* v)
+    {
+        return std::sqrt(v[0] * v[0] + v[1] * v[1] + v[2] * v[2]);
+    }
+
+public:
+    OneEuroFilter() : _isInitialized(false) {}
+
+    /* Filter a new pose that is dt seconds after the last one. The cutoff
+     * frequencies are in Hz, the beta values in Hz per mm/s and per rad/s. */
+    void step(const double* vec, const double* quat, double dt,
+        double minCutoff, double vecBeta, double quatBeta, double derivativeCutoff,
+        double* estimatedVec, double* estimatedQuat)
+    {
+        if (!_isInitialized) {
+            for (int i = 0; i < 3; i++) {
+                _lastVec[i] = vec[i];
+                _lastRawVec[i] = vec[i];
+                _lastVecVelocity[i] = 0.0;
+                _lastQuatVelocity[i] = 0.0;
+            }
+            for (int i = 0; i < 4; i++) {
+                _lastQuat[i] = quat[i];
+                _lastRawQuat[i] = quat[i];
+            }
+            _isInitialized = true;
+        }
+        double derivativeAlpha = smoothingFactor(dt, derivativeCutoff);
+        // position
+        for (int i = 0; i < 3; i++) {
+            double velocity = (vec[i] - _lastRawVec[i]) / dt;
+            _lastVecVelocity[i] += derivativeAlpha * (velocity - _lastVecVelocity[i]);
+            _lastRawVec[i] = vec[i];
+        }
+        double vecAlpha = smoothingFactor(dt, minCutoff + vecBeta * length3(_lastVecVelocity));
+        for (int i = 0; i < 3; i++) {
+            _lastVec[i] += vecAlpha * (vec[i] - _lastVec[i]);
+            estimatedVec[i] = _lastVec[i];
+        }
+        // orientation: the rotation from the last value, quat * conj(lastRawQuat),
+        // gives the angular velocity
+        const double* p = _lastRawQuat;
+        double d[4] = {
+            p[3] * quat[0] - quat[3] * p[0] - quat[1] * p[2] + quat[2] * p[1],
+            p[3] * quat[1] - quat[3] * p[1] - quat[2] * p[0] + quat[0] * p[2],
+            p[3] * quat[2] - quat[3] * p[2] - quat[0] * p[1] + quat[1] * p[0],
+            p[3] * quat[3] + quat[0] * p[0] + quat[1] * p[1] + quat[2] * p[2]
+        };
+        if (d[3] < 0.0) {
+            // take the shorter way
+            d[0] = -d[0]; d[1] = -d[1]; d[2] = -d[2]; d[3] = -d[3];
+        }
+        double sinHalfAngle = length3(d);
+        double angularSpeed = (sinHalfAngle > 0.0 ? 2.0 * std::atan2(sinHalfAngle, d[3]) / (sinHalfAngle * dt) : 0.0);
+        for (int i = 0; i < 3; i++) {
+            double velocity = d[i] * angularSpeed;
+            _lastQuatVelocity[i] += derivativeAlpha * (velocity - _lastQuatVelocity[i]);
+        }
+        double quatAlpha = smoothingFactor(dt, minCutoff + quatBeta * length3(_lastQuatVelocity));
+        double q[4];
+        slerp(q, quatAlpha, _lastQuat, quat);
+        normalize4(q);
+        for (int i = 0; i < 4; i++) {
+            _lastQuat[i] = q[i];
+            _lastRawQuat[i] = quat[i];
+            estimatedQuat[i] = q[i];
+        }
+    }
+
+    /* Extrapolate the last estimate by h seconds with the filtered velocities */
+    void predict(double h, double* estimatedVec, double* estimatedQuat) const
+    {
+        for (int i = 0; i < 3; i++)
+            estimatedVec[i] = _lastVec[i] + _lastVecVelocity[i] * h;
+        // rotate by the angular velocity times h: r * lastQuat
+        double angularSpeed = length3(_lastQuatVelocity);
+        double s = (angularSpeed > 0.0 ? std::sin(0.5 * angularSpeed * h) / angularSpeed : 0.0);
+        double r[4] = {
+            _lastQuatVelocity[0] * s, _lastQuatVelocity[1] * s, _lastQuatVelocity[2] * s,
+            std::cos(0.5 * angularSpeed * h)
+        };
+        const double* p = _lastQuat;
+        estimatedQuat[0] = r[3] * p[0] + p[3] * r[0] + r[1] * p[2] - r[2] * p[1];
+        estimatedQuat[1] = r[3] * p[1] + p[3] * r[1] + r[2] * p[0] - r[0] * p[2];
+        estimatedQuat[2] = r[3] * p[2] + p[3] * r[2] + r[0] * p[1] - r[1] * p[0];
+        estimatedQuat[3] = r[3] * p[3] - r[0] * p[0] - r[1] * p[1] - r[2] * p[2];
+    }
+};
+
+/* Quaternion Kalman Filter
+ * A multiplicative (error-state) Kalman filter for the orientation, as in
+ * "Attitude Error Representations for Kalman Filtering" by F. L. Markley, with
+ * the constant acceleration model of the Kalman filter above for the position
+ * and for the orientation. The orientation is a quaternion, and the filter
+ * state of each axis is a small rotation away from it, the angular velocity
+ * and the angular acceleration, in camera coordinates. Each step predicts the
+ * rotation, measures the rotation from the predicted to the observed quaternion,
+ * corrects the state by it, and then moves the corrected rotation into the
+ * quaternion, so that the small rotation is zero again.
+ * Small rotations are represented by Gibbs vectors (twice the vector part over
+ * the scalar part of the quaternion), which equal the rotation vector up to
+ * third order. Conversions to and from quaternions then need no trigonometric
+ * functions, and there is no singularity at any orientation. The terms that
+ * couple the axes are of second order in the small rotation and are dropped,
+ * so that, as the position, the axes fall apart into independent filters with
+ * three states each. All six filters have the same noise, and therefore share
+ * one error covariance and gain, which each step updates only once.
+ */
+
+class QuaternionKalmanFilter
+{
+private:
+    double _nominalDt;
+    double _processNoise;
+    double _measurementNoise;
+    bool _isInitialized;
+    // per coordinate: the state (value, velocity, acceleration)
+    double _vecState[3][3];
+    // per axis: the state (small rotation, angular velocity, angular acceleration);
+    // the rotation is relative to _quat
+    double _quatState[3][3];
+    double _quat[4];
+    // the error covariance of all states
+    double _errorCov[3][3];
+
+    static double length3(const double* v)
+    {
+        return std::sqrt(v[0] * v[0] + v[1] * v[1] + v[2] * v[2]);
+    }
+
+    // result = rotation of the Gibbs vector g, applied after q
+    static void rotate(double* result, const double* g, const double* q)
+    {
+        double r[4] = { 0.5 * g[0], 0.5 * g[1], 0.5 * g[2], 1.0 };
+        result[0] = r[3] * q[0] + q[3] * r[0] + r[1] * q[2] - r[2] * q[1];
+        result[1] = r[3] * q[1] + q[3] * r[1] + r[2] * q[0] - r[0] * q[2];
+        result[2] = r[3] * q[2] + q[3] * r[2] + r[0] * q[1] - r[1] * q[0];
+        result[3] = r[3] * q[3] - r[0] * q[0] - r[1] * q[1] - r[2] * q[2];
+        normalize4(result);
+    }
+
+public:
+    QuaternionKalmanFilter(double nominalDt, double processNoise, double measurementNoise, double initialError) :
+        _nominalDt(nominalDt),
+        _processNoise(processNoise),
+        _measurementNoise(measurementNoise),
+        _isInitialized(false)
+    {
+        for (int c = 0; c < 3; c++) {
+            for (int i = 0; i < 3; i++) {
+                _vecState[c][i] = 0.0;
+                _quatState[c][i] = 0.0;
+            }
+        }
+        kalmanInit(initialError, _errorCov);
+    }
+
+    /* Predict by the time step dt (in seconds) and correct with the measured pose */
+    void step(double dt, const double* vec, const double* quat, double* estimatedVec, double* estimatedQuat)
+    {
+        if (!_isInitialized) {
+            // start at the first orientation, so that the small rotations stay small
+            for (int i = 0; i < 4; i++)
+                _quat[i] = quat[i];
+            _isInitialized = true;
+        }
+        double F[3][3], gain[3];
+        kalmanTransition(dt, F);
+        kalmanPredictCovariance(F, _processNoise * (dt / _nominalDt), _errorCov);
+        kalmanCorrectCovariance(_measurementNoise, _errorCov, gain);
+        // position
+        for (int c = 0; c < 3; c++) {
+            kalmanPredictState(F, _vecState[c]);
+            kalmanCorrectState(gain, vec[c] - _vecState[c][0], _vecState[c]);
+            estimatedVec[c] = _vecState[c][0];
+        }
+        // orientation: the innovation is the rotation from the prediction to the
+        // measurement, quat * conj(predicted)
+        double predictedRotation[3], predicted[4];
+        for (int c = 0; c < 3; c++) {
+            kalmanPredictState(F, _quatState[c]);
+            predictedRotation[c] = _quatState[c][0];
+        }
+        rotate(predicted, predictedRotation, _quat);
+        const double* p = predicted;
+        double d[4] = {
+            p[3] * quat[0] - quat[3] * p[0] - quat[1] * p[2] + quat[2] * p[1],
+            p[3] * quat[1] - quat[3] * p[1] - quat[2] * p[0] + quat[0] * p[2],
+            p[3] * quat[2] - quat[3] * p[2] - quat[0] * p[1] + quat[1] * p[0],
+            p[3] * quat[3] + quat[0] * p[0] + quat[1] * p[1] + quat[2] * p[2]
+        };
+        if (d[3] < 0.0) {
+            // take the shorter way
+            d[0] = -d[0]; d[1] = -d[1]; d[2] = -d[2]; d[3] = -d[3];
+        }
+        if (d[3] < M_SQRT1_2) {
+            // more than 90 degrees off: a tracking failure; limit the innovation to that
+            double s = M_SQRT1_2 / length3(d);
+            d[0] *= s; d[1] *= s; d[2] *= s;
+            d[3] = M_SQRT1_2;
+        }
+        double correctedRotation[3];
+        for (int c = 0; c < 3; c++) {
+            kalmanCorrectState(gain, 2.0 * d[c] / d[3], _quatState[c]);
+            correctedRotation[c] = _quatState[c][0];
+            _quatState[c][0] = 0.0;
+        }
+        rotate(estimatedQuat, correctedRotation, _quat);
+        for (int i = 0; i < 4; i++)
+            _quat[i] = estimatedQuat[i];
+    }
+
+    /* Extrapolate the pose h seconds beyond the last step */
+    void predict(double h, double* estimatedVec, double* estimatedQuat) const
+    {
+        double rotation[3];
+        for (int c = 0; c < 3; c++) {
+            estimatedVec[c] = _vecState[c][0] + _vecState[c][1] * h + 0.5 * _vecState[c][2] * h * h;
+            rotation[c] = _quatState[c][1] * h + 0.5 * _quatState[c][2] * h * h;
+        }
+        rotate(estimatedQuat, rotation, _quat);
+    }
+};
+
+/* Euler angles for the Kalman filter */
+
+static void quaternionToEuler(const double* q, double* euler)
+{
+    double singularityTest = q[0] * q[1] + q[2] * q[3];
+    if (singularityTest > 0.4999) {
+        // north pole
+        euler[0] = 2.0 * std::atan2(q[0], q[3]);
+        euler[1] = M_PI_2;
+        euler[2] = 0.0;
+    }
+    else if (singularityTest < -0.4999) {
+        // south pole
+        euler[0] = -2.0 * std::atan2(q[0], q[3]);
+        euler[1] = -M_PI_2;
+        euler[2] = 0.0f;
+    }
+    else {
+        euler[0] = std::atan2(2.0 * (q[3] * q[0] + q[1] * q[2]), 1.0 - 2.0 * (q[0] * q[0] + q[1] * q[1]));
+        // rounding can push the argument out of [-1, 1] near the poles
+        euler[1] = std::asin(std::max(-1.0, std::min(1.0, 2.0 * (q[3] * q[1] - q[0] * q[2]))));
+        euler[2] = std::atan2(2.0 * (q[3] * q[2] + q[0] * q[1]), 1.0 - 2.0 * (q[1] * q[1] + q[2] * q[2]));
+    }
+}
+
+static void eulerToQuaternion(const double* euler, double* q)
+{
+    double x2 = euler[0] / 2.0;
+    double y2 = euler[1] / 2.0;
+    double z2 = euler[2] / 2.0;
+    double sx2 = std::sin(x2);
+    double cx2 = std::cos(x2);
+    double sy2 = std::sin(y2);
+    double cy2 = std::cos(y2);
+    double sz2 = std::sin(z2);
+    double cz2 = std::cos(z2);
+    q[0] = sx2 * cy2 * cz2 - cx2 * sy2 * sz2;
+    q[1] = cx2 * sy2 * cz2 + sx2 * cy2 * sz2;
+    q[2] = cx2 * cy2 * sz2 - sx2 * sy2 * cz2;
+    q[3] = cx2 * cy2 * cz2 + sx2 * sy2 * sz2;
+}
+
+
+/* Filtering
+ * The filter parameters are meant for frames at the nominal frame rate. They
+ * are adapted to the actual time between two poses, from the capture timestamps.
+ * That time is limited, so that the filters do not extrapolate far over a long
+ * gap, e.g. while the face was lost. Predictions are limited as well, since the
+ * extrapolation error grows quickly with the time.
+ */
+
+static const double maxFilterInterval = 0.25;       // seconds
+static const double maxPredictionInterval = 0.1;    // seconds
+static const double kalmanInitialError = 1.0;
+
+/* Default parameters
+ * The Kalman filter noise is from the OpenCV real time pose tutorial. The
+ * quaternion Kalman filter uses the same, since its small rotations are in
+ * radians as the Euler angles.
+ * With the head still, the One Euro cutoff is the minimum; it rises by beta Hz
+ * per mm/s of position speed and per rad/s of angular speed, so that a quick
+ * head turn of 2 rad/s is hardly delayed. The speeds are smoothed with a fixed
+ * cutoff.
+ */
+
+PoseFilterParameters::PoseFilterParameters() :
+    kalmanProcessNoise(1e-3),
+    kalmanMeasurementNoise(1e-1),
+    quaternionKalmanProcessNoise(1e-3),
+    quaternionKalmanMeasurementNoise(1e-1),
+    despAlpha(0.2),
+    despTau(0.7),
+    oneEuroMinCutoff(1.0),
+    oneEuroPositionBeta(0.02),
+    oneEuroOrientationBeta(5.0),
+    oneEuroDerivativeCutoff(1.0)
+{
+}
+
+/* PoseFilter */
+
+PoseFilter::PoseFilter(double nominalFps, const PoseFilterParameters& parameters) :
+    _nominalFps(nominalFps),
+    _parameters(parameters),
+    // See http://docs.opencv.org/trunk/dc/d2c/tutorial_real_time_pose.html
+    // for information on this!
+    _kalmanFilter(new PoseKalmanFilter(1.0 / nominalFps,
+        parameters.kalmanProcessNoise, parameters.kalmanMeasurementNoise, kalmanInitialError)),
+    _quaternionKalmanFilter(new QuaternionKalmanFilter(1.0 / nominalFps,
+        parameters.quaternionKalmanProcessNoise, parameters.quaternionKalmanMeasurementNoise, kalmanInitialError)),
+    _despFilter(new DoubleExponentialSmoothing),
+    _oneEuroFilter(new OneEuroFilter),
+    _lastFilter(WebcamHeadTracker::Filter_None),
+    _lastTimestamp(-1.0),
+    _lastInterval(1.0 / nominalFps),
+    _lastVec{ 0.0, 0.0, 0.0 },
+    _lastQuat{ 0.0, 0.0, 0.0, 1.0 }
+{
+}
+
+PoseFilter::~PoseFilter()
+{
+    delete _kalmanFilter;
+    delete _quaternionKalmanFilter;
+    delete _despFilter;
+    delete _oneEuroFilter;
+}
+
+void PoseFilter::step(enum WebcamHeadTracker::Filter filter, double timestamp, const double* vec, const double* quat,
+    double* estimatedVec, double* estimatedQuat)
+{
+    // the time since the last pose
+    double dt = 1.0 / _nominalFps;
+    if (_lastTimestamp >= 0.0 && timestamp > _lastTimestamp)
+        dt = std::min(timestamp - _lastTimestamp, maxFilterInterval);
+    switch (filter) {
+    case WebcamHeadTracker::Filter_None:
+    {
+        estimatedVec[0] = vec[0];
+        estimatedVec[1] = vec[1];
+        estimatedVec[2] = vec[2];
+        estimatedQuat[0] = quat[0];
+        estimatedQuat[1] = quat[1];
+        estimatedQuat[2] = quat[2];
+        estimatedQuat[3] = quat[3];
+    }
+    break;
+    case WebcamHeadTracker::Filter_Kalman:
+    {
+        double eulerAngles[3];
+        quaternionToEuler(quat, eulerAngles);
+        double measurement[6] = {
+            vec[0], vec[1], vec[2],
+            eulerAngles[0], eulerAngles[1], eulerAngles[2]
+        };
+        double estimation[6];
+        _kalmanFilter->step(dt, measurement, estimation);
+        estimatedVec[0] = estimation[0];
+        estimatedVec[1] = estimation[1];
+        estimatedVec[2] = estimation[2];
+        eulerToQuaternion(estimation + 3, estimatedQuat);
+    }
+    break;
+    case WebcamHeadTracker::Filter_Double_Exponential:
+    {
+        // a step of n nominal frames smoothes like n steps, and predicts
+        // the same time ahead
+        double frames = dt * _nominalFps;
+        _despFilter->step(vec, quat,
+            1.0 - std::pow(1.0 - _parameters.despAlpha, frames), _parameters.despTau / frames,
+            estimatedVec, estimatedQuat);
+    }
+    break;
+    case WebcamHeadTracker::Filter_OneEuro:
+    {
+        _oneEuroFilter->step(vec, quat, dt,
+            _parameters.oneEuroMinCutoff, _parameters.oneEuroPositionBeta,
+            _parameters.oneEuroOrientationBeta, _parameters.oneEuroDerivativeCutoff,
+            estimatedVec, estimatedQuat);
+    }
+    break;
+    case WebcamHeadTracker::Filter_Quaternion_Kalman:
+    {
+        _quaternionKalmanFilter->step(dt, vec, quat, estimatedVec, estimatedQuat);
+    }
+    break;
+    }
+    _lastFilter = filter;
+    _lastTimestamp = timestamp;
+    _lastInterval = dt;
+    std::copy(estimatedVec, estimatedVec + 3, _lastVec);
+    std::copy(estimatedQuat, estimatedQuat + 4, _lastQuat);
+}
+
+bool PoseFilter::predict(double targetTime, double* vec, double* quat) const
+{
+    if (_lastTimestamp < 0.0)
+        return false;
+    double h = std::max(0.0, std::min(targetTime - _lastTimestamp, maxPredictionInterval));
+    switch (_lastFilter) {
+    case WebcamHeadTracker::Filter_None:
+        std::copy(_lastVec, _lastVec + 3, vec);
+        std::copy(_lastQuat, _lastQuat + 4, quat);
+        break;
+    case WebcamHeadTracker::Filter_Kalman:
+    {
+        double estimation[6];
+        _kalmanFilter->predict(h, estimation);
+        std::copy(estimation, estimation + 3, vec);
+        eulerToQuaternion(estimation + 3, quat);
+    }
+    break;
+    case WebcamHeadTracker::Filter_Double_Exponential:
+        // the smoothing works in steps of the last frame interval
+        _despFilter->predict(h / _lastInterval, vec, quat);
+        break;
+    case WebcamHeadTracker::Filter_OneEuro:
+        _oneEuroFilter->predict(h, vec, quat);
+        break;
+    case WebcamHeadTracker::Filter_Quaternion_Kalman:
+        _quaternionKalmanFilter->predict(h, vec, quat);
+        break;
+    }
+    return true;
+}
+
+/* Filter configuration files */
+
+// in the order of WebcamHeadTracker::Filter
+static const char* const filterNames[] = { "none", "kalman", "double_exponential", "one_euro", "quaternion_kalman" };
+static const int filterCount = sizeof(filterNames) / sizeof(filterNames[0]);
+
+static const struct {
+    const char* key;
+    double PoseFilterParameters::* value;
+} parameterKeys[] = {
+    { "kalman_process_noise", &PoseFilterParameters::kalmanProcessNoise },
+    { "kalman_measurement_noise", &PoseFilterParameters::kalmanMeasurementNoise },
+    { "quaternion_kalman_process_noise", &PoseFilterParameters::quaternionKalmanProcessNoise },
+    { "quaternion_kalman_measurement_noise", &PoseFilterParameters::quaternionKalmanMeasurementNoise },
+    { "desp_alpha", &PoseFilterParameters::despAlpha },
+    { "desp_tau", &PoseFilterParameters::despTau },
+    { "one_euro_min_cutoff", &PoseFilterParameters::oneEuroMinCutoff },
+    { "one_euro_position_beta", &PoseFilterParameters::oneEuroPositionBeta },
+    { "one_euro_orientation_beta", &PoseFilterParameters::oneEuroOrientationBeta },
+    { "one_euro_derivative_cutoff", &PoseFilterParameters::oneEuroDerivativeCutoff }
+};
+
+bool PoseFilter::load(const std::string& fileName, enum WebcamHeadTracker::Filter& filter,
+    PoseFilterParameters& parameters)
+{
+    std::string name;
+    PoseFilterParameters p;
+    try {
+        cv::FileStorage fs(fileName, cv::FileStorage::READ);
+        if (!fs.isOpened())
+            return false;
+        fs["filter"] >> name;
+        for (const auto& k : parameterKeys) {
+            cv::FileNode node = fs[k.key];
+            if (node.empty())
+                continue;
+            if (!node.isReal() && !node.isInt())
+                return false;
+            p.*k.value = static_cast<double>(node);
+        }
+    }
+    catch (cv::Exception& e) {
+        return false;
+    }
+    const char* const* n = std::find(filterNames, filterNames + filterCount, name);
+    if (n == filterNames + filterCount)
+        return false;
+    filter = static_cast<enum WebcamHeadTracker::Filter>(n - filterNames);
+    parameters = p;
+    return true;
+}
+
+bool PoseFilter::save(const std::string& fileName, enum WebcamHeadTracker::Filter filter,
+    const PoseFilterParameters& parameters)
+{
+    try {
+        cv::FileStorage fs(fileName, cv::FileStorage::WRITE);
+        if (!fs.isOpened())
+            return false;
+        fs << "filter" << filterNames[filter];
+        for (const auto& k : parameterKeys)
+            fs << k.key << parameters.*k.value;
+    }
+    catch (cv::Exception& e) {
+        return false;
+    }
+    return true;
+}
@@ -0,0 +1,102 @@
+#ifndef POSE_FILTER_HPP
+#define POSE_FILTER_HPP
+
+#include <string>
+
+#include "webcam-head-tracker.hpp"
+
+class DoubleExponentialSmoothing;
+class OneEuroFilter;
+class PoseKalmanFilter;
+class QuaternionKalmanFilter;
+
+/*!
+ * \brief Parameters of the filters of the \a WebcamHeadTracker
+ *
+ * The constructor sets the defaults. The smoothing factor and the prediction of the
+ * double exponential smoothing refer to frames at the nominal frame rate.
+ */
+struct PoseFilterParameters
+{
+    double kalmanProcessNoise;          // per nominal frame
+    double kalmanMeasurementNoise;
+    double quaternionKalmanProcessNoise;    // per nominal frame
+    double quaternionKalmanMeasurementNoise;
+    double despAlpha;
+    double despTau;                     // prediction, in nominal frames
+    double oneEuroMinCutoff;            // Hz
+    double oneEuroPositionBeta;         // Hz per mm/s
+    double oneEuroOrientationBeta;      // Hz per rad/s
+    double oneEuroDerivativeCutoff;     // Hz
+
+    PoseFilterParameters();
+};
+
+/*!
+ * \brief The pose filters of the \a WebcamHeadTracker
+ *
+ * This holds the state of all filters. Each step feeds a new head pose to one of them,
+ * so that the filter can be switched at any time. The filters adapt to the actual time
+ * between poses, taken from their capture timestamps.
+ *
+ * Poses are in the tracker's internal representation: a translation in mm in OpenCV
+ * camera coordinates, and a rotation quaternion (x, y, z, w).
+ */
+class PoseFilter
+{
+public:
+    /*! \brief Constructor
+     * \param nominalFps    The nominal frame rate
+     * \param parameters    The filter parameters */
+    PoseFilter(double nominalFps, const PoseFilterParameters& parameters = PoseFilterParameters());
+    ~PoseFilter();
+
+    /*! \brief The filter parameters */
+    const PoseFilterParameters& parameters() const { return _parameters; }
+
+    /*! \brief Filter a new pose
+     * \param filter        The filter to use
+     * \param timestamp     The capture time of the pose in seconds
+     * \param vec           The translation
+     * \param quat          The rotation
+     * \param estimatedVec  Receives the filtered translation
+     * \param estimatedQuat Receives the filtered rotation */
+    void step(enum WebcamHeadTracker::Filter filter, double timestamp, const double* vec, const double* quat,
+        double* estimatedVec, double* estimatedQuat);
+
+    /*! \brief Extrapolate the state of the last used filter to the given time
+     *
+     * The extrapolation is limited to 100 ms beyond the last pose; \a WebcamHeadTracker::Filter_None
+     * does not extrapolate. Returns false if there was no pose yet. */
+    bool predict(double targetTime, double* vec, double* quat) const;
+
+    /*! \brief Load a filter choice and parameters from a file written by \a save()
+     *
+     * Parameters that are missing from the file keep their defaults, so that files of
+     * older versions remain valid. Returns false if the file does not exist or is invalid;
+     * the arguments are unchanged then. */
+    static bool load(const std::string& fileName, enum WebcamHeadTracker::Filter& filter,
+        PoseFilterParameters& parameters);
+
+    /*! \brief Save a filter choice and parameters
+     *
+     * Returns false if the file cannot be written. */
+    static bool save(const std::string& fileName, enum WebcamHeadTracker::Filter filter,
+        const PoseFilterParameters& parameters);
+
+private:
+    double _nominalFps;
+    PoseFilterParameters _parameters;
+    PoseKalmanFilter* _kalmanFilter;
+    QuaternionKalmanFilter* _quaternionKalmanFilter;
+    DoubleExponentialSmoothing* _despFilter;
+    OneEuroFilter* _oneEuroFilter;
+    // the last step
+    enum WebcamHeadTracker::Filter _lastFilter;
+    double _lastTimestamp;              // negative if there was no pose yet
+    double _lastInterval;
+    double _lastVec[3];
+    double _lastQuat[4];
+};
+
+#endif
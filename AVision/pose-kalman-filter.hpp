@@ -0,0 +1,136 @@
+#ifndef POSE_KALMAN_FILTER_HPP
+#define POSE_KALMAN_FILTER_HPP
+
+/* Kalman filter for one coordinate
+ * Used by the tracker and by the benchmarks.
+ *
+ * A constant acceleration model: the state is the value, its velocity and its
+ * acceleration, and only the value is measured. The process noise is added to
+ * the diagonal of the error covariance. The covariance and the gain do not
+ * depend on the measurements, so coordinates with the same noise can share them.
+ */
+
+static inline void kalmanTransition(double dt, double (*F)[3])
+{
+    F[0][0] = 1.0; F[0][1] = dt;  F[0][2] = 0.5 * dt * dt;
+    F[1][0] = 0.0; F[1][1] = 1.0; F[1][2] = dt;
+    F[2][0] = 0.0; F[2][1] = 0.0; F[2][2] = 1.0;
+}
+
+static inline void kalmanInit(double initialError, double (*P)[3])
+{
+    for (int i = 0; i < 3; i++) {
+        for (int j = 0; j < 3; j++)
+            P[i][j] = (i == j ? initialError : 0.0);
+    }
+}
+
+// x = F x
+static inline void kalmanPredictState(const double (*F)[3], double* x)
+{
+    double xPre[3];
+    for (int i = 0; i < 3; i++)
+        xPre[i] = F[i][0] * x[0] + F[i][1] * x[1] + F[i][2] * x[2];
+    x[0] = xPre[0];
+    x[1] = xPre[1];
+    x[2] = xPre[2];
+}
+
+// P = F P F^T + Q
+static inline void kalmanPredictCovariance(const double (*F)[3], double processNoise, double (*P)[3])
+{
+    double FP[3][3];
+    for (int i = 0; i < 3; i++) {
+        for (int j = 0; j < 3; j++)
+            FP[i][j] = F[i][0] * P[0][j] + F[i][1] * P[1][j] + F[i][2] * P[2][j];
+    }
+    for (int i = 0; i < 3; i++) {
+        for (int j = 0; j < 3; j++)
+            P[i][j] = FP[i][0] * F[j][0] + FP[i][1] * F[j][1] + FP[i][2] * F[j][2] + (i == j ? processNoise : 0.0);
+    }
+}
+
+// Compute the gain and correct the covariance; only the value is measured,
+// so the innovation covariance is a scalar
+static inline void kalmanCorrectCovariance(double measurementNoise, double (*P)[3], double* gain)
+{
+    double S = P[0][0] + measurementNoise;
+    double P0[3] = { P[0][0], P[0][1], P[0][2] };
+    for (int i = 0; i < 3; i++)
+        gain[i] = P0[i] / S;
+    for (int i = 0; i < 3; i++) {
+        for (int j = 0; j < 3; j++)
+            P[i][j] -= gain[i] * P0[j];
+    }
+}
+
+// x = x + gain * innovation
+static inline void kalmanCorrectState(const double* gain, double innovation, double* x)
+{
+    x[0] += gain[0] * innovation;
+    x[1] += gain[1] * innovation;
+    x[2] += gain[2] * innovation;
+}
+
+/* Kalman Filter
+ * A constant acceleration model for the position and the Euler angles, see
+ * http://docs.opencv.org/trunk/dc/d2c/tutorial_real_time_pose.html. As one
+ * cv::KalmanFilter, this has 18 states and 6 measurements, but the transition
+ * matrix only couples the value, velocity and acceleration of the same
+ * coordinate, and all noise covariances are diagonal. The filter therefore
+ * falls apart into six independent filters with three states each, which
+ * work on fixed-size arrays. Each step does the same operations on the
+ * nonzero entries as cv::KalmanFilter::predict() and correct().
+ * The transition is computed for the actual time step, and the process noise
+ * is given per nominal time step and scaled accordingly.
+ */
+
+class PoseKalmanFilter
+{
+private:
+    static const int coordinates = 6;
+    double _nominalDt;
+    double _processNoise;
+    double _measurementNoise;
+    // per coordinate: the state (value, velocity, acceleration) and its error covariance
+    double _state[coordinates][3];
+    double _errorCov[coordinates][3][3];
+
+public:
+    PoseKalmanFilter(double nominalDt, double processNoise, double measurementNoise, double initialError) :
+        _nominalDt(nominalDt),
+        _processNoise(processNoise),
+        _measurementNoise(measurementNoise)
+    {
+        for (int c = 0; c < coordinates; c++) {
+            _state[c][0] = _state[c][1] = _state[c][2] = 0.0;
+            kalmanInit(initialError, _errorCov[c]);
+        }
+    }
+
+    /* Predict by the time step dt (in seconds) and correct with the measurement
+     * of the six coordinates; the estimate receives the corrected values. */
+    void step(double dt, const double* measurement, double* estimate)
+    {
+        double F[3][3];
+        kalmanTransition(dt, F);
+        double processNoise = _processNoise * (dt / _nominalDt);
+        for (int c = 0; c < coordinates; c++) {
+            double gain[3];
+            kalmanPredictState(F, _state[c]);
+            kalmanPredictCovariance(F, processNoise, _errorCov[c]);
+            kalmanCorrectCovariance(_measurementNoise, _errorCov[c], gain);
+            kalmanCorrectState(gain, measurement[c] - _state[c][0], _state[c]);
+            estimate[c] = _state[c][0];
+        }
+    }
+
+    /* Extrapolate the six coordinates h seconds beyond the last step */
+    void predict(double h, double* estimate) const
+    {
+        for (int c = 0; c < coordinates; c++)
+            estimate[c] = _state[c][0] + _state[c][1] * h + 0.5 * _state[c][2] * h * h;
+    }
+};
+
+#endif
@@ -0,0 +1,254 @@
+#include "session-file.hpp"
+
+#include <cstring>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#include <opencv2/core/core.hpp>
+#include <opencv2/imgproc/imgproc.hpp>
+
+static const char sessionFileMagic[8] = { 'A', 'V', 'S', 'E', 'S', 'S', 0, 0 };
+static const uint32_t sessionFileVersion = 1;
+static const uint64_t sessionFileDataOffset = 4096;
+
+static uint64_t alignTo64(uint64_t x)
+{
+    return (x + 63) & ~uint64_t(63);
+}
+
+/* SessionRecorder */
+
+SessionRecorder::SessionRecorder() :
+    _file(NULL),
+    _converted(new cv::Mat)
+{
+}
+
+SessionRecorder::~SessionRecorder()
+{
+    close();
+    delete _converted;
+}
+
+bool SessionRecorder::open(const std::string& fileName, int width, int height, bool grayscale, float fps)
+{
+    close();
+    if (width <= 0 || height <= 0)
+        return false;
+    _file = std::fopen(fileName.c_str(), "wb");
+    if (!_file)
+        return false;
+    int channels = grayscale ? 1 : 3;
+    std::memset(&_header, 0, sizeof(_header));
+    std::memcpy(_header.magic, sessionFileMagic, sizeof(_header.magic));
+    _header.version = sessionFileVersion;
+    _header.width = width;
+    _header.height = height;
+    _header.type = grayscale ? CV_8UC1 : CV_8UC3;
+    _header.rowStride = alignTo64(uint64_t(width) * channels);
+    _header.pixelOffset = 64;
+    _header.frameStride = alignTo64(_header.pixelOffset + uint64_t(_header.rowStride) * height);
+    _header.dataOffset = sessionFileDataOffset;
+    _header.frameCount = 0;
+    _header.fps = fps;
+    // the frame count is written on close()
+    static const unsigned char zeros[sessionFileDataOffset] = {};
+    if (std::fwrite(&_header, sizeof(_header), 1, _file) != 1
+        || std::fwrite(zeros, _header.dataOffset - sizeof(_header), 1, _file) != 1) {
+        std::fclose(_file);
+        _file = NULL;
+        return false;
+    }
+    return true;
+}
+
+bool SessionRecorder::write(const cv::Mat& frame, double timestamp)
+{
+    if (!_file || frame.cols != int(_header.width) || frame.rows != int(_header.height))
+        return false;
+    const cv::Mat* f = &frame;
+    if (frame.type() != int(_header.type)) {
+        if (frame.channels() == 3 && _header.type == CV_8UC1)
+            cv::cvtColor(frame, *_converted, cv::COLOR_BGR2GRAY);
+        else if (frame.channels() == 1 && _header.type == CV_8UC3)
+            cv::cvtColor(frame, *_converted, cv::COLOR_GRAY2BGR);
+        else
+            return false;
+        f = _converted;
+    }
+    static const unsigned char zeros[64] = {};
+    size_t rowSize = f->cols * f->elemSize();
+    size_t rowPadding = _header.rowStride - rowSize;
+    size_t recordPadding = _header.frameStride - _header.pixelOffset - uint64_t(_header.rowStride) * _header.height;
+    bool ok = std::fwrite(&timestamp, sizeof(timestamp), 1, _file) == 1
+        && std::fwrite(zeros, _header.pixelOffset - sizeof(timestamp), 1, _file) == 1;
+    for (int y = 0; ok && y < f->rows; y++) {
+        ok = std::fwrite(f->ptr<unsigned char>(y), rowSize, 1, _file) == 1
+            && (rowPadding == 0 || std::fwrite(zeros, rowPadding, 1, _file) == 1);
+    }
+    ok = ok && (recordPadding == 0 || std::fwrite(zeros, recordPadding, 1, _file) == 1);
+    if (ok)
+        _header.frameCount++;
+    return ok;
+}
+
+void SessionRecorder::close()
+{
+    if (!_file)
+        return;
+    if (std::fseek(_file, 0, SEEK_SET) == 0)
+        std::fwrite(&_header, sizeof(_header), 1, _file);
+    std::fclose(_file);
+    _file = NULL;
+}
+
+/* SessionFrameSource */
+
+SessionFrameSource::SessionFrameSource(const std::string& fileName) :
+    _data(NULL),
+    _size(0),
+#ifdef _WIN32
+    _fileHandle(INVALID_HANDLE_VALUE),
+    _mappingHandle(NULL),
+#endif
+    _frameCount(0),
+    _firstTimestamp(0.0),
+    _index(0)
+{
+    std::memset(&_header, 0, sizeof(_header));
+#ifdef _WIN32
+    _fileHandle = CreateFileA(fileName.c_str(), GENERIC_READ, FILE_SHARE_READ, NULL,
+        OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL | FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+    if (_fileHandle == INVALID_HANDLE_VALUE)
+        return;
+    LARGE_INTEGER fileSize;
+    if (!GetFileSizeEx(_fileHandle, &fileSize) || fileSize.QuadPart < LONGLONG(sizeof(_header))) {
+        _unmap();
+        return;
+    }
+    // read-only: the frames are views of the mapping, and must not be drawn into
+    _mappingHandle = CreateFileMapping(_fileHandle, NULL, PAGE_READONLY, 0, 0, NULL);
+    if (!_mappingHandle) {
+        _unmap();
+        return;
+    }
+    _data = static_cast<unsigned char*>(MapViewOfFile(_mappingHandle, FILE_MAP_READ, 0, 0, 0));
+    if (!_data) {
+        _unmap();
+        return;
+    }
+    _size = fileSize.QuadPart;
+#else
+    int fd = ::open(fileName.c_str(), O_RDONLY);
+    if (fd < 0)
+        return;
+    struct stat statBuf;
+    if (::fstat(fd, &statBuf) != 0 || statBuf.st_size < off_t(sizeof(_header))) {
+        ::close(fd);
+        return;
+    }
+    // read-only: the frames are views of the mapping, and must not be drawn into
+    void* data = ::mmap(NULL, statBuf.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    ::close(fd);
+    if (data == MAP_FAILED)
+        return;
+    _data = static_cast<unsigned char*>(data);
+    _size = statBuf.st_size;
+    ::madvise(_data, _size, MADV_SEQUENTIAL);
+#endif
+
+    std::memcpy(&_header, _data, sizeof(_header));
+    if (std::memcmp(_header.magic, sessionFileMagic, sizeof(_header.magic)) != 0
+        || _header.version != sessionFileVersion
+        || (_header.type != CV_8UC1 && _header.type != CV_8UC3)
+        || _header.width == 0 || _header.height == 0
+        || _header.rowStride < _header.width * (_header.type == CV_8UC1 ? 1 : 3)
+        || _header.pixelOffset < sizeof(double)
+        || _header.frameStride < _header.pixelOffset + uint64_t(_header.rowStride) * _header.height
+        || _header.dataOffset > _size) {
+        _unmap();
+        return;
+    }
+    // a recording that was not closed properly has a frame count of zero;
+    // in any case, do not trust a frame count that does not fit the file size
+    uint64_t completeFrames = (_size - _header.dataOffset) / _header.frameStride;
+    _frameCount = _header.frameCount;
+    if (_frameCount == 0 || _frameCount > completeFrames)
+        _frameCount = completeFrames;
+    if (_header.fps <= 0.0f)
+        _header.fps = 30.0f;
+    _firstTimestamp = 0.0;
+    if (_frameCount > 0)
+        std::memcpy(&_firstTimestamp, _data + _header.dataOffset, sizeof(_firstTimestamp));
+}
+
+SessionFrameSource::~SessionFrameSource()
+{
+    _unmap();
+}
+
+void SessionFrameSource::_unmap()
+{
+#ifdef _WIN32
+    if (_data)
+        UnmapViewOfFile(_data);
+    if (_mappingHandle)
+        CloseHandle(_mappingHandle);
+    if (_fileHandle != INVALID_HANDLE_VALUE)
+        CloseHandle(_fileHandle);
+    _mappingHandle = NULL;
+    _fileHandle = INVALID_HANDLE_VALUE;
+#else
+    if (_data)
+        ::munmap(_data, _size);
+#endif
+    _data = NULL;
+    _size = 0;
+    _frameCount = 0;
+}
+
+bool SessionFrameSource::isOpened() const
+{
+    return _data != NULL;
+}
+
+int SessionFrameSource::width() const
+{
+    return _header.width;
+}
+
+int SessionFrameSource::height() const
+{
+    return _header.height;
+}
+
+float SessionFrameSource::fps() const
+{
+    return _header.fps;
+}
+
+bool SessionFrameSource::readRecorded(cv::Mat& frame, double& timestamp)
+{
+    if (_index >= _frameCount)
+        return false;
+    unsigned char* record = _data + _header.dataOffset + _index * _header.frameStride;
+    std::memcpy(&timestamp, record, sizeof(timestamp));
+    timestamp -= _firstTimestamp;
+    // a view of the mapped data: no copy
+    frame = cv::Mat(_header.height, _header.width, _header.type, record + _header.pixelOffset, _header.rowStride);
+    _index++;
+    return true;
+}
+
+bool SessionFrameSource::rewind()
+{
+    _index = 0;
+    return _frameCount > 0;
+}
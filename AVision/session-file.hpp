@@ -0,0 +1,116 @@
+#ifndef SESSION_FILE_HPP
+#define SESSION_FILE_HPP
+
+#include <cstdio>
+#include <cstdint>
+#include <string>
+
+#include "frame-source.hpp"
+
+/*!
+ * \brief Header of a recorded session file
+ *
+ * A session file stores raw frames with a fixed stride, so that frame i
+ * starts at dataOffset + i * frameStride. Each frame record starts with the
+ * capture timestamp (a double, in seconds), followed by the pixel data at
+ * offset \a pixelOffset within the record. All offsets and strides are
+ * multiples of 64 bytes, and \a dataOffset is a multiple of the page size,
+ * so that the pixel data of a memory-mapped file is suitably aligned.
+ * All values are stored in little endian byte order.
+ */
+struct SessionFileHeader
+{
+    char magic[8];          // "AVSESS\0\0"
+    uint32_t version;       // 1
+    uint32_t width;
+    uint32_t height;
+    uint32_t type;          // OpenCV type: CV_8UC1 or CV_8UC3
+    uint32_t rowStride;     // bytes per pixel row
+    uint32_t pixelOffset;   // offset of the pixel data within a frame record
+    uint64_t frameStride;   // bytes per frame record
+    uint64_t dataOffset;    // offset of the first frame record
+    uint64_t frameCount;    // 0 if the recording was not closed properly
+    float fps;              // nominal frame rate
+};
+
+/*!
+ * \brief Writes frames and their capture timestamps to a session file
+ */
+class SessionRecorder
+{
+public:
+    SessionRecorder();
+    ~SessionRecorder();
+
+    /*! \brief Create a session file
+     * \param fileName  Name of the file
+     * \param width     Frame width
+     * \param height    Frame height
+     * \param grayscale Whether to store 8-bit grayscale instead of BGR frames
+     * \param fps       Nominal frame rate
+     *
+     * Returns false if the file cannot be created. */
+    bool open(const std::string& fileName, int width, int height, bool grayscale, float fps);
+
+    /*! \brief Append a frame
+     * \param frame     BGR or grayscale frame; it is converted if necessary
+     * \param timestamp Capture timestamp in seconds
+     *
+     * Returns false if the frame has the wrong size or cannot be written. */
+    bool write(const cv::Mat& frame, double timestamp);
+
+    /*! \brief Finish the session file */
+    void close();
+
+    /*! \brief Returns true if a session file is open */
+    bool isOpen() const { return _file != NULL; }
+
+private:
+    std::FILE* _file;
+    SessionFileHeader _header;
+    cv::Mat* _converted;
+};
+
+/*!
+ * \brief Replay of a session file written by \a SessionRecorder
+ *
+ * The file is memory-mapped, and each frame is a view of the mapped pixel
+ * data, so no decoding or copying takes place. The mapping is read-only:
+ * frames must not be written to; copy a frame before drawing into it.
+ */
+class SessionFrameSource : public ReplayFrameSource
+{
+public:
+    /*! \brief Constructor
+     * \param fileName  Name of a session file */
+    SessionFrameSource(const std::string& fileName);
+    ~SessionFrameSource();
+
+    bool isOpened() const override;
+    int width() const override;
+    int height() const override;
+    float fps() const override;
+
+    /*! \brief Number of frames in the session */
+    uint64_t frameCount() const { return _frameCount; }
+
+protected:
+    bool readRecorded(cv::Mat& frame, double& timestamp) override;
+    bool rewind() override;
+
+private:
+    unsigned char* _data;
+    size_t _size;
+#ifdef _WIN32
+    void* _fileHandle;
+    void* _mappingHandle;
+#endif
+    SessionFileHeader _header;
+    uint64_t _frameCount;
+    double _firstTimestamp;
+    uint64_t _index;
+
+    void _unmap();
+};
+
+#endif
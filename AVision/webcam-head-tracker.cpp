@@ -21,22 +21,32 @@
  */
 
 #include "webcam-head-tracker.hpp"
+#include "frame-source.hpp"
+#include "session-file.hpp"
+#include "face-detector.hpp"
+#include "face-landmarks.hpp"
+#include "head-model.hpp"
+#include "head-pose-solver.hpp"
+#include "head-model-calibration.hpp"
+#include "pose-filter.hpp"
 
 #include <chrono>
 #include <cstdlib>
 #include <cstdio>
 #include <cmath>
+#include <atomic>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+#include <algorithm>
 
 #include <opencv2/highgui/highgui_c.h>
 #include <opencv2/highgui/highgui.hpp>
 #include <opencv2/imgproc/imgproc.hpp>
-#include <opencv2/objdetect/objdetect.hpp>
 #include <opencv2/calib3d/calib3d.hpp>
 #include <opencv2/video/tracking.hpp>
 
-#include <dlib/opencv.h>
-#include <dlib/image_processing.h>
-
 #define M_PI 3.14159265358979323846
 #define M_PI_2 1.57079632679489661923
 
@@ -56,142 +66,729 @@ float duration(const timer& start, const timer& end)
     return time_span.count() / 1e3f;
 }
 
-/* Double Exponential Smoothing
- * This implements double exponential smoothing-based prediction
- * as described in Sec. 2 of "Double Exponential Smoothing: An alternative to
- * Kalman Filter-Based Predictive Tracking" by Joseph J. LaViola Jr.
+/* Triple Buffer
+ * Lock-free exchange of the latest value between exactly one producer and
+ * one consumer. The producer owns one slot, the consumer owns one slot, and
+ * the third slot holds the most recently published value. Publishing and
+ * fetching swap an owned slot with the shared slot in a single atomic
+ * operation, so neither side ever waits for the other, and the consumer
+ * always gets the newest complete value.
  */
 
-class DoubleExponentialSmoothing
+template<typename T>
+class TripleBuffer
 {
 private:
-    bool _isInitialized;
-    double _lastVecS[3], _lastVecS2[3];
-    double _lastQuatS[4], _lastQuatS2[4];
+    T _slots[3];
+    // bits 0-1: index of the shared slot; bit 2: the shared slot holds an unread value
+    std::atomic<unsigned int> _shared;
+    unsigned int _back;     // owned by the producer
+    unsigned int _front;    // owned by the consumer
+
+    static const unsigned int FreshBit = 4;
+    static const unsigned int IndexMask = 3;
+
+public:
+    TripleBuffer() : _shared(1), _back(0), _front(2) {}
+
+    /* Producer side */
+    T& back() { return _slots[_back]; }
 
-    inline void copy3(double* result, const double* value)
+    void publish()
     {
-        result[0] = value[0];
-        result[1] = value[1];
-        result[2] = value[2];
+        unsigned int prev = _shared.exchange(_back | FreshBit, std::memory_order_acq_rel);
+        _back = prev & IndexMask;
     }
 
-    inline void copy4(double* result, const double* value)
+    /* Consumer side */
+    bool hasNew() const { return _shared.load(std::memory_order_acquire) & FreshBit; }
+
+    bool fetch()
     {
-        result[0] = value[0];
-        result[1] = value[1];
-        result[2] = value[2];
-        result[3] = value[3];
+        if (!hasNew())
+            return false;
+        unsigned int prev = _shared.exchange(_front, std::memory_order_acq_rel);
+        _front = prev & IndexMask;
+        return true;
     }
 
-    inline double mix(double alpha, double x, double y)
+    T& front() { return _slots[_front]; }
+};
+
+/* Capture Worker
+ * Reads frames on a background thread into a triple buffer so that
+ * the blocking webcam read overlaps with head pose computation.
+ */
+
+class CaptureWorker
+{
+private:
+    struct TimedFrame {
+        cv::Mat frame;
+        double timestamp;
+    };
+
+    FrameSource* _source;
+    TripleBuffer<TimedFrame> _frames;
+    std::atomic<bool> _stop;
+    std::atomic<bool> _atEnd;
+    // only used to sleep while the consumer is ahead of the webcam;
+    // frame exchange itself goes through the lock-free triple buffer
+    std::mutex _mutex;
+    std::condition_variable _cond;
+    std::thread _thread;
+
+    void run()
     {
-        return alpha * y + (1.0 - alpha) * x;
+        while (!_stop.load()) {
+            TimedFrame& f = _frames.back();
+            if (!_source->read(f.frame, f.timestamp)) {
+                if (_source->atEnd()) {
+                    _atEnd.store(true);
+                    { std::lock_guard<std::mutex> lock(_mutex); }
+                    _cond.notify_one();
+                    break;
+                }
+                std::this_thread::sleep_for(std::chrono::milliseconds(10));
+                continue;
+            }
+            _frames.publish();
+            { std::lock_guard<std::mutex> lock(_mutex); }
+            _cond.notify_one();
+        }
     }
 
-    inline void mix3(double* result, double alpha, const double* v, const double* w)
+public:
+    CaptureWorker(FrameSource* source) :
+        _source(source),
+        _stop(false),
+        _atEnd(false),
+        _thread(&CaptureWorker::run, this)
     {
-        result[0] = mix(alpha, v[0], w[0]);
-        result[1] = mix(alpha, v[1], w[1]);
-        result[2] = mix(alpha, v[2], w[2]);
     }
 
-    inline void mix4(double* result, double alpha, const double* v, const double* w)
+    ~CaptureWorker()
     {
-        result[0] = mix(alpha, v[0], w[0]);
-        result[1] = mix(alpha, v[1], w[1]);
-        result[2] = mix(alpha, v[2], w[2]);
-        result[3] = mix(alpha, v[3], w[3]);
+        _stop.store(true);
+        _thread.join();
     }
 
-    inline double dot4(const double* v, const double* w)
+    /* Get the newest frame. If no new frame arrived since the last call,
+     * wait for the next one, but at most for the given timeout. */
+    bool getFrame(cv::Mat& frame, double& timestamp, std::chrono::milliseconds timeout)
     {
-        return (v[0] * w[0] + v[1] * w[1] + v[2] * w[2] + v[3] * w[3]);
+        if (!_frames.hasNew()) {
+            std::unique_lock<std::mutex> lock(_mutex);
+            if (!_cond.wait_for(lock, timeout, [this]() { return _frames.hasNew() || _atEnd.load(); }))
+                return false;
+        }
+        if (!_frames.fetch())
+            return false;
+        // share the data of the consumer slot; the producer does not touch
+        // this slot again before the next call of this function
+        frame = _frames.front().frame;
+        timestamp = _frames.front().timestamp;
+        return true;
     }
 
-    inline void normalize4(double* v)
+    /* Returns true if the frame source has ended and all frames were fetched */
+    bool atEnd() const { return _atEnd.load() && !_frames.hasNew(); }
+};
+
+/* Local face search
+ * With FaceSearch_Local, the face is searched in the last face rectangle,
+ * enlarged by the padding (relative to the face width) on each side, and only
+ * for faces whose size is within the given range relative to the last face.
+ * After too many consecutive misses, the full frame is searched again.
+ */
+
+static const int minFaceSize = 80;
+static const float localSearchPadding = 0.5f;
+static const float localSearchMinScale = 0.7f;
+static const float localSearchMaxScale = 1.4f;
+static const int localSearchMaxMisses = 3;
+
+static bool detectFace(FaceDetector* detector, const cv::Mat& frame,
+    bool localSearch, const cv::Rect& lastFaceRect, cv::Rect& face)
+{
+    if (!localSearch)
+        return detector->detect(frame, minFaceSize, 0, face);
+    // search only around the last face, and only for faces of similar size
+    int padding = localSearchPadding * lastFaceRect.width;
+    cv::Rect searchRect(lastFaceRect.x - padding, lastFaceRect.y - padding,
+        lastFaceRect.width + 2 * padding, lastFaceRect.height + 2 * padding);
+    searchRect &= cv::Rect(0, 0, frame.cols, frame.rows);
+    int minSize = std::max(minFaceSize, int(localSearchMinScale * lastFaceRect.width));
+    int maxSize = localSearchMaxScale * lastFaceRect.width;
+    if (!detector->detect(frame(searchRect), minSize, maxSize, face))
+        return false;
+    face.x += searchRect.x;
+    face.y += searchRect.y;
+    return true;
+}
+
+/* Landmark-based face tracking
+ * With Tracking_Landmarks, the face rectangle is derived from the landmarks
+ * of the last frame instead of running the face detector. The detector runs
+ * again when the face model fits the landmarks badly (RMS reprojection error
+ * relative to the face width), when the face leaves the frame, and as a
+ * safety check after a fixed number of tracked frames.
+ */
+
+static const int trackingRedetectInterval = 30;
+static const float trackingMaxReprojectionError = 0.08f;
+
+/* Robust pose estimation
+ * With PoseSolver_Head_Model_Robust, residuals above the Huber threshold
+ * (relative to the face width) get less weight. Such outlier landmarks are
+ * left out of the fit check, as long as enough landmarks remain.
+ */
+
+static const float robustHuberThreshold = 0.025f;
+static const int robustMinInliers = 6;
+
+/* Head model calibration
+ * While there is no calibrated head model for the user, frames in which all
+ * landmark residuals are small (relative to the face width) are collected for
+ * the calibration, if the head turned a little since the last collected frame.
+ */
+
+static const int calibrationFrames = 60;
+static const float calibrationMaxResidual = 0.03f;
+
+/* Warm-started landmark detection
+ * With setLandmarkWarmStart(true), only the last stages of the landmark cascade
+ * run, starting from the previous landmarks. If the first of these stages moves
+ * the landmarks by more than the given RMS distance (relative to the face size),
+ * the previous landmarks are too far off, and the full cascade runs instead.
+ */
+
+static const int warmStartStages = 4;
+static const float warmStartMaxMotion = 0.02f;
+
+/* Optical flow tracking
+ * With Tracking_Optical_Flow, the pose landmarks are tracked with pyramidal
+ * Lucas-Kanade flow. The detectors run again after a number of frames, when
+ * the flow of a landmark fails, or when the mean flow error (the mean absolute
+ * intensity difference between the tracked patches) exceeds a threshold.
+ */
+
+static const int flowReanchorInterval = 10;
+static const float flowMaxError = 12.0f;
+static const int flowWindowSize = 15;
+static const int flowPyramidLevels = 3;
+
+/* Detection Worker
+ * Runs the face detector on a background thread for Detection_Asynchronous.
+ * Requests (a copy of the detection frame plus the local search parameters)
+ * and results are exchanged through triple buffers, so the pose loop never
+ * waits for the detector: it hands over a frame only when the worker is idle,
+ * and it picks up the newest result whenever one was published.
+ */
+
+class DetectionWorker
+{
+public:
+    struct Request {
+        cv::Mat frame;
+        bool localSearch;
+        cv::Rect lastFaceRect;
+    };
+
+private:
+    struct Result {
+        bool found;
+        cv::Rect face;
+    };
+
+    FaceDetector* _detector;
+    TripleBuffer<Request> _requests;
+    TripleBuffer<Result> _results;
+    std::atomic<bool> _stop;
+    std::atomic<bool> _busy;
+    // only used to sleep while there is no request
+    std::mutex _mutex;
+    std::condition_variable _cond;
+    std::thread _thread;
+
+    void run()
     {
-        double s = std::sqrt(dot4(v, v));
-        v[0] /= s;
-        v[1] /= s;
-        v[2] /= s;
-        v[3] /= s;
+        for (;;) {
+            {
+                std::unique_lock<std::mutex> lock(_mutex);
+                _cond.wait(lock, [this]() { return _requests.hasNew() || _stop.load(); });
+            }
+            if (_stop.load())
+                break;
+            _requests.fetch();
+            const Request& request = _requests.front();
+            Result& result = _results.back();
+            result.found = detectFace(_detector, request.frame,
+                request.localSearch, request.lastFaceRect, result.face);
+            _results.publish();
+            _busy.store(false);
+        }
     }
 
-    inline void slerp(double* result, double alpha, const double* q, const double* r)
+public:
+    DetectionWorker(FaceDetector* detector) :
+        _detector(detector),
+        _stop(false),
+        _busy(false),
+        _thread(&DetectionWorker::run, this)
     {
-        double w[4] = { r[0], r[1], r[2], r[3] };
-        double cosHalfAngle = dot4(q, r);
-        if (cosHalfAngle < 0.0) {
-            // quat(x, y, z, w) and quat(-x, -y, -z, -w) represent the same rotation
-            w[0] = -w[0]; w[1] = -w[1]; w[2] = -w[2]; w[3] = -w[3];
-            cosHalfAngle = -cosHalfAngle;
-        }
-        double tmpQ, tmpW;
-        if (std::fabs(cosHalfAngle) >= 1.0) {
-            // angle is zero => rotations are identical
-            tmpQ = 1.0;
-            tmpW = 0.0;
+    }
+
+    ~DetectionWorker()
+    {
+        {
+            std::lock_guard<std::mutex> lock(_mutex);
+            _stop.store(true);
         }
-        else {
-            double halfAngle = acos(cosHalfAngle);
-            double sinHalfAngle = sqrt(1.0 - cosHalfAngle * cosHalfAngle);
-            if (std::fabs(sinHalfAngle) < 0.001) {
-                // angle is 180 degrees => result is not clear
-                tmpQ = 0.5;
-                tmpW = 0.5;
+        _cond.notify_one();
+        _thread.join();
+    }
+
+    /* Returns true while the worker processes a request */
+    bool busy() const { return _busy.load(); }
+
+    /* The request to fill before calling submit(). Its frame buffer
+     * is reused, so copying a frame into it does not allocate memory. */
+    Request& request() { return _requests.back(); }
+
+    void submit()
+    {
+        _busy.store(true);
+        {
+            std::lock_guard<std::mutex> lock(_mutex);
+            _requests.publish();
+        }
+        _cond.notify_one();
+    }
+
+    /* Get the newest result, if one was published since the last call */
+    bool getResult(bool& found, cv::Rect& face)
+    {
+        if (!_results.fetch())
+            return false;
+        found = _results.front().found;
+        face = _results.front().face;
+        return true;
+    }
+};
+
+/* Frame State
+ * The data of one frame on its way through the stages of the head tracking:
+ * the frame itself, the face and landmarks found in it, and the pose of the
+ * face model, plus what the timing output and the preview need. The tracking
+ * state that is carried from one frame to the next stays in the workspace;
+ * everything that belongs to a single frame is passed from stage to stage in
+ * this structure, so that in Execution_Pipelined mode the stages can work on
+ * different frames at the same time.
+ */
+
+struct FrameState
+{
+    static const int landmarkCount = 68;
+
+    cv::Mat frame;
+    cv::Mat frameGray;
+    // face and landmarks
+    bool located;
+    cv::Rect faceRect;
+    bool visible;           // the face rectangle for the next frame is mostly inside the frame
+    bool localSearch, tracking, flowing, async, warmStarted;
+    std::vector<cv::Point2f> landmarks;
+    // pose
+    bool lastPoseValid;
+    bool fitted;            // the face model was fitted, so the residuals are valid
+    bool posed;             // the pose passed all checks
+    double rvec[3], tvec[3];
+    float residuals[HeadPoseSolver::pointCount];
+    bool inliers[HeadPoseSolver::pointCount];
+    int solverIterations;
+    bool headModelCalibrated;
+    std::vector<cv::Point3f> modelLandmarks;    // the model of the fit, for the preview
+    // stage durations in ms
+    float grayDuration, detectionDuration, landmarksDuration, poseDuration;
+
+    FrameState() :
+        located(false),
+        visible(false),
+        localSearch(false), tracking(false), flowing(false), async(false), warmStarted(false),
+        landmarks(landmarkCount),
+        lastPoseValid(false),
+        fitted(false),
+        posed(false),
+        rvec{ 0.0, 0.0, 0.0 },
+        tvec{ 0.0, 0.0, 0.0 },
+        residuals{ 0.0f },
+        inliers{ false },
+        solverIterations(0),
+        headModelCalibrated(false),
+        modelLandmarks(modelLandmarkPositions, modelLandmarkPositions + modelLandmarkCount),
+        grayDuration(0.0f), detectionDuration(0.0f), landmarksDuration(0.0f), poseDuration(0.0f)
+    {
+    }
+};
+
+/* Pose Workspace
+ * All buffers that computeHeadPose() needs per frame, plus the tracking state
+ * that is carried from one frame to the next. The buffers are sized once in
+ * initPoseEstimator() and then reused, so that a steady-state frame does not
+ * allocate memory in this file. (OpenCV and the face detector may still allocate internally.)
+ * In Execution_Pipelined mode, the face and landmark state belongs to the
+ * landmark thread, the fit state to the pose thread, and the preview buffers
+ * to the thread of computeHeadPose().
+ */
+
+struct PoseWorkspace
+{
+    static const int landmarkCount = FrameState::landmarkCount;
+    static_assert(HeadPoseSolver::pointCount == modelLandmarkCount, "HeadPoseSolver does not fit the face model");
+
+    // the current frame in Execution_Sequential mode
+    FrameState frameState;
+    std::vector<cv::Point2f> landmarks;
+    std::vector<cv::Point3f> modelLandmarks;
+    std::vector<cv::Point2f> imageLandmarks;
+    cv::Mat distCoeffs;
+    cv::Mat rvec, tvec;
+    HeadPoseSolver poseSolver;
+    std::vector<cv::Point2f> projectedModelLandmarks;
+    // the residuals of the last fit, for getLandmarkResiduals()
+    float residuals[HeadPoseSolver::pointCount];
+    // preview buffers
+    cv::Mat previewFrame;
+    cv::Mat previewDistCoeffs;
+    cv::Mat previewRvec, previewTvec;
+    std::vector<cv::Point2f> previewModelLandmarks;
+    std::vector<cv::Point2f> previewFilteredModelLandmarks;
+    // tracking state
+    cv::Rect lastFaceRect;
+    int faceMisses;
+    bool trackingValid;
+    // whether the landmarks of the last fitted frame can be tracked: -1 if not known yet,
+    // 0 if the face was lost, 1 if they can; set by the pose fit for the next face detection
+    std::atomic<int> trackingVerdict;
+    int framesSinceDetection;
+    int framesSinceSubmission;
+    bool landmarksValid;
+    std::vector<cv::Point2f> initialLandmarks;
+    bool poseValid;
+    double lastRvec[3];
+    double lastTvec[3];
+    bool headModelCalibrated;
+    // the pose filter is shared with predictPose(), which may run on another thread
+    std::mutex filterMutex;
+    cv::Rect trackedFaceRect;
+    float faceRectFromShape[4];
+    // optical flow state: pyramids of the current and the last frame, and the pose landmarks
+    cv::Mat flowGray;
+    std::vector<cv::Mat> flowPyramid;
+    std::vector<cv::Mat> lastFlowPyramid;
+    std::vector<cv::Point2f> flowPoints;
+    std::vector<cv::Point2f> flowedPoints;
+    std::vector<unsigned char> flowStatus;
+    std::vector<float> flowError;
+
+    PoseWorkspace() :
+        landmarks(landmarkCount),
+        modelLandmarks(modelLandmarkPositions, modelLandmarkPositions + modelLandmarkCount),
+        imageLandmarks(modelLandmarkCount),
+        distCoeffs(1, 5, CV_32F),
+        rvec(1, 3, CV_64F),
+        tvec(1, 3, CV_64F),
+        poseSolver(modelLandmarkPositions),
+        projectedModelLandmarks(modelLandmarkCount),
+        residuals{ 0.0f },
+        previewDistCoeffs(1, 5, CV_32F),
+        previewRvec(1, 3, CV_64F),
+        previewTvec(1, 3, CV_64F),
+        previewModelLandmarks(modelLandmarkCount),
+        previewFilteredModelLandmarks(modelLandmarkCount),
+        faceMisses(0),
+        trackingValid(false),
+        trackingVerdict(-1),
+        framesSinceDetection(0),
+        framesSinceSubmission(0),
+        landmarksValid(false),
+        initialLandmarks(landmarkCount),
+        poseValid(false),
+        lastRvec{ 0.0, 0.0, 0.0 },
+        lastTvec{ 0.0, 0.0, 0.0 },
+        headModelCalibrated(false),
+        faceRectFromShape{ 0.0f, 0.0f, 1.0f, 1.0f },
+        flowPoints(poseLandmarkCount),
+        flowedPoints(poseLandmarkCount),
+        flowStatus(poseLandmarkCount),
+        flowError(poseLandmarkCount)
+    {
+    }
+
+    void setHeadModel(const cv::Point3f* model)
+    {
+        modelLandmarks.assign(model, model + modelLandmarkCount);
+        poseSolver.setModel(model);
+    }
+};
+
+/* Frame Queue
+ * A bounded lock-free ring of frame tickets between exactly one producer and
+ * one consumer. A ticket names a frame slot of the tracking pipeline, plus the
+ * number and the capture time of its frame. When the ring is full, push()
+ * drops the oldest ticket and hands its slot back, so that a stage that falls
+ * behind always gets recent frames and the latency cannot grow.
+ * Since dropping moves the read index, both sides move it with compare-and-swap.
+ * The consumer reads a ticket before it claims it; if the producer dropped the
+ * ticket and reused its entry meanwhile, the claim fails and the consumer tries
+ * again. The entries are atomics, so reading an entry while it is rewritten is
+ * harmless.
+ */
+
+struct FrameTicket
+{
+    int slot;
+    unsigned long long number;
+    double timestamp;
+};
+
+template<int Capacity>
+class FrameQueue
+{
+private:
+    struct Entry {
+        std::atomic<int> slot;
+        std::atomic<unsigned long long> number;
+        std::atomic<double> timestamp;
+    };
+
+    Entry _entries[Capacity];
+    std::atomic<unsigned long long> _head;  // index of the oldest ticket
+    std::atomic<unsigned long long> _tail;  // index of the next ticket; only moved by the producer
+    std::atomic<bool> _closed;
+    // only used to sleep while the queue is empty;
+    // the tickets themselves go through the lock-free ring
+    std::mutex _mutex;
+    std::condition_variable _cond;
+
+    void read(unsigned long long index, FrameTicket& ticket) const
+    {
+        const Entry& e = _entries[index % Capacity];
+        ticket.slot = e.slot.load(std::memory_order_relaxed);
+        ticket.number = e.number.load(std::memory_order_relaxed);
+        ticket.timestamp = e.timestamp.load(std::memory_order_relaxed);
+    }
+
+public:
+    FrameQueue() : _head(0), _tail(0), _closed(false) {}
+
+    /* Producer side: append a ticket. Returns the slot of the ticket that
+     * was dropped to make room for it, or -1 if none was dropped. */
+    int push(const FrameTicket& ticket)
+    {
+        unsigned long long tail = _tail.load(std::memory_order_relaxed);
+        unsigned long long head = _head.load(std::memory_order_acquire);
+        int dropped = -1;
+        if (tail - head == Capacity) {
+            // drop the oldest ticket, unless the consumer claims it first;
+            // either way, its entry is free afterwards
+            FrameTicket oldest;
+            read(head, oldest);
+            if (_head.compare_exchange_strong(head, head + 1, std::memory_order_acq_rel))
+                dropped = oldest.slot;
+        }
+        Entry& e = _entries[tail % Capacity];
+        e.slot.store(ticket.slot, std::memory_order_relaxed);
+        e.number.store(ticket.number, std::memory_order_relaxed);
+        e.timestamp.store(ticket.timestamp, std::memory_order_relaxed);
+        _tail.store(tail + 1, std::memory_order_release);
+        { std::lock_guard<std::mutex> lock(_mutex); }
+        _cond.notify_one();
+        return dropped;
+    }
+
+    /* Producer side: no more tickets follow. This also wakes up a waiting consumer. */
+    void close()
+    {
+        _closed.store(true);
+        { std::lock_guard<std::mutex> lock(_mutex); }
+        _cond.notify_one();
+    }
+
+    /* Consumer side: take the oldest ticket. Returns false if the queue is empty. */
+    bool pop(FrameTicket& ticket)
+    {
+        unsigned long long head = _head.load(std::memory_order_acquire);
+        for (;;) {
+            if (head == _tail.load(std::memory_order_acquire))
+                return false;
+            read(head, ticket);
+            if (_head.compare_exchange_weak(head, head + 1, std::memory_order_acq_rel))
+                return true;
+        }
+    }
+
+    /* Consumer side: wait until the queue is not empty or closed, but at most for
+     * the given timeout. Returns false on timeout. */
+    bool wait(std::chrono::milliseconds timeout)
+    {
+        std::unique_lock<std::mutex> lock(_mutex);
+        return _cond.wait_for(lock, timeout, [this]() { return !empty() || _closed.load(); });
+    }
+
+    bool empty() const
+    {
+        return _head.load(std::memory_order_acquire) == _tail.load(std::memory_order_acquire);
+    }
+
+    /* Returns true if the queue was closed and all tickets were taken */
+    bool atEnd() const { return _closed.load() && empty(); }
+};
+
+/* Tracking Pipeline
+ * Runs the stages of the head tracking for Execution_Pipelined on threads of
+ * their own: capture (reading, recording, and grayscale conversion), face and
+ * landmark detection, and the pose fit. The thread that calls getNewFrame()
+ * and computeHeadPose() is the last stage: it filters the pose and shows the
+ * preview, so that the pose filter and the window stay on that thread.
+ * The frames live in a fixed set of slots, whose buffers are reused. The stages
+ * hand slots on through frame queues, and return the slots of dropped frames to
+ * the free set. Each stage works on one frame at a time, so the frame rate is
+ * that of the slowest stage, and each queue holds at most two frames, so the
+ * latency stays bounded.
+ */
+
+class TrackingPipeline
+{
+public:
+    typedef std::function<void(FrameState&, double)> CaptureStage;
+    typedef std::function<void(FrameState&)> Stage;
+
+private:
+    static const int queueCapacity = 2;
+    // one slot for each stage and for the consumer, plus the queued ones
+    static const int slotCount = 4 + 3 * queueCapacity;
+
+    FrameSource* _source;
+    CaptureStage _capture;
+    Stage _locate, _solve;
+    FrameState _slots[slotCount];
+    std::atomic<unsigned int> _freeSlots;   // bit i is set if slot i is free
+    FrameQueue<queueCapacity> _captured, _located, _solved;
+    unsigned long long _frameNumber;        // of the last captured frame
+    int _consumerSlot;                      // the slot of the last getFrame(), or -1
+    std::atomic<bool> _stop;
+    std::thread _captureThread;
+    std::thread _locateThread;
+    std::thread _solveThread;
+
+    // Only the capture thread takes slots, and the other threads only return
+    // them, so a free slot cannot be taken by someone else in the meantime.
+    int takeSlot()
+    {
+        unsigned int freeSlots = _freeSlots.load();
+        for (int slot = 0; slot < slotCount; slot++) {
+            if (freeSlots & (1u << slot)) {
+                _freeSlots.fetch_and(~(1u << slot));
+                return slot;
             }
-            else {
-                tmpQ = std::sin((1.0 - alpha) * halfAngle) / sinHalfAngle;
-                tmpW = sin(alpha * halfAngle) / sinHalfAngle;
+        }
+        return -1;
+    }
+
+    void returnSlot(int slot)
+    {
+        if (slot >= 0)
+            _freeSlots.fetch_or(1u << slot);
+    }
+
+    void runCapture()
+    {
+        while (!_stop.load()) {
+            int slot = takeSlot();
+            if (slot < 0) {
+                // cannot happen with enough slots, but do not spin if it does
+                std::this_thread::sleep_for(std::chrono::milliseconds(1));
+                continue;
             }
+            FrameTicket ticket = { slot, 0, 0.0 };
+            if (!_source->read(_slots[slot].frame, ticket.timestamp)) {
+                returnSlot(slot);
+                if (_source->atEnd())
+                    break;
+                std::this_thread::sleep_for(std::chrono::milliseconds(10));
+                continue;
+            }
+            ticket.number = ++_frameNumber;
+            _capture(_slots[slot], ticket.timestamp);
+            returnSlot(_captured.push(ticket));
         }
-        result[0] = q[0] * tmpQ + w[0] * tmpW;
-        result[1] = q[1] * tmpQ + w[1] * tmpW;
-        result[2] = q[2] * tmpQ + w[2] * tmpW;
-        result[3] = q[3] * tmpQ + w[3] * tmpW;
+        _captured.close();
+    }
+
+    void runStage(FrameQueue<queueCapacity>& input, const Stage& stage, FrameQueue<queueCapacity>& output)
+    {
+        while (!_stop.load()) {
+            FrameTicket ticket;
+            if (!input.pop(ticket)) {
+                if (input.atEnd())
+                    break;
+                input.wait(std::chrono::milliseconds(1000));
+                continue;
+            }
+            stage(_slots[ticket.slot]);
+            returnSlot(output.push(ticket));
+        }
+        output.close();
     }
 
 public:
-    DoubleExponentialSmoothing() : _isInitialized(false) {}
+    TrackingPipeline(FrameSource* source, unsigned long long frameNumber,
+        const CaptureStage& capture, const Stage& locate, const Stage& solve) :
+        _source(source),
+        _capture(capture),
+        _locate(locate),
+        _solve(solve),
+        _freeSlots((1u << slotCount) - 1),
+        _frameNumber(frameNumber),
+        _consumerSlot(-1),
+        _stop(false),
+        _captureThread(&TrackingPipeline::runCapture, this),
+        _locateThread(&TrackingPipeline::runStage, this, std::ref(_captured), std::cref(_locate), std::ref(_located)),
+        _solveThread(&TrackingPipeline::runStage, this, std::ref(_located), std::cref(_solve), std::ref(_solved))
+    {
+    }
 
-    void step(const double* vec, const double* quat,
-        double alpha, double tau, double* estimatedVec, double* estimatedQuat)
+    ~TrackingPipeline()
     {
-        if (!_isInitialized) {
-            copy3(_lastVecS, vec);
-            copy3(_lastVecS2, vec);
-            copy4(_lastQuatS, quat);
-            copy4(_lastQuatS2, quat);
-            _isInitialized = true;
-        }
-        double vecS[3], vecS2[3], quatS[4], quatS2[4];
-        // Eq. (1), (2)
-        mix3(vecS, alpha, _lastVecS, vec);
-        mix3(vecS2, alpha, _lastVecS2, vecS);
-        mix4(quatS, alpha, _lastQuatS, quat);
-        mix4(quatS2, alpha, _lastQuatS2, quatS);
-        copy3(_lastVecS, vecS);
-        copy3(_lastVecS2, vecS2);
-        copy4(_lastQuatS, quatS);
-        copy4(_lastQuatS2, quatS2);
-        // Eq. (6) for floor(tau) and ceil(tau)
-        double floorTau = std::floor(tau);
-        double betaFloorTau = 2.0 + alpha * floorTau / (1.0 - alpha);
-        double estimatedVecFloorTau[3], estimatedQuatFloorTau[4];
-        mix3(estimatedVecFloorTau, betaFloorTau, vecS2, vecS);
-        mix4(estimatedQuatFloorTau, betaFloorTau, quatS2, quatS);
-        normalize4(estimatedQuatFloorTau);
-        double ceilTau = std::ceil(tau);
-        double betaCeilTau = 2.0 + alpha * ceilTau / (1.0 - alpha);
-        double estimatedVecCeilTau[3], estimatedQuatCeilTau[4];
-        mix3(estimatedVecCeilTau, betaCeilTau, vecS2, vecS);
-        mix4(estimatedQuatCeilTau, betaCeilTau, quatS2, quatS);
-        normalize4(estimatedQuatCeilTau);
-        // mix results for floor(tau) and ceil(tau)
-        mix3(estimatedVec, tau - floorTau, estimatedVecCeilTau, estimatedVecFloorTau);
-        slerp(estimatedQuat, tau - floorTau, estimatedQuatCeilTau, estimatedQuatFloorTau);
+        _stop.store(true);
+        // wake up the stages that wait for frames
+        _captured.close();
+        _located.close();
+        _captureThread.join();
+        _locateThread.join();
+        _solveThread.join();
     }
+
+    /* Get the next frame that passed all stages. If there is none yet, wait
+     * for it, but at most for the given timeout. The slot of the frame from
+     * the last call goes back to the pipeline. Returns NULL if there is no frame. */
+    FrameState* getFrame(std::chrono::milliseconds timeout, unsigned long long& number, double& timestamp)
+    {
+        returnSlot(_consumerSlot);
+        _consumerSlot = -1;
+        FrameTicket ticket;
+        if (!_solved.pop(ticket) && !(_solved.wait(timeout) && _solved.pop(ticket)))
+            return NULL;
+        _consumerSlot = ticket.slot;
+        number = ticket.number;
+        timestamp = ticket.timestamp;
+        return &_slots[ticket.slot];
+    }
+
+    /* Returns true if the frame source has ended and all frames were fetched */
+    bool atEnd() const { return _solved.atEnd(); }
 };
 
 /* WebcamHeadTracker */
@@ -203,53 +800,87 @@ bool WebcamHeadTracker::FeedOpened = false;
 WebcamHeadTracker::WebcamHeadTracker(unsigned int debugOptions) :
     _debugOptions(debugOptions),
     _isReady(false),
-    _capture(NULL),
+    _frameSource(NULL),
     _frame(NULL),
+    _frameTimestamp(0.0),
+    _frameNumber(0),
+    _recorder(NULL),
+    _grayscaleProcessing(false),
+    _landmarkWarmStart(false),
+    _captureMode(Capture_Synchronous),
+    _captureWorker(NULL),
+    _executionMode(Execution_Sequential),
+    _pipeline(NULL),
+    _pipelineFrame(NULL),
     _w(0), _h(0),
     _fps(0.0f),
     _fx(0.0f), _fy(0.0f),
     _cx(0.0f), _cy(0.0f),
     _k1(0.0f), _k2(0.0f), _p1(0.0f), _p2(0.0f), _k3(0.0f),
-    _faceCascade(NULL),
+    _faceDetector(NULL),
     _faceModel(NULL),
+    _faceSearch(FaceSearch_Full_Frame),
+    _trackingMode(Tracking_Detect_Every_Frame),
+    _detectionMode(Detection_Synchronous),
+    _poseSolver(PoseSolver_OpenCV),
+    _headModelCalibration(NULL),
+    _headModelCalibrated(false),
+    _detectionInterval(5),
+    _detectionWorker(NULL),
     _filter(Filter_Double_Exponential),
-    _kalmanFilter(NULL),
-    _despFilter(NULL),
+    _poseFilter(NULL),
+    _workspace(NULL),
     _headPosition{ 0.0f, 0.0f, 0.5f },
-    _headOrientation{ 0.0f, 0.0f, 0.0f, 0.0f },
-    _windowHandle(NULL),
-    _windowClassName(L"AVisionHeadTracker")
+    _headOrientation{ 0.0f, 0.0f, 0.0f, 0.0f }
+#ifdef _WIN32
+    , _windowClassName(L"AVisionHeadTracker"),
+    _windowHandle(NULL)
+#endif
 {
 }
 
 WebcamHeadTracker::~WebcamHeadTracker()
 {
-    delete _capture;
+    delete _pipeline;
+    delete _captureWorker;
+    delete _recorder;
+    delete _frameSource;
     delete _frame;
-    delete _faceCascade;
+    delete _detectionWorker;
+    delete _faceDetector;
     delete _faceModel;
-    delete _kalmanFilter;
-    delete _despFilter;
+    delete _headModelCalibration;
+    delete _poseFilter;
+    delete _workspace;
 
+#ifdef _WIN32
     if (_windowHandle != NULL)
     {
         DestroyWindow(_windowHandle);
         UnregisterClass(_wc.lpszClassName, _wc.hInstance);
     }
+#endif
 }
 
 bool WebcamHeadTracker::initWebcam()
 {
-    if (_capture)
+    if (_frameSource)
         return isReady();
-    _capture = new cv::VideoCapture(0);
-    if (_capture && _capture->isOpened()) {
-        _capture->set(cv::CAP_PROP_FRAME_WIDTH, 640);
-        _capture->set(cv::CAP_PROP_FRAME_HEIGHT, 480);
+    return initFrameSource(new CameraFrameSource(0, 640, 480));
+}
+
+bool WebcamHeadTracker::initFrameSource(FrameSource* source)
+{
+    if (_frameSource) {
+        delete source;
+        return isReady();
+    }
+    _frameSource = source;
+    if (_frameSource && _frameSource->isOpened()) {
         _frame = new cv::Mat;
-        _w = _capture->get(cv::CAP_PROP_FRAME_WIDTH);
-        _h = _capture->get(cv::CAP_PROP_FRAME_HEIGHT);
-        _fps = _capture->get(cv::CAP_PROP_FPS);
+        _w = _frameSource->width();
+        _h = _frameSource->height();
+        _fps = _frameSource->fps();
         if (_fps <= 0.0f)
             _fps = 30.0f;
         const char* intrinsics;
@@ -277,6 +908,8 @@ bool WebcamHeadTracker::initWebcam()
             _p2 = p2;
             _k3 = k3;
         }
+        if (_captureMode == Capture_Threaded)
+            _captureWorker = new CaptureWorker(_frameSource);
         return true;
     }
     else {
@@ -284,6 +917,24 @@ bool WebcamHeadTracker::initWebcam()
     }
 }
 
+bool WebcamHeadTracker::startRecording(const char* fileName, bool grayscale)
+{
+    if (!_frameSource || !_frameSource->isOpened())
+        return false;
+    // the capture stage of the pipeline writes to the recorder
+    _stopPipeline();
+    if (!_recorder)
+        _recorder = new SessionRecorder;
+    return _recorder->open(fileName, _w, _h, grayscale, _fps);
+}
+
+void WebcamHeadTracker::stopRecording()
+{
+    _stopPipeline();
+    if (_recorder)
+        _recorder->close();
+}
+
 #define STRINGIFY(s) STRINGIFY_HELPER(s)
 #define STRINGIFY_HELPER(s) #s
 
@@ -312,59 +963,48 @@ bool WebcamHeadTracker::initPoseEstimator(const char* frontalFaceXml, const char
     if (isReady())
         return true;
 
-    _faceCascade = new cv::CascadeClassifier;
-    if (!_faceCascade->load(frontalFaceXml)) {
-        delete _faceCascade;
-        _faceCascade = NULL;
-        return false;
+    bool ownDetector = false;
+    if (!_faceDetector) {
+        _faceDetector = FaceDetector::create(FaceDetector::Backend_Haar, frontalFaceXml);
+        if (!_faceDetector)
+            return false;
+        ownDetector = true;
     }
 
-    _faceModel = new dlib::shape_predictor;
-    try {
-        dlib::deserialize(faceLandmarksDat) >> *_faceModel;
-    }
-    catch (std::exception& e) {
-        delete _faceCascade;
-        _faceCascade = NULL;
+    // The first start converts the dlib model into a precompiled file next to it;
+    // later starts only map that file.
+    _faceModel = new FaceLandmarkModel;
+    if (!_faceModel->load(faceLandmarksDat, std::string(faceLandmarksDat) + ".flat")
+        || _faceModel->landmarkCount() != 68) {
+        if (ownDetector) {
+            delete _faceDetector;
+            _faceDetector = NULL;
+        }
         delete _faceModel;
         _faceModel = NULL;
         return false;
     }
-
-    // See http://docs.opencv.org/trunk/dc/d2c/tutorial_real_time_pose.html
-    // for information on this!
-    _kalmanFilter = new cv::KalmanFilter;
-    _kalmanFilter->init(18, 6, 0, CV_64F);
-    cv::setIdentity(_kalmanFilter->processNoiseCov, cv::Scalar::all(1e-3));
-    cv::setIdentity(_kalmanFilter->measurementNoiseCov, cv::Scalar::all(1e-1));
-    cv::setIdentity(_kalmanFilter->errorCovPost, cv::Scalar::all(1));
-    float dt = 1.0f / _fps;
-    _kalmanFilter->transitionMatrix.at<double>(0, 3) = dt;
-    _kalmanFilter->transitionMatrix.at<double>(1, 4) = dt;
-    _kalmanFilter->transitionMatrix.at<double>(2, 5) = dt;
-    _kalmanFilter->transitionMatrix.at<double>(3, 6) = dt;
-    _kalmanFilter->transitionMatrix.at<double>(4, 7) = dt;
-    _kalmanFilter->transitionMatrix.at<double>(5, 8) = dt;
-    _kalmanFilter->transitionMatrix.at<double>(0, 6) = 0.5f * dt * dt;
-    _kalmanFilter->transitionMatrix.at<double>(1, 7) = 0.5f * dt * dt;
-    _kalmanFilter->transitionMatrix.at<double>(2, 8) = 0.5f * dt * dt;
-    _kalmanFilter->transitionMatrix.at<double>(9, 12) = dt;
-    _kalmanFilter->transitionMatrix.at<double>(10, 13) = dt;
-    _kalmanFilter->transitionMatrix.at<double>(11, 14) = dt;
-    _kalmanFilter->transitionMatrix.at<double>(12, 15) = dt;
-    _kalmanFilter->transitionMatrix.at<double>(13, 16) = dt;
-    _kalmanFilter->transitionMatrix.at<double>(14, 17) = dt;
-    _kalmanFilter->transitionMatrix.at<double>(9, 15) = 0.5f * dt * dt;
-    _kalmanFilter->transitionMatrix.at<double>(10, 16) = 0.5f * dt * dt;
-    _kalmanFilter->transitionMatrix.at<double>(11, 17) = 0.5f * dt * dt;
-    _kalmanFilter->measurementMatrix.at<double>(0, 0) = 1;
-    _kalmanFilter->measurementMatrix.at<double>(1, 1) = 1;
-    _kalmanFilter->measurementMatrix.at<double>(2, 2) = 1;
-    _kalmanFilter->measurementMatrix.at<double>(3, 9) = 1;
-    _kalmanFilter->measurementMatrix.at<double>(4, 10) = 1;
-    _kalmanFilter->measurementMatrix.at<double>(5, 11) = 1;
-
-    _despFilter = new DoubleExponentialSmoothing;
+    if (_debugOptions & Debug_Timing)
+        fprintf(stderr, "WHT: face landmark kernel: %s\n", FaceLandmarkModel::kernelName(_faceModel->kernel()));
+
+    PoseFilterParameters filterParameters;
+    if (!_filterConfigFile.empty())
+        PoseFilter::load(_filterConfigFile, _filter, filterParameters);
+    _poseFilter = new PoseFilter(_fps, filterParameters);
+
+    _workspace = new PoseWorkspace;
+
+    if (!_headModelFile.empty()) {
+        cv::Point3f model[modelLandmarkCount];
+        if (HeadModelCalibration::load(_headModelFile, model)) {
+            _workspace->setHeadModel(model);
+            _workspace->headModelCalibrated = true;
+            _headModelCalibrated = true;
+        }
+        else {
+            _headModelCalibration = new HeadModelCalibration(modelLandmarkPositions);
+        }
+    }
 
     _isReady = true;
     return true;
@@ -372,18 +1012,21 @@ bool WebcamHeadTracker::initPoseEstimator(const char* frontalFaceXml, const char
 
 void WebcamHeadTracker::setFocalLengthsInPixels(float fx, float fy)
 {
+    _stopPipeline();
     _fx = fx;
     _fy = fy;
 }
 
 void WebcamHeadTracker::setPrincipalPointInPixels(float cx, float cy)
 {
+    _stopPipeline();
     _cx = cx;
     _cy = cy;
 }
 
 void WebcamHeadTracker::setDistortionCoefficients(float k1, float k2, float p1, float p2, float k3)
 {
+    _stopPipeline();
     _k1 = k1;
     _k2 = k2;
     _p1 = p1;
@@ -396,14 +1039,167 @@ void WebcamHeadTracker::setFilter(enum Filter filter)
     _filter = filter;
 }
 
+void WebcamHeadTracker::setGrayscaleProcessing(bool grayscale)
+{
+    _stopPipeline();
+    _grayscaleProcessing = grayscale;
+}
+
+void WebcamHeadTracker::setLandmarkWarmStart(bool warmStart)
+{
+    _stopPipeline();
+    _landmarkWarmStart = warmStart;
+}
+
+void WebcamHeadTracker::setFaceSearch(enum FaceSearch faceSearch)
+{
+    _stopPipeline();
+    _faceSearch = faceSearch;
+}
+
+void WebcamHeadTracker::setFaceDetector(FaceDetector* faceDetector)
+{
+    _stopPipeline();
+    // the detection worker uses the old detector
+    delete _detectionWorker;
+    _detectionWorker = NULL;
+    delete _faceDetector;
+    _faceDetector = faceDetector;
+    if (_workspace)
+        _workspace->faceMisses = 0;
+}
+
+void WebcamHeadTracker::setTrackingMode(enum TrackingMode trackingMode)
+{
+    _stopPipeline();
+    _trackingMode = trackingMode;
+    if (_workspace) {
+        _workspace->trackingValid = false;
+        _workspace->trackingVerdict.store(-1);
+    }
+}
+
+void WebcamHeadTracker::setDetectionMode(enum DetectionMode mode, int interval)
+{
+    _stopPipeline();
+    _detectionMode = mode;
+    _detectionInterval = std::max(interval, 1);
+    if (_detectionMode == Detection_Synchronous) {
+        delete _detectionWorker;
+        _detectionWorker = NULL;
+    }
+}
+
+void WebcamHeadTracker::setPoseSolver(enum PoseSolver poseSolver)
+{
+    _stopPipeline();
+    _poseSolver = poseSolver;
+}
+
+void WebcamHeadTracker::setHeadModelFile(const char* fileName)
+{
+    _stopPipeline();
+    _headModelFile = (fileName ? fileName : "");
+}
+
+void WebcamHeadTracker::setFilterConfigFile(const char* fileName)
+{
+    _filterConfigFile = (fileName ? fileName : "");
+}
+
+void WebcamHeadTracker::recalibrateHeadModel()
+{
+    if (_headModelFile.empty() || !_workspace)
+        return;
+    // the pose thread of the pipeline uses the head model
+    _stopPipeline();
+    _workspace->setHeadModel(modelLandmarkPositions);
+    _workspace->headModelCalibrated = false;
+    _headModelCalibrated = false;
+    if (_headModelCalibration)
+        _headModelCalibration->reset();
+    else
+        _headModelCalibration = new HeadModelCalibration(modelLandmarkPositions);
+}
+
+void WebcamHeadTracker::setCaptureMode(enum CaptureMode mode)
+{
+    _captureMode = mode;
+    // while the pipeline runs, its capture stage replaces the capture worker
+    if (!_frameSource || !_frameSource->isOpened() || _pipeline)
+        return;
+    if (_captureMode == Capture_Threaded && !_captureWorker) {
+        _captureWorker = new CaptureWorker(_frameSource);
+    }
+    else if (_captureMode == Capture_Synchronous && _captureWorker) {
+        delete _captureWorker;
+        _captureWorker = NULL;
+    }
+}
+
+void WebcamHeadTracker::setExecutionMode(enum ExecutionMode mode)
+{
+    // the pipeline starts with the next getNewFrame()
+    _stopPipeline();
+    _executionMode = mode;
+}
+
 void WebcamHeadTracker::getNewFrame()
 {
     timer t0, t1;
     t0.setNow();
-    *_capture >> *_frame;
+    if (_executionMode == Execution_Pipelined && _isReady) {
+        if (!_pipeline)
+            _startPipeline();
+        unsigned long long lastFrameNumber = _frameNumber;
+        _pipelineFrame = _pipeline->getFrame(std::chrono::milliseconds(1000), _frameNumber, _frameTimestamp);
+        if (_pipelineFrame) {
+            // share the data of the frame slot; the pipeline does not touch
+            // this slot again before the next call of this function
+            *_frame = _pipelineFrame->frame;
+        }
+        else {
+            _frame->release();
+            if (_pipeline->atEnd())
+                _isReady = false;
+        }
+        t1.setNow();
+        if (_debugOptions & Debug_Timing) {
+            fprintf(stderr, "WHT: waiting for pipeline:    %4.1f ms\n", duration(t0, t1));
+            if (_pipelineFrame && _frameNumber > lastFrameNumber + 1)
+                fprintf(stderr, "WHT: skipped frames:          %4llu\n", _frameNumber - lastFrameNumber - 1);
+        }
+        return;
+    }
+    // the tracker is not ready (any more), or the mode changed
+    _stopPipeline();
+    bool gotFrame;
+    bool atEnd;
+    if (_captureWorker) {
+        gotFrame = _captureWorker->getFrame(*_frame, _frameTimestamp, std::chrono::milliseconds(1000));
+        atEnd = _captureWorker->atEnd();
+    }
+    else {
+        gotFrame = _frameSource->read(*_frame, _frameTimestamp);
+        atEnd = _frameSource->atEnd();
+    }
+    if (gotFrame) {
+        _frameNumber++;
+    }
+    else {
+        _frame->release();
+        if (atEnd)
+            _isReady = false;
+    }
     t1.setNow();
+    timer t2;
+    if (gotFrame)
+        _storeFrame(*_frame, _frameTimestamp);
+    t2.setNow();
     if (_debugOptions & Debug_Timing) {
         fprintf(stderr, "WHT: acquiring webcam frame:  %4.1f ms\n", duration(t0, t1));
+        if (_recorder && _recorder->isOpen())
+            fprintf(stderr, "WHT: recording frame:         %4.1f ms\n", duration(t1, t2));
     }
 }
 
@@ -433,126 +1229,296 @@ static void quaternionToRodrigues(const double* q, double* r)
     r[2] = factor * q[2];
 }
 
-static void quaternionToEuler(const double* q, double* euler)
+// Convert the internal pose (OpenCV camera coordinates in mm) to the external
+// representation of getHeadPosition() and getHeadOrientation()
+static void toExternalPose(const double* vec, const double* quat, float* position, float* orientation)
 {
-    double singularityTest = q[0] * q[1] + q[2] * q[3];
-    if (singularityTest > 0.4999) {
-        // north pole
-        euler[0] = 2.0 * std::atan2(q[0], q[3]);
-        euler[1] = M_PI_2;
-        euler[2] = 0.0;
-    }
-    else if (singularityTest < -0.4999) {
-        // south pole
-        euler[0] = -2.0 * std::atan2(q[0], q[3]);
-        euler[1] = -M_PI_2;
-        euler[2] = 0.0f;
-    }
-    else {
-        euler[0] = std::atan2(2.0 * (q[3] * q[0] + q[1] * q[2]), 1.0 - 2.0 * (q[0] * q[0] + q[1] * q[1]));
-        euler[1] = std::asin(2.0 * (q[3] * q[1] - q[0] * q[2]));
-        euler[2] = std::atan2(2.0 * (q[3] * q[2] + q[0] * q[1]), 1.0 - 2.0 * (q[1] * q[1] + q[2] * q[2]));
+    // convert position
+    position[0] = -vec[0] / 1000.0;
+    position[1] = -vec[1] / 1000.0;
+    position[2] = vec[2] / 1000.0;
+    // convert orientation (rotate 180 deg around x)
+    orientation[0] = quat[3];
+    orientation[1] = -quat[2];
+    orientation[2] = quat[1];
+    orientation[3] = -quat[0];
+}
+
+// Record a new frame, and convert it for the detection pipeline
+void WebcamHeadTracker::_storeFrame(cv::Mat& frame, double timestamp)
+{
+    if (_recorder && _recorder->isOpen())
+        _recorder->write(frame, timestamp);
+    // without grayscale processing, the detection pipeline expects BGR frames
+    if (!_grayscaleProcessing && frame.channels() == 1)
+        cv::cvtColor(frame, frame, cv::COLOR_GRAY2BGR);
+}
+
+// Grayscale conversion: done once, then used by both detectors
+void WebcamHeadTracker::_prepareFrame(FrameState& f)
+{
+    timer t0, t1;
+    t0.setNow();
+    if (_grayscaleProcessing) {
+        if (f.frame.channels() == 1)
+            f.frameGray = f.frame;
+        else
+            cv::cvtColor(f.frame, f.frameGray, cv::COLOR_BGR2GRAY);
     }
+    t1.setNow();
+    f.grayDuration = duration(t0, t1);
 }
 
-static void eulerToQuaternion(const double* euler, double* q)
+void WebcamHeadTracker::_startPipeline()
 {
-    double x2 = euler[0] / 2.0;
-    double y2 = euler[1] / 2.0;
-    double z2 = euler[2] / 2.0;
-    double sx2 = std::sin(x2);
-    double cx2 = std::cos(x2);
-    double sy2 = std::sin(y2);
-    double cy2 = std::cos(y2);
-    double sz2 = std::sin(z2);
-    double cz2 = std::cos(z2);
-    q[0] = sx2 * cy2 * cz2 - cx2 * sy2 * sz2;
-    q[1] = cx2 * sy2 * cz2 + sx2 * cy2 * sz2;
-    q[2] = cx2 * cy2 * sz2 - sx2 * sy2 * cz2;
-    q[3] = cx2 * cy2 * cz2 + sx2 * sy2 * sz2;
+    // the capture stage replaces the capture worker
+    delete _captureWorker;
+    _captureWorker = NULL;
+    _pipelineFrame = NULL;
+    _pipeline = new TrackingPipeline(_frameSource, _frameNumber,
+        [this](FrameState& f, double timestamp) { _storeFrame(f.frame, timestamp); _prepareFrame(f); },
+        [this](FrameState& f) { _locateFace(f); },
+        [this](FrameState& f) { _solvePose(f); });
 }
 
-bool WebcamHeadTracker::computeHeadPose()
+void WebcamHeadTracker::_stopPipeline()
 {
-    if (!_faceCascade)
-        return false;
+    if (!_pipeline)
+        return;
+    delete _pipeline;
+    _pipeline = NULL;
+    _pipelineFrame = NULL;
+    if (_captureMode == Capture_Threaded)
+        _captureWorker = new CaptureWorker(_frameSource);
+}
 
-    timer t0, t1, t2, t3, t4;
+// Face detection or tracking, and landmark detection
+void WebcamHeadTracker::_locateFace(FrameState& f)
+{
+    PoseWorkspace& ws = *_workspace;
+    const cv::Mat& detectionFrame = (_grayscaleProcessing ? f.frameGray : f.frame);
+    timer t0, t1, t2;
+    f.located = false;
+    f.visible = false;
 
-    /* Face detection */
+    /* Face detection, or face tracking based on the landmarks of the last frame */
     t0.setNow();
-    const int minFaceSize = 80;
-    std::vector<cv::Rect> faces;
-    _faceCascade->detectMultiScale(*_frame, faces, 1.1, 2,
-        cv::CASCADE_SCALE_IMAGE | cv::CASCADE_FIND_BIGGEST_OBJECT,
-        cv::Size(minFaceSize, minFaceSize));
-    if (faces.size() < 1)
-        return false;
-    cv::Rect faceRect = faces[0];
+    // The pose fit of the last frame decides whether its landmarks can be tracked.
+    // In pipelined mode, this frame may come before that decision, so the landmarks
+    // are trusted until the pose fit reports that the face was lost.
+    int verdict = ws.trackingVerdict.exchange(-1);
+    if (verdict == 0 || (verdict == 1 && _executionMode == Execution_Sequential))
+        ws.trackingValid = (verdict == 1);
+    // the landmarks of the last frame are only valid if nothing fails until they are replaced
+    bool landmarksValid = ws.landmarksValid;
+    ws.landmarksValid = false;
+    bool async = (_detectionMode == Detection_Asynchronous);
+    bool tracking = (_trackingMode == Tracking_Landmarks && ws.trackingValid
+        && (async || ws.framesSinceDetection < trackingRedetectInterval));
+    bool localSearch = (_faceSearch == FaceSearch_Local
+        && ws.lastFaceRect.area() > 0 && ws.faceMisses < localSearchMaxMisses);
+    bool flowing = false;
+    if (_trackingMode == Tracking_Optical_Flow) {
+        // The pyramid of every frame is needed for the flow into the next one,
+        // also when this frame is an anchor frame.
+        const cv::Mat* flowFrame = &detectionFrame;
+        if (detectionFrame.channels() != 1) {
+            cv::cvtColor(detectionFrame, ws.flowGray, cv::COLOR_BGR2GRAY);
+            flowFrame = &ws.flowGray;
+        }
+        cv::Size windowSize(flowWindowSize, flowWindowSize);
+        std::swap(ws.flowPyramid, ws.lastFlowPyramid);
+        cv::buildOpticalFlowPyramid(*flowFrame, ws.flowPyramid, windowSize, flowPyramidLevels);
+        if (ws.trackingValid && ws.framesSinceDetection < flowReanchorInterval) {
+            cv::calcOpticalFlowPyrLK(ws.lastFlowPyramid, ws.flowPyramid, ws.flowPoints, ws.flowedPoints,
+                ws.flowStatus, ws.flowError, windowSize, flowPyramidLevels);
+            flowing = true;
+            float errorSum = 0.0f;
+            for (int i = 0; i < poseLandmarkCount; i++) {
+                if (!ws.flowStatus[i])
+                    flowing = false;
+                errorSum += ws.flowError[i];
+            }
+            if (errorSum > flowMaxError * poseLandmarkCount)
+                flowing = false;
+        }
+        // if the flow failed, this frame becomes an anchor frame, or the face is lost
+        ws.trackingValid = false;
+    }
+    cv::Rect faceRect;
+    if (flowing) {
+        // the face rectangle follows the pose landmarks, for the debug window and the next anchor frame
+        cv::Rect2f pointBox = cv::boundingRect(ws.flowedPoints);
+        faceRect = cv::Rect(
+            cvRound(pointBox.x + ws.faceRectFromShape[0] * pointBox.width),
+            cvRound(pointBox.y + ws.faceRectFromShape[1] * pointBox.height),
+            cvRound(ws.faceRectFromShape[2] * pointBox.width),
+            cvRound(ws.faceRectFromShape[3] * pointBox.height));
+        ws.framesSinceDetection++;
+    }
+    else if (async) {
+        if (!_detectionWorker)
+            _detectionWorker = new DetectionWorker(_faceDetector);
+        // without tracking, the last detection is reused until the next one arrives
+        bool reuseLastFace = (_trackingMode != Tracking_Landmarks
+            && ws.lastFaceRect.area() > 0 && ws.faceMisses == 0);
+        // hand a frame to the detector at a lower cadence, or as soon as possible if no face is known
+        ws.framesSinceSubmission++;
+        if ((ws.framesSinceSubmission >= _detectionInterval || !(tracking || reuseLastFace))
+            && !_detectionWorker->busy()) {
+            DetectionWorker::Request& request = _detectionWorker->request();
+            detectionFrame.copyTo(request.frame);
+            request.localSearch = localSearch;
+            request.lastFaceRect = ws.lastFaceRect;
+            _detectionWorker->submit();
+            ws.framesSinceSubmission = 0;
+        }
+        bool found;
+        cv::Rect detectedRect;
+        bool anchored = false;
+        if (_detectionWorker->getResult(found, detectedRect)) {
+            if (!found) {
+                ws.faceMisses++;
+            }
+            else if (!tracking || (ws.trackedFaceRect & detectedRect).area() < 0.5 * detectedRect.area()) {
+                // The detection is a few frames old. If the landmarks still track
+                // the same face, their rectangle is more recent, so keep it.
+                faceRect = detectedRect;
+                anchored = true;
+                tracking = false;
+            }
+        }
+        if (tracking) {
+            faceRect = ws.trackedFaceRect;
+        }
+        else if (!anchored) {
+            if (!reuseLastFace || ws.faceMisses > 0)
+                return;
+            faceRect = ws.lastFaceRect;
+        }
+    }
+    else if (tracking) {
+        faceRect = ws.trackedFaceRect;
+        ws.framesSinceDetection++;
+    }
+    else {
+        if (!detectFace(_faceDetector, detectionFrame, localSearch, ws.lastFaceRect, faceRect)) {
+            ws.faceMisses++;
+            return;
+        }
+        ws.framesSinceDetection = 0;
+    }
+    cv::Rect lastFaceRect = ws.lastFaceRect;
+    ws.lastFaceRect = faceRect;
+    ws.faceMisses = 0;
     t1.setNow();
 
     /* Face landmark detection */
-#if 1
-    // A temporary workaround for a Dlib/OpenCV incompatibility:
-    IplImage iplImg = cvIplImage(*_frame);
-    dlib::cv_image<dlib::bgr_pixel> dlibFrame(&iplImg);
-#else
-    dlib::cv_image<dlib::bgr_pixel> dlibFrame(*_frame); // does not copy data
-#endif
-    dlib::rectangle dlibRect(faceRect.x, faceRect.y,
-        faceRect.x + faceRect.width - 1, faceRect.y + faceRect.height - 1);
-    dlib::full_object_detection shape = (*_faceModel)(dlibFrame, dlibRect);
-    if (shape.num_parts() != 68)
-        return false;
-    std::vector<cv::Point2f> landmarks;
-    landmarks.resize(68);
-    for (int i = 0; i < 68; i++) {
-        dlib::point p = shape.part(i);
-        landmarks[i] = cv::Point(p.x(), p.y());
+    // Only the landmarks of the face model are needed, unless they are all drawn.
+    std::vector<cv::Point2f>& landmarks = ws.landmarks;
+    bool warmStarted = false;
+    if (flowing) {
+        // only the pose landmarks move; the others keep their place from the last anchor frame
+        for (int i = 0; i < poseLandmarkCount; i++)
+            landmarks[poseLandmarkIndices[i]] = ws.flowedPoints[i];
+        std::swap(ws.flowPoints, ws.flowedPoints);
+    }
+    else {
+        const int* subset = (_debugOptions & Debug_Window) ? NULL : poseLandmarkIndices;
+        int subsetSize = (_debugOptions & Debug_Window) ? 0 : poseLandmarkCount;
+        if (_landmarkWarmStart && landmarksValid) {
+            // Place the previous landmarks for the current face rectangle. While tracking,
+            // the rectangle was derived from them, so they stay where they are. After a
+            // detection, they follow the similarity transform between the two rectangles.
+            const cv::Point2f* initialLandmarks = landmarks.data();
+            if (!tracking && faceRect != lastFaceRect) {
+                float scale = float(faceRect.width) / lastFaceRect.width;
+                cv::Point2f lastCenter(lastFaceRect.x + 0.5f * lastFaceRect.width, lastFaceRect.y + 0.5f * lastFaceRect.height);
+                cv::Point2f center(faceRect.x + 0.5f * faceRect.width, faceRect.y + 0.5f * faceRect.height);
+                for (int i = 0; i < PoseWorkspace::landmarkCount; i++)
+                    ws.initialLandmarks[i] = center + scale * (landmarks[i] - lastCenter);
+                initialLandmarks = ws.initialLandmarks.data();
+            }
+            warmStarted = _faceModel->predictFrom(detectionFrame, faceRect, initialLandmarks,
+                warmStartStages, warmStartMaxMotion, landmarks.data(), subset, subsetSize);
+        }
+        else {
+            _faceModel->predict(detectionFrame, faceRect, landmarks.data(), subset, subsetSize);
+        }
+        ws.landmarksValid = true;
+    }
+    if (_trackingMode == Tracking_Optical_Flow && !flowing) {
+        // anchor the flow at the new landmarks; the face rectangle is remembered
+        // relative to their bounding box, as in Tracking_Landmarks
+        for (int i = 0; i < poseLandmarkCount; i++)
+            ws.flowPoints[i] = landmarks[poseLandmarkIndices[i]];
+        cv::Rect2f pointBox = cv::boundingRect(ws.flowPoints);
+        ws.faceRectFromShape[0] = (faceRect.x - pointBox.x) / pointBox.width;
+        ws.faceRectFromShape[1] = (faceRect.y - pointBox.y) / pointBox.height;
+        ws.faceRectFromShape[2] = faceRect.width / pointBox.width;
+        ws.faceRectFromShape[3] = faceRect.height / pointBox.height;
+        ws.framesSinceDetection = 0;
     }
+    if (_trackingMode == Tracking_Landmarks) {
+        // Derive the face rectangle for the next frame from the landmarks.
+        // The relation between the detector's face rectangle and the landmark
+        // bounding box is remembered at detection time, so that the landmark
+        // detector always gets face rectangles in the detector's convention.
+        cv::Rect2f shapeBox = cv::boundingRect(landmarks);
+        if (!tracking) {
+            ws.faceRectFromShape[0] = (faceRect.x - shapeBox.x) / shapeBox.width;
+            ws.faceRectFromShape[1] = (faceRect.y - shapeBox.y) / shapeBox.height;
+            ws.faceRectFromShape[2] = faceRect.width / shapeBox.width;
+            ws.faceRectFromShape[3] = faceRect.height / shapeBox.height;
+        }
+        ws.trackedFaceRect = cv::Rect(
+            cvRound(shapeBox.x + ws.faceRectFromShape[0] * shapeBox.width),
+            cvRound(shapeBox.y + ws.faceRectFromShape[1] * shapeBox.height),
+            cvRound(ws.faceRectFromShape[2] * shapeBox.width),
+            cvRound(ws.faceRectFromShape[3] * shapeBox.height));
+    }
+    if (_trackingMode == Tracking_Landmarks || _trackingMode == Tracking_Optical_Flow) {
+        // the face can be tracked into the next frame only if it stays in view
+        const cv::Rect& nextFaceRect = (_trackingMode == Tracking_Landmarks ? ws.trackedFaceRect : faceRect);
+        cv::Rect visibleRect = nextFaceRect & cv::Rect(0, 0, detectionFrame.cols, detectionFrame.rows);
+        f.visible = visibleRect.area() > 0.5 * nextFaceRect.area();
+        if (_executionMode == Execution_Pipelined)
+            ws.trackingValid = f.visible;
+    }
+    t2.setNow();
+    std::copy(landmarks.begin(), landmarks.end(), f.landmarks.begin());
+    f.faceRect = faceRect;
+    f.localSearch = localSearch;
+    f.tracking = tracking;
+    f.flowing = flowing;
+    f.async = async;
+    f.warmStarted = warmStarted;
+    f.detectionDuration = duration(t0, t1);
+    f.landmarksDuration = duration(t1, t2);
+    f.located = true;
+}
+
+// Fit the face model to the landmarks, and calibrate the head model
+void WebcamHeadTracker::_solvePose(FrameState& f)
+{
+    PoseWorkspace& ws = *_workspace;
+    // the pose of the last frame is only valid if nothing failed since
+    f.lastPoseValid = ws.poseValid;
+    ws.poseValid = false;
+    f.fitted = false;
+    f.posed = false;
+    f.headModelCalibrated = ws.headModelCalibrated;
+    if (!f.located)
+        return;
+    const cv::Rect& faceRect = f.faceRect;
+    timer t2, t3;
     t2.setNow();
 
-    /* Extract a subset of landmarks for which we have good guesses for
-     * average positions from <https://en.wikipedia.org/wiki/Human_head>.
-     * Everything must be in mm to be consistent with OpenCV assumptions.
-     * We use landmarks that tend not to change too much with varying
-     * facial expressions. */
-    const cv::Point3f landmarkLeftEctocanthi(-60.0f, 0.0f, 0.0f);
-    const cv::Point3f landmarkRightEctocanthi(+60.0f, 0.0f, 0.0f);
-    const cv::Point3f landmarkSellion(0.0f, 5.0f, -20.0f);
-    const cv::Point3f landmarkSubnasale(0.0f, -42.0f, -30.0f);
-    const cv::Point3f landmarkStomion(0.0f, -67.0f, -32.0f);
-    const cv::Point3f landmarkLeftTragion(-70.0f, 0.0f, 99.9f);
-    const cv::Point3f landmarkRightTragion(+70.0f, 0.0f, 99.9f);
-    const std::vector<cv::Point3f> modelLandmarks({
-            landmarkLeftEctocanthi,
-            landmarkLeftEctocanthi,
-            landmarkRightEctocanthi,
-            landmarkRightEctocanthi,
-            landmarkSellion,
-            landmarkSubnasale,
-            landmarkStomion,
-            landmarkLeftTragion,
-            landmarkRightTragion
-        });
-    const int landmarkLeftEctocanthiIndex = 36;
-    const int landmarkRightEctocanthiIndex = 45;
-    const int landmarkSellionIndex = 27;
-    const int landmarkSubnasaleIndex = 33;
-    const int landmarkStomionIndex = 51;
-    const int landmarkLeftTragionIndex = 0;
-    const int landmarkRightTragionIndex = 16;
-    const std::vector<cv::Point2f> imageLandmarks({
-            landmarks[landmarkLeftEctocanthiIndex],
-            landmarks[landmarkLeftEctocanthiIndex],
-            landmarks[landmarkRightEctocanthiIndex],
-            landmarks[landmarkRightEctocanthiIndex],
-            landmarks[landmarkSellionIndex],
-            landmarks[landmarkSubnasaleIndex],
-            landmarks[landmarkStomionIndex],
-            landmarks[landmarkLeftTragionIndex],
-            landmarks[landmarkRightTragionIndex]
-        });
+    /* Match the face model to the landmarks */
+    for (int i = 0; i < modelLandmarkCount; i++)
+        ws.imageLandmarks[i] = f.landmarks[modelLandmarkIndices[i]];
+    if (_debugOptions & Debug_Window)
+        f.modelLandmarks = ws.modelLandmarks;
     cv::Matx33f cameraMatrix;
     cameraMatrix(0, 0) = _fx;
     cameraMatrix(0, 1) = 0.0f;
@@ -563,180 +1529,309 @@ bool WebcamHeadTracker::computeHeadPose()
     cameraMatrix(2, 0) = 0.0f;
     cameraMatrix(2, 1) = 0.0f;
     cameraMatrix(2, 2) = 1.0f;
-    cv::Mat distCoeffs(1, 5, CV_32F);
+    cv::Mat& distCoeffs = ws.distCoeffs;
     distCoeffs.at<float>(0) = _k1;
     distCoeffs.at<float>(1) = _k2;
     distCoeffs.at<float>(2) = _p1;
     distCoeffs.at<float>(3) = _p2;
     distCoeffs.at<float>(4) = _k3;
-    cv::Mat rvec(1, 3, CV_64F);
-    rvec.at<double>(0) = M_PI; // 180 deg around x axis: null rotation in OpenCV orientation
-    rvec.at<double>(1) = 0.0f;
-    rvec.at<double>(2) = 0.0f;
-    cv::Mat tvec(1, 3, CV_64F);
-    tvec.at<double>(0) = 0.0f;
-    tvec.at<double>(1) = 0.0f;
-    tvec.at<double>(2) = 500.0f;
+    // Start from the pose of the last frame if there was one; after the face was
+    // (re)acquired, start from a canonical pose in front of the camera.
+    cv::Mat& rvec = ws.rvec;
+    cv::Mat& tvec = ws.tvec;
+    if (f.lastPoseValid) {
+        for (int i = 0; i < 3; i++) {
+            rvec.at<double>(i) = ws.lastRvec[i];
+            tvec.at<double>(i) = ws.lastTvec[i];
+        }
+    }
+    else {
+        rvec.at<double>(0) = M_PI; // 180 deg around x axis: null rotation in OpenCV orientation
+        rvec.at<double>(1) = 0.0f;
+        rvec.at<double>(2) = 0.0f;
+        tvec.at<double>(0) = 0.0f;
+        tvec.at<double>(1) = 0.0f;
+        tvec.at<double>(2) = 500.0f;
+    }
     // in my tests, using the CV_P3P solver with 4 points was less stable than using the iterative solver with 7
     //cv::solvePnP(modelLandmarks, imageLandmarks, cameraMatrix, distCoeffs, rvec, tvec, false, CV_P3P);
-    cv::solvePnP(modelLandmarks, imageLandmarks, cameraMatrix, distCoeffs, rvec, tvec, true, cv::SOLVEPNP_ITERATIVE);
-    double observedVec[3] = { tvec.at<double>(0), tvec.at<double>(1), tvec.at<double>(2) };
-    double observedQuat[4];
-    rodriguesToQuaternion(&(rvec.at<double>(0)), observedQuat);
+    if (_poseSolver == PoseSolver_OpenCV) {
+        bool solved = cv::solvePnP(ws.modelLandmarks, ws.imageLandmarks, cameraMatrix, distCoeffs,
+            rvec, tvec, true, cv::SOLVEPNP_ITERATIVE);
+        // a pose that is not finite, or puts the head behind the camera, is no fit either
+        for (int i = 0; i < 3; i++) {
+            if (!std::isfinite(rvec.at<double>(i)) || !std::isfinite(tvec.at<double>(i)))
+                solved = false;
+        }
+        if (!solved || tvec.at<double>(2) <= 0.0) {
+            ws.trackingVerdict.store(0);
+            return;
+        }
+        cv::projectPoints(ws.modelLandmarks, rvec, tvec, cameraMatrix, distCoeffs, ws.projectedModelLandmarks);
+        for (int i = 0; i < modelLandmarkCount; i++) {
+            f.residuals[i] = cv::norm(ws.projectedModelLandmarks[i] - ws.imageLandmarks[i]);
+            f.inliers[i] = true;
+        }
+        f.solverIterations = 0;
+    }
+    else {
+        CameraIntrinsics camera = { _fx, _fy, _cx, _cy, _k1, _k2, _p1, _p2, _k3 };
+        ws.poseSolver.setHuberThreshold(_poseSolver == PoseSolver_Head_Model_Robust
+            ? robustHuberThreshold * faceRect.width : 0.0);
+        if (!ws.poseSolver.solve(camera, ws.imageLandmarks.data(), &(rvec.at<double>(0)), &(tvec.at<double>(0)))) {
+            // without a fit, the landmarks cannot be trusted to be tracked into the next frame
+            ws.trackingVerdict.store(0);
+            return;
+        }
+        // outliers that the robust solver rejected do not count in the checks below
+        for (int i = 0; i < modelLandmarkCount; i++) {
+            f.residuals[i] = ws.poseSolver.residual(i);
+            f.inliers[i] = (_poseSolver != PoseSolver_Head_Model_Robust || ws.poseSolver.isInlier(i));
+        }
+        f.solverIterations = ws.poseSolver.iterations();
+    }
+    f.fitted = true;
+    if (_trackingMode == Tracking_Landmarks || _trackingMode == Tracking_Optical_Flow) {
+        // The landmark fit quality decides whether the landmarks can be trusted
+        // to place the face rectangle or to be tracked in the next frame.
+        double sumOfSquares = 0.0;
+        int inliers = 0;
+        for (int i = 0; i < modelLandmarkCount; i++) {
+            if (f.inliers[i]) {
+                sumOfSquares += f.residuals[i] * f.residuals[i];
+                inliers++;
+            }
+        }
+        double rmsError = std::sqrt(sumOfSquares / std::max(inliers, 1));
+        bool goodFit = (inliers >= robustMinInliers && rmsError < trackingMaxReprojectionError * faceRect.width);
+        ws.trackingVerdict.store(goodFit && f.visible ? 1 : 0);
+        if ((f.tracking || f.flowing) && !goodFit) {
+            // the face was lost; detect it again in the next frame
+            return;
+        }
+    }
+    for (int i = 0; i < 3; i++) {
+        ws.lastRvec[i] = rvec.at<double>(i);
+        ws.lastTvec[i] = tvec.at<double>(i);
+    }
+    ws.poseValid = true;
+    if (_headModelCalibration) {
+        bool calibrationFrame = true;
+        for (int i = 0; i < modelLandmarkCount; i++) {
+            if (f.residuals[i] > calibrationMaxResidual * faceRect.width)
+                calibrationFrame = false;
+        }
+        if (calibrationFrame) {
+            CameraIntrinsics camera = { _fx, _fy, _cx, _cy, _k1, _k2, _p1, _p2, _k3 };
+            _headModelCalibration->addFrame(camera, ws.imageLandmarks.data(), &(rvec.at<double>(0)), &(tvec.at<double>(0)));
+        }
+        if (_headModelCalibration->frameCount() >= calibrationFrames) {
+            cv::Point3f model[modelLandmarkCount];
+            if (_headModelCalibration->solve(model)) {
+                // the next frames use the new model; the pose of this frame stays
+                ws.setHeadModel(model);
+                HeadModelCalibration::save(_headModelFile, model);
+                ws.headModelCalibrated = true;
+            }
+            if (_debugOptions & Debug_Timing) {
+                fprintf(stderr, "WHT: head model calibration: %s, RMS error %.2f px -> %.2f px\n",
+                    ws.headModelCalibrated ? "done" : "rejected",
+                    _headModelCalibration->initialRmsError(), _headModelCalibration->rmsError());
+            }
+            if (ws.headModelCalibrated) {
+                delete _headModelCalibration;
+                _headModelCalibration = NULL;
+            }
+            else {
+                // start over with new frames
+                _headModelCalibration->reset();
+            }
+        }
+    }
+    f.headModelCalibrated = ws.headModelCalibrated;
+    for (int i = 0; i < 3; i++) {
+        f.rvec[i] = rvec.at<double>(i);
+        f.tvec[i] = tvec.at<double>(i);
+    }
     t3.setNow();
+    f.poseDuration = duration(t2, t3);
+    f.posed = true;
+}
+
+bool WebcamHeadTracker::computeHeadPose()
+{
+    FrameState* state;
+    if (_pipeline) {
+        // the pipeline ran all stages up to the pose fit
+        state = _pipelineFrame;
+        if (!state)
+            return false;
+    }
+    else {
+        if (!_faceDetector || !_workspace || !_frame || _frame->empty())
+            return false;
+        state = &_workspace->frameState;
+        state->frame = *_frame;
+        _prepareFrame(*state);
+        _locateFace(*state);
+        _solvePose(*state);
+    }
+    const FrameState& f = *state;
+    PoseWorkspace& ws = *_workspace;
+    _headModelCalibrated = f.headModelCalibrated;
+    if (f.fitted)
+        std::copy(f.residuals, f.residuals + modelLandmarkCount, ws.residuals);
+    if (!f.posed)
+        return false;
+    timer t3, t4;
 
     /* Feed the new measurement to the filter and save result */
-    double estimatedVec[3] = { 0, 0, 0 };
-    double estimatedQuat[4] = { 0, 0, 0, 0 };
-    switch (_filter) {
-    case Filter_None:
-    {
-        estimatedVec[0] = observedVec[0];
-        estimatedVec[1] = observedVec[1];
-        estimatedVec[2] = observedVec[2];
-        estimatedQuat[0] = observedQuat[0];
-        estimatedQuat[1] = observedQuat[1];
-        estimatedQuat[2] = observedQuat[2];
-        estimatedQuat[3] = observedQuat[3];
-    }
-    break;
-    case Filter_Kalman:
-    {
-        double observedEulerAngles[3];
-        quaternionToEuler(observedQuat, observedEulerAngles);
-        // See http://docs.opencv.org/trunk/dc/d2c/tutorial_real_time_pose.html
-        // for information on this!
-        cv::Mat measurement(6, 1, CV_64F);
-        measurement.at<double>(0) = observedVec[0];
-        measurement.at<double>(1) = observedVec[1];
-        measurement.at<double>(2) = observedVec[2];
-        measurement.at<double>(3) = observedEulerAngles[0];
-        measurement.at<double>(4) = observedEulerAngles[1];
-        measurement.at<double>(5) = observedEulerAngles[2];
-        cv::Mat prediction = _kalmanFilter->predict();
-        cv::Mat estimation = _kalmanFilter->correct(measurement);
-        estimatedVec[0] = estimation.at<double>(0);
-        estimatedVec[1] = estimation.at<double>(1);
-        estimatedVec[2] = estimation.at<double>(2);
-        eulerToQuaternion(&(estimation.at<double>(9)), estimatedQuat);
-    }
-    break;
-    case Filter_Double_Exponential:
+    t3.setNow();
+    double observedQuat[4];
+    rodriguesToQuaternion(f.rvec, observedQuat);
+    double estimatedVec[3];
+    double estimatedQuat[4];
     {
-        _despFilter->step(observedVec, observedQuat,
-            0.2, 0.7,
-            estimatedVec, estimatedQuat);
-    }
-    break;
+        std::lock_guard<std::mutex> lock(ws.filterMutex);
+        _poseFilter->step(_filter, _frameTimestamp, f.tvec, observedQuat, estimatedVec, estimatedQuat);
     }
     t4.setNow();
 
     /* Convert the internal representation to the external representation */
-    // convert position
-    _headPosition[0] = -estimatedVec[0] / 1000.0;
-    _headPosition[1] = -estimatedVec[1] / 1000.0;
-    _headPosition[2] = estimatedVec[2] / 1000.0;
-    // convert orientation (rotate 180 deg around x)
-    _headOrientation[0] = estimatedQuat[3];
-    _headOrientation[1] = -estimatedQuat[2];
-    _headOrientation[2] = estimatedQuat[1];
-    _headOrientation[3] = -estimatedQuat[0];
+    toExternalPose(estimatedVec, estimatedQuat, _headPosition, _headOrientation);
 
     /* Debug output */
     if (_debugOptions & Debug_Timing) {
-        fprintf(stderr, "WHT: face detection:          %4.1f ms\n", duration(t0, t1));
-        fprintf(stderr, "WHT: face landmark detection: %4.1f ms\n", duration(t1, t2));
-        fprintf(stderr, "WHT: face model matching:     %4.1f ms\n", duration(t2, t3));
-        fprintf(stderr, "WHT: filtering:               %4.1f ms\n", duration(t4, t3));
-    }
-    if (_debugOptions & Debug_Window) {
-        // render face rectangle
-        cv::rectangle(*_frame, faceRect, cv::Scalar(0, 0, 255));
-        // render face model
-        for (int i = 1; i <= 16; i++)
-            cv::line(*_frame, landmarks[i - 1], landmarks[i], cv::Scalar(0, 255, 0), 1, 1, 0);
-        for (int i = 18; i <= 21; i++)
-            cv::line(*_frame, landmarks[i - 1], landmarks[i], cv::Scalar(0, 255, 0), 1, 1, 0);
-        for (int i = 23; i <= 26; i++)
-            cv::line(*_frame, landmarks[i - 1], landmarks[i], cv::Scalar(0, 255, 0), 1, 1, 0);
-        for (int i = 28; i <= 30; i++)
-            cv::line(*_frame, landmarks[i - 1], landmarks[i], cv::Scalar(0, 255, 0), 1, 1, 0);
-        for (int i = 31; i <= 35; i++)
-            cv::line(*_frame, landmarks[i - 1], landmarks[i], cv::Scalar(0, 255, 0), 1, 1, 0);
-        cv::line(*_frame, landmarks[30], landmarks[35], cv::Scalar(0, 255, 0), 1, 1, 0);
-        for (int i = 37; i <= 41; i++)
-            cv::line(*_frame, landmarks[i - 1], landmarks[i], cv::Scalar(0, 255, 0), 1, 1, 0);
-        cv::line(*_frame, landmarks[36], landmarks[41], cv::Scalar(0, 255, 0), 1, 1, 0);
-        for (int i = 43; i <= 47; i++)
-            cv::line(*_frame, landmarks[i - 1], landmarks[i], cv::Scalar(0, 255, 0), 1, 1, 0);
-        cv::line(*_frame, landmarks[42], landmarks[47], cv::Scalar(0, 255, 0), 1, 1, 0);
-        for (int i = 49; i <= 59; i++)
-            cv::line(*_frame, landmarks[i - 1], landmarks[i], cv::Scalar(0, 255, 0), 1, 1, 0);
-        cv::line(*_frame, landmarks[48], landmarks[49], cv::Scalar(0, 255, 0), 1, 1, 0);
-        for (int i = 61; i <= 67; i++)
-            cv::line(*_frame, landmarks[i - 1], landmarks[i], cv::Scalar(0, 255, 0), 1, 1, 0);
-        cv::line(*_frame, landmarks[60], landmarks[67], cv::Scalar(0, 255, 0), 1, 1, 0);
-        for (int i = 0; i < 68; i++)
-            cv::circle(*_frame, landmarks[i], 2.5f, cv::Scalar(0, 0, 255), 1, 1, 0);
-        cv::circle(*_frame, landmarks[landmarkLeftEctocanthiIndex], 3.0f, cv::Scalar(255, 255, 255), 1, 1, 0);
-        cv::circle(*_frame, landmarks[landmarkRightEctocanthiIndex], 3.0f, cv::Scalar(255, 255, 255), 1, 1, 0);
-        cv::circle(*_frame, landmarks[landmarkSellionIndex], 3.0f, cv::Scalar(255, 255, 255), 1, 1, 0);
-        cv::circle(*_frame, landmarks[landmarkSubnasaleIndex], 3.0f, cv::Scalar(255, 255, 255), 1, 1, 0);
-        cv::circle(*_frame, landmarks[landmarkStomionIndex], 3.0f, cv::Scalar(255, 255, 255), 1, 1, 0);
-        cv::circle(*_frame, landmarks[landmarkLeftTragionIndex], 3.0f, cv::Scalar(255, 255, 255), 1, 1, 0);
-        cv::circle(*_frame, landmarks[landmarkRightTragionIndex], 3.0f, cv::Scalar(255, 255, 255), 1, 1, 0);
-        // render projected face model landmarks
-        std::vector<cv::Point2f> projectedModelLandmarks;
-        cv::projectPoints(modelLandmarks, rvec, tvec, cameraMatrix, distCoeffs, projectedModelLandmarks);
-        cv::line(*_frame, projectedModelLandmarks[7], projectedModelLandmarks[0], cv::Scalar(255, 0, 0));
-        cv::line(*_frame, projectedModelLandmarks[0], projectedModelLandmarks[4], cv::Scalar(255, 0, 0));
-        cv::line(*_frame, projectedModelLandmarks[4], projectedModelLandmarks[2], cv::Scalar(255, 0, 0));
-        cv::line(*_frame, projectedModelLandmarks[2], projectedModelLandmarks[8], cv::Scalar(255, 0, 0));
-        cv::line(*_frame, projectedModelLandmarks[4], projectedModelLandmarks[5], cv::Scalar(255, 0, 0));
-        cv::line(*_frame, projectedModelLandmarks[5], projectedModelLandmarks[6], cv::Scalar(255, 0, 0));
-        cv::circle(*_frame, projectedModelLandmarks[0], 3.0f, cv::Scalar(255, 0, 0));
-        cv::circle(*_frame, projectedModelLandmarks[2], 3.0f, cv::Scalar(255, 0, 0));
-        cv::circle(*_frame, projectedModelLandmarks[4], 3.0f, cv::Scalar(255, 0, 0));
-        cv::circle(*_frame, projectedModelLandmarks[5], 3.0f, cv::Scalar(255, 0, 0));
-        cv::circle(*_frame, projectedModelLandmarks[6], 3.0f, cv::Scalar(255, 0, 0));
-        cv::circle(*_frame, projectedModelLandmarks[7], 3.0f, cv::Scalar(255, 0, 0));
-        cv::circle(*_frame, projectedModelLandmarks[8], 3.0f, cv::Scalar(255, 0, 0));
-        // render projected filtered model
-        std::vector<cv::Point2f> projectedFilteredModelLandmarks;
-        tvec.at<double>(0) = estimatedVec[0];
-        tvec.at<double>(1) = estimatedVec[1];
-        tvec.at<double>(2) = estimatedVec[2];
-        quaternionToRodrigues(estimatedQuat, &(rvec.at<double>(0)));
-        cv::projectPoints(modelLandmarks, rvec, tvec, cameraMatrix, distCoeffs, projectedFilteredModelLandmarks);
-        cv::line(*_frame, projectedFilteredModelLandmarks[7], projectedFilteredModelLandmarks[0], cv::Scalar(255, 255, 0));
-        cv::line(*_frame, projectedFilteredModelLandmarks[0], projectedFilteredModelLandmarks[4], cv::Scalar(255, 255, 0));
-        cv::line(*_frame, projectedFilteredModelLandmarks[4], projectedFilteredModelLandmarks[2], cv::Scalar(255, 255, 0));
-        cv::line(*_frame, projectedFilteredModelLandmarks[2], projectedFilteredModelLandmarks[8], cv::Scalar(255, 255, 0));
-        cv::line(*_frame, projectedFilteredModelLandmarks[4], projectedFilteredModelLandmarks[5], cv::Scalar(255, 255, 0));
-        cv::line(*_frame, projectedFilteredModelLandmarks[5], projectedFilteredModelLandmarks[6], cv::Scalar(255, 255, 0));
-        cv::circle(*_frame, projectedFilteredModelLandmarks[0], 3.0f, cv::Scalar(255, 255, 0));
-        cv::circle(*_frame, projectedFilteredModelLandmarks[2], 3.0f, cv::Scalar(255, 255, 0));
-        cv::circle(*_frame, projectedFilteredModelLandmarks[4], 13.0f, cv::Scalar(255, 255, 0));
-        cv::circle(*_frame, projectedFilteredModelLandmarks[5], 3.0f, cv::Scalar(255, 255, 0));
-        cv::circle(*_frame, projectedFilteredModelLandmarks[6], 3.0f, cv::Scalar(255, 255, 0));
-        cv::circle(*_frame, projectedFilteredModelLandmarks[7], 3.0f, cv::Scalar(255, 255, 0));
-        cv::circle(*_frame, projectedFilteredModelLandmarks[8], 3.0f, cv::Scalar(255, 255, 0));
-        // show
-        //cv::imshow(WindowName, *_frame);
-        _loadFrameToWindow(*_frame);
-
-        int key = cv::waitKey(1);
-        //if (key == 27 || key == 'q')// || cv::getWindowProperty(WindowName, cv::WND_PROP_VISIBLE) <= 0)
-        if (!WebcamHeadTracker::FeedOpened)
-            _isReady = false;
-        if (key == 'f')
-            _filter = (_filter == Filter_None ? Filter_Kalman
-                : _filter == Filter_Kalman ? Filter_Double_Exponential
-                : Filter_None);
+        if (_grayscaleProcessing)
+            fprintf(stderr, "WHT: grayscale conversion:    %4.1f ms\n", f.grayDuration);
+        fprintf(stderr, "WHT: %-25s%4.1f ms\n", f.flowing ? "optical flow:" : f.async ? "face detection (async):"
+            : f.tracking ? "face tracking:" : f.localSearch ? "face detection (local):" : "face detection:",
+            f.detectionDuration);
+        if (!f.flowing)
+            fprintf(stderr, "WHT: %-25s%4.1f ms\n", f.warmStarted ? "face landmarks (warm):"
+                : "face landmark detection:", f.landmarksDuration);
+        if (_poseSolver != PoseSolver_OpenCV)
+            fprintf(stderr, "WHT: face model matching:     %4.1f ms (%d iterations%s)\n", f.poseDuration,
+                f.solverIterations, f.lastPoseValid ? ", warm" : "");
+        else
+            fprintf(stderr, "WHT: face model matching:     %4.1f ms%s\n", f.poseDuration, f.lastPoseValid ? " (warm)" : "");
+        fprintf(stderr, "WHT: filtering:               %4.1f ms\n", duration(t3, t4));
     }
+    if (_debugOptions & Debug_Window)
+        _showPreview(f, estimatedVec, estimatedQuat);
     return true;
 }
 
+void WebcamHeadTracker::_showPreview(const FrameState& f, const double* estimatedVec, const double* estimatedQuat)
+{
+    PoseWorkspace& ws = *_workspace;
+    const std::vector<cv::Point2f>& landmarks = f.landmarks;
+    cv::Matx33f cameraMatrix(_fx, 0.0f, _cx, 0.0f, _fy, _cy, 0.0f, 0.0f, 1.0f);
+    cv::Mat& distCoeffs = ws.previewDistCoeffs;
+    distCoeffs.at<float>(0) = _k1;
+    distCoeffs.at<float>(1) = _k2;
+    distCoeffs.at<float>(2) = _p1;
+    distCoeffs.at<float>(3) = _p2;
+    distCoeffs.at<float>(4) = _k3;
+    cv::Mat& rvec = ws.previewRvec;
+    cv::Mat& tvec = ws.previewTvec;
+    for (int i = 0; i < 3; i++) {
+        rvec.at<double>(i) = f.rvec[i];
+        tvec.at<double>(i) = f.tvec[i];
+    }
+    // draw on a copy, always in color: the frame may be a view of a replayed
+    // recording, which is read again when the replay loops
+    cv::Mat& frame = ws.previewFrame;
+    if (_frame->channels() == 1)
+        cv::cvtColor(*_frame, frame, cv::COLOR_GRAY2BGR);
+    else
+        _frame->copyTo(frame);
+    // render face rectangle
+    cv::rectangle(frame, f.faceRect, cv::Scalar(0, 0, 255));
+    // render face model
+    for (int i = 1; i <= 16; i++)
+        cv::line(frame, landmarks[i - 1], landmarks[i], cv::Scalar(0, 255, 0), 1, 1, 0);
+    for (int i = 18; i <= 21; i++)
+        cv::line(frame, landmarks[i - 1], landmarks[i], cv::Scalar(0, 255, 0), 1, 1, 0);
+    for (int i = 23; i <= 26; i++)
+        cv::line(frame, landmarks[i - 1], landmarks[i], cv::Scalar(0, 255, 0), 1, 1, 0);
+    for (int i = 28; i <= 30; i++)
+        cv::line(frame, landmarks[i - 1], landmarks[i], cv::Scalar(0, 255, 0), 1, 1, 0);
+    for (int i = 31; i <= 35; i++)
+        cv::line(frame, landmarks[i - 1], landmarks[i], cv::Scalar(0, 255, 0), 1, 1, 0);
+    cv::line(frame, landmarks[30], landmarks[35], cv::Scalar(0, 255, 0), 1, 1, 0);
+    for (int i = 37; i <= 41; i++)
+        cv::line(frame, landmarks[i - 1], landmarks[i], cv::Scalar(0, 255, 0), 1, 1, 0);
+    cv::line(frame, landmarks[36], landmarks[41], cv::Scalar(0, 255, 0), 1, 1, 0);
+    for (int i = 43; i <= 47; i++)
+        cv::line(frame, landmarks[i - 1], landmarks[i], cv::Scalar(0, 255, 0), 1, 1, 0);
+    cv::line(frame, landmarks[42], landmarks[47], cv::Scalar(0, 255, 0), 1, 1, 0);
+    for (int i = 49; i <= 59; i++)
+        cv::line(frame, landmarks[i - 1], landmarks[i], cv::Scalar(0, 255, 0), 1, 1, 0);
+    cv::line(frame, landmarks[48], landmarks[49], cv::Scalar(0, 255, 0), 1, 1, 0);
+    for (int i = 61; i <= 67; i++)
+        cv::line(frame, landmarks[i - 1], landmarks[i], cv::Scalar(0, 255, 0), 1, 1, 0);
+    cv::line(frame, landmarks[60], landmarks[67], cv::Scalar(0, 255, 0), 1, 1, 0);
+    for (int i = 0; i < 68; i++)
+        cv::circle(frame, landmarks[i], 2.5f, cv::Scalar(0, 0, 255), 1, 1, 0);
+    // model landmarks; magenta if the robust solver rejected them
+    for (int i = 0; i < modelLandmarkCount; i++) {
+        cv::circle(frame, landmarks[modelLandmarkIndices[i]], 3.0f,
+            f.inliers[i] ? cv::Scalar(255, 255, 255) : cv::Scalar(255, 0, 255), 1, 1, 0);
+    }
+    // render projected face model landmarks
+    std::vector<cv::Point2f>& projectedModelLandmarks = ws.previewModelLandmarks;
+    cv::projectPoints(f.modelLandmarks, rvec, tvec, cameraMatrix, distCoeffs, projectedModelLandmarks);
+    cv::line(frame, projectedModelLandmarks[7], projectedModelLandmarks[0], cv::Scalar(255, 0, 0));
+    cv::line(frame, projectedModelLandmarks[0], projectedModelLandmarks[4], cv::Scalar(255, 0, 0));
+    cv::line(frame, projectedModelLandmarks[4], projectedModelLandmarks[2], cv::Scalar(255, 0, 0));
+    cv::line(frame, projectedModelLandmarks[2], projectedModelLandmarks[8], cv::Scalar(255, 0, 0));
+    cv::line(frame, projectedModelLandmarks[4], projectedModelLandmarks[5], cv::Scalar(255, 0, 0));
+    cv::line(frame, projectedModelLandmarks[5], projectedModelLandmarks[6], cv::Scalar(255, 0, 0));
+    cv::circle(frame, projectedModelLandmarks[0], 3.0f, cv::Scalar(255, 0, 0));
+    cv::circle(frame, projectedModelLandmarks[2], 3.0f, cv::Scalar(255, 0, 0));
+    cv::circle(frame, projectedModelLandmarks[4], 3.0f, cv::Scalar(255, 0, 0));
+    cv::circle(frame, projectedModelLandmarks[5], 3.0f, cv::Scalar(255, 0, 0));
+    cv::circle(frame, projectedModelLandmarks[6], 3.0f, cv::Scalar(255, 0, 0));
+    cv::circle(frame, projectedModelLandmarks[7], 3.0f, cv::Scalar(255, 0, 0));
+    cv::circle(frame, projectedModelLandmarks[8], 3.0f, cv::Scalar(255, 0, 0));
+    // render projected filtered model
+    std::vector<cv::Point2f>& projectedFilteredModelLandmarks = ws.previewFilteredModelLandmarks;
+    tvec.at<double>(0) = estimatedVec[0];
+    tvec.at<double>(1) = estimatedVec[1];
+    tvec.at<double>(2) = estimatedVec[2];
+    quaternionToRodrigues(estimatedQuat, &(rvec.at<double>(0)));
+    cv::projectPoints(f.modelLandmarks, rvec, tvec, cameraMatrix, distCoeffs, projectedFilteredModelLandmarks);
+    cv::line(frame, projectedFilteredModelLandmarks[7], projectedFilteredModelLandmarks[0], cv::Scalar(255, 255, 0));
+    cv::line(frame, projectedFilteredModelLandmarks[0], projectedFilteredModelLandmarks[4], cv::Scalar(255, 255, 0));
+    cv::line(frame, projectedFilteredModelLandmarks[4], projectedFilteredModelLandmarks[2], cv::Scalar(255, 255, 0));
+    cv::line(frame, projectedFilteredModelLandmarks[2], projectedFilteredModelLandmarks[8], cv::Scalar(255, 255, 0));
+    cv::line(frame, projectedFilteredModelLandmarks[4], projectedFilteredModelLandmarks[5], cv::Scalar(255, 255, 0));
+    cv::line(frame, projectedFilteredModelLandmarks[5], projectedFilteredModelLandmarks[6], cv::Scalar(255, 255, 0));
+    cv::circle(frame, projectedFilteredModelLandmarks[0], 3.0f, cv::Scalar(255, 255, 0));
+    cv::circle(frame, projectedFilteredModelLandmarks[2], 3.0f, cv::Scalar(255, 255, 0));
+    cv::circle(frame, projectedFilteredModelLandmarks[4], 13.0f, cv::Scalar(255, 255, 0));
+    cv::circle(frame, projectedFilteredModelLandmarks[5], 3.0f, cv::Scalar(255, 255, 0));
+    cv::circle(frame, projectedFilteredModelLandmarks[6], 3.0f, cv::Scalar(255, 255, 0));
+    cv::circle(frame, projectedFilteredModelLandmarks[7], 3.0f, cv::Scalar(255, 255, 0));
+    cv::circle(frame, projectedFilteredModelLandmarks[8], 3.0f, cv::Scalar(255, 255, 0));
+    // show
+    //cv::imshow(WindowName, *_frame);
+    _loadFrameToWindow(frame);
+
+    int key = cv::waitKey(1);
+    //if (key == 27 || key == 'q')// || cv::getWindowProperty(WindowName, cv::WND_PROP_VISIBLE) <= 0)
+    if (!WebcamHeadTracker::FeedOpened)
+        _isReady = false;
+    if (key == 'f')
+        _filter = (_filter == Filter_None ? Filter_Kalman
+            : _filter == Filter_Kalman ? Filter_Double_Exponential
+            : _filter == Filter_Double_Exponential ? Filter_OneEuro
+            : _filter == Filter_OneEuro ? Filter_Quaternion_Kalman
+            : Filter_None);
+}
+
+#ifdef _WIN32
 LRESULT CALLBACK WindowProc(HWND hwnd, UINT uMsg, WPARAM wParam, LPARAM lParam)
 {
     switch (uMsg)
@@ -807,6 +1902,15 @@ void WebcamHeadTracker::_loadFrameToWindow(cv::Mat frame)
 
     WebcamHeadTracker::FeedOpened = true;
 }
+#else
+void WebcamHeadTracker::_loadFrameToWindow(cv::Mat frame)
+{
+    std::string windowName(WindowName.begin(), WindowName.end());
+    cv::imshow(windowName, frame);
+
+    WebcamHeadTracker::FeedOpened = true;
+}
+#endif
 
 void WebcamHeadTracker::getHeadPosition(float* headPosition) const
 {
@@ -821,4 +1925,29 @@ void WebcamHeadTracker::getHeadOrientation(float* headOrientation) const
     headOrientation[1] = _headOrientation[1];
     headOrientation[2] = _headOrientation[2];
     headOrientation[3] = _headOrientation[3];
+}
+
+bool WebcamHeadTracker::predictPose(double targetTime, float* headPosition, float* headOrientation) const
+{
+    if (!_workspace)
+        return false;
+    double vec[3], quat[4];
+    {
+        std::lock_guard<std::mutex> lock(_workspace->filterMutex);
+        if (!_poseFilter->predict(targetTime, vec, quat))
+            return false;
+    }
+    toExternalPose(vec, quat, headPosition, headOrientation);
+    return true;
+}
+
+double WebcamHeadTracker::currentTime()
+{
+    return std::chrono::duration<double>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+void WebcamHeadTracker::getLandmarkResiduals(float* residuals) const
+{
+    for (int i = 0; i < modelLandmarkCount; i++)
+        residuals[i] = (_workspace ? _workspace->residuals[i] : 0.0f);
 }
\ No newline at end of file
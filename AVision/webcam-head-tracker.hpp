@@ -24,19 +24,25 @@
 #define WEBCAM_HEAD_TRACKER_HPP
 
 #include <string>
+#ifdef _WIN32
 #include <windows.h>
+#endif
 
  /*! \cond */
 namespace cv {
-    class VideoCapture;
     class Mat;
-    class CascadeClassifier;
-    class KalmanFilter;
 }
-namespace dlib {
-    class shape_predictor;
-}
-class DoubleExponentialSmoothing;
+class PoseFilter;
+class CaptureWorker;
+class DetectionWorker;
+class TrackingPipeline;
+class FaceDetector;
+class FaceLandmarkModel;
+class HeadModelCalibration;
+class FrameSource;
+class SessionRecorder;
+struct PoseWorkspace;
+struct FrameState;
 /*! \endcond */
 
 /*!
@@ -45,7 +51,8 @@ class DoubleExponentialSmoothing;
  * Usage:
  * - Create a single instance of the \a WebcamHeadTracker class.
  * - Call \a WebcamHeadTracker::initWebcam() to initialize the webcam. If this fails, no usable
- *   webcam could be found.
+ *   webcam could be found. Alternatively, call \a WebcamHeadTracker::initFrameSource() to
+ *   process frames from another \a FrameSource, e.g. a recorded video.
  * - Call \a WebcamHeadTracker::initPoseEstimator() to initialize the head pose estimator. This
  *   requires two data files: `haarcascade_frontalface_alt.xml` from OpenCV
  *   and `shape_predictor_68_face_landmarks.dat` from dlib. If you call this
@@ -53,6 +60,10 @@ class DoubleExponentialSmoothing;
  *   at the places where they were when the library was built. This works fine
  *   on development systems and on Linux(ish) systems, but if you deploy your
  *   application, you might want to bundle these files.
+ * - Optionally call \a WebcamHeadTracker::setCaptureMode() with \a WebcamHeadTracker::Capture_Threaded
+ *   to read webcam frames on a background thread while the head pose is computed, or
+ *   \a WebcamHeadTracker::setExecutionMode() with \a WebcamHeadTracker::Execution_Pipelined to run
+ *   all stages of the head tracking on threads of their own.
  * - While \a WebcamHeadTracker::isReady() returns true:
  *   - Acquire a new webcam frame with \a WebcamHeadTracker::getNewFrame().
  *   - Compute a new head pose with \a WebcamHeadTracker::computeHeadPose(). This may fail if no
@@ -82,7 +93,84 @@ public:
         /*! \brief Apply Kalman filter (smooth results, but long update delays on pose changes) */
         Filter_Kalman,
         /*! \brief Apply double exponential smoothing (smooth results, acceptable delays) */
-        Filter_Double_Exponential
+        Filter_Double_Exponential,
+        /*! \brief Apply the One Euro filter, which adapts the smoothing to the head speed
+         *  (smooth results while the head is still, little delay during fast movements) */
+        Filter_OneEuro,
+        /*! \brief Apply a Kalman filter to the orientation quaternion instead of Euler angles
+         *  (as \a Filter_Kalman, but cheaper and without glitches when the head turns far) */
+        Filter_Quaternion_Kalman
+    };
+
+    /*! \brief Face search strategies */
+    enum FaceSearch {
+        /*! \brief Search the whole frame for faces of any size */
+        FaceSearch_Full_Frame,
+        /*! \brief Search only around the last known face and for faces of similar size;
+         *  fall back to a full frame search after a few consecutive misses */
+        FaceSearch_Local
+    };
+
+    /*! \brief Tracking modes */
+    enum TrackingMode {
+        /*! \brief Run the face detector on every frame */
+        Tracking_Detect_Every_Frame,
+        /*! \brief Run the face detector once, then derive the face rectangle from the
+         *  landmarks of the previous frame. The detector runs again when the face is lost,
+         *  when the landmarks fit the face model badly, and periodically as a safety check. */
+        Tracking_Landmarks,
+        /*! \brief Run the face detector and the landmark detector once, then track the pose
+         *  landmarks from frame to frame with pyramidal Lucas-Kanade optical flow. Both detectors
+         *  run again every few frames, when the flow loses a landmark or its error grows, and
+         *  when the landmarks fit the face model badly. This is much cheaper per frame than
+         *  the other modes, for high frame rates. */
+        Tracking_Optical_Flow
+    };
+
+    /*! \brief Face detection modes */
+    enum DetectionMode {
+        /*! \brief Run the face detector in \a computeHeadPose() whenever a face rectangle is needed */
+        Detection_Synchronous,
+        /*! \brief Run the face detector on a worker thread, which gets a frame every few frames.
+         *  \a computeHeadPose() never waits for it: it computes the landmarks on every frame from
+         *  the most recent face rectangle, and picks up new detection results as they arrive. */
+        Detection_Asynchronous
+    };
+
+    /*! \brief Pose solvers, which fit the head model to the landmarks */
+    enum PoseSolver {
+        /*! \brief `cv::solvePnP()` with `SOLVEPNP_ITERATIVE` */
+        PoseSolver_OpenCV,
+        /*! \brief A solver specialized for the head model (see \a HeadPoseSolver): the same
+         *  results as \a PoseSolver_OpenCV in a fraction of the time */
+        PoseSolver_Head_Model,
+        /*! \brief Like \a PoseSolver_Head_Model, but with the Huber loss instead of least squares:
+         *  landmarks that are far off, e.g. because a hand or glasses occlude them, get less
+         *  weight, and they do not count in the fit check of the tracking modes */
+        PoseSolver_Head_Model_Robust
+    };
+
+    /*! \brief Capture modes */
+    enum CaptureMode {
+        /*! \brief Read each frame in \a getNewFrame() (blocks until the webcam delivers the next frame) */
+        Capture_Synchronous,
+        /*! \brief Read frames continuously on a background thread; \a getNewFrame() picks up
+         *  the newest complete frame and only waits if no new frame arrived since the last call */
+        Capture_Threaded
+    };
+
+    /*! \brief Execution modes */
+    enum ExecutionMode {
+        /*! \brief Run all stages of the head tracking one after the other in \a getNewFrame()
+         *  and \a computeHeadPose() */
+        Execution_Sequential,
+        /*! \brief Run capture, face and landmark detection, and pose fitting on threads of their
+         *  own, so that they work on consecutive frames at the same time. \a getNewFrame() picks up
+         *  the next frame that passed these stages, and \a computeHeadPose() filters its pose and
+         *  shows the preview. The frame rate is then that of the slowest stage instead of that of
+         *  all stages together. A stage that falls behind skips the oldest waiting frames, so that
+         *  the latency does not grow. */
+        Execution_Pipelined
     };
 
     /*! \brief Constructor
@@ -97,23 +185,86 @@ public:
      * is available. */
     bool initWebcam();
 
+    /*! \brief Initialize with a custom frame source
+     * \param source    The frame source. The tracker takes ownership of it.
+     *
+     * Use this instead of \a initWebcam() to process frames from a video file or
+     * an image sequence, e.g. for benchmarks and regression tests. Returns false
+     * if the frame source is not usable. When a replay source reaches its end,
+     * \a isReady() returns false. */
+    bool initFrameSource(FrameSource* source);
+
+    /*! \brief Start recording frames to a session file
+     * \param fileName  Name of the session file
+     * \param grayscale Whether to record 8-bit grayscale instead of BGR frames
+     *
+     * Every frame acquired by \a getNewFrame() is written to the file together with
+     * its capture timestamp, before any processing. The file can be replayed with a
+     * \a SessionFrameSource. This requires an initialized frame source.
+     * Returns false if the file cannot be created. */
+    bool startRecording(const char* fileName, bool grayscale = false);
+
+    /*! \brief Stop recording frames and finish the session file. */
+    void stopRecording();
+
     /*! \brief Default path to `haarcascade_frontalface_alt.xml` (location at build time, if it was found) */
     static const char* filePathFrontalFaceXml();
     /*! \brief Default path to `shape_predictor_68_face_landmarks.dat` (location at build time, if it was found) */
     static const char* filePathFaceLandmarksDat();
 
+    /*! \brief Set the face detector
+     * \param faceDetector      A face detector, see \a FaceDetector::create()
+     *
+     * The tracker takes ownership of the detector. Call this before \a initPoseEstimator();
+     * otherwise, an OpenCV Haar cascade detector is used. */
+    void setFaceDetector(FaceDetector* faceDetector);
+
     /*! \brief Initialize the pose estimator
      * \param frontalFaceXml    Full path to the file haarcascade_frontalface_alt.xml from OpenCV
+     *                          (ignored if a face detector was set with \a setFaceDetector())
      * \param faceLandmarksDat  Full path to the file shape_predictor_68_face_landmarks.dat from dlib
      *
      * This function loads the two data files from OpenCV and dlib. It returns false if this fails.
      * The default parameters should work fine on development systems and Linux(ish) systems, but
      * you might want to bundle these files with your application and use custom file paths as
-     * parameters to this function. */
+     * parameters to this function.
+     * Parsing the dlib file is slow, so on first use it is converted to a precompiled file with
+     * the additional extension `.flat` in the same directory (if that directory is writable).
+     * Later calls memory-map that file instead, which is nearly instant. A precompiled file can
+     * also be passed directly as \a faceLandmarksDat. */
     bool initPoseEstimator(
         const char* frontalFaceXml = filePathFrontalFaceXml(),
         const char* faceLandmarksDat = filePathFaceLandmarksDat());
 
+    /*! \brief Set the file that holds the calibrated head model of the user
+     * \param fileName  Name of the file, or NULL to always use the average head model
+     *
+     * The head pose is the pose of a 3D head model that fits the face landmarks best.
+     * By default, the model holds average landmark positions, which do not fit every
+     * face. With a head model file, \a initPoseEstimator() loads the model of the user
+     * from it. If the file does not exist yet, the tracker calibrates the model from the
+     * first seconds of tracking, during which the user should turn the head a little,
+     * and then saves it to the file. Use one file per user.
+     * Call this before \a initPoseEstimator(). */
+    void setHeadModelFile(const char* fileName);
+
+    /*! \brief Discard the calibrated head model and calibrate it again from the next frames
+     *
+     * This requires a head model file (see \a setHeadModelFile()), which is overwritten. */
+    void recalibrateHeadModel();
+
+    /*! \brief Set the file that holds the filter and its parameters
+     * \param fileName  Name of the file, or NULL to use \a setFilter() and the default parameters
+     *
+     * The file is written by `AVisionBench tune`, which finds the parameters that suit
+     * recorded sessions best. If it cannot be read, the filter set with \a setFilter() and the
+     * default parameters are used. The filter can still be changed with \a setFilter() later.
+     * Call this before \a initPoseEstimator(). */
+    void setFilterConfigFile(const char* fileName);
+
+    /*! \brief Returns true if the head pose is computed with a calibrated head model */
+    bool isHeadModelCalibrated() const { return _headModelCalibrated; }
+
     /*! \brief Set intrinsic camera parameters: focal lengths
      * \param fx        Horizontal focal length
      * \param fy        Vertical focal length
@@ -144,17 +295,96 @@ public:
     /*! \brief Set the filter that is applied to the pose
      * \param filter    The filter
      *
+     * The filters take the capture timestamps of the frames into account, so
+     * that irregular frame intervals and skipped frames do not cause lag.
      * The default is \a Filter_Double_Exponential.
      */
     void setFilter(enum Filter filter);
 
+    /*! \brief Set the face search strategy
+     * \param faceSearch    The face search strategy
+     *
+     * The default is \a FaceSearch_Full_Frame.
+     */
+    void setFaceSearch(enum FaceSearch faceSearch);
+
+    /*! \brief Set the tracking mode
+     * \param trackingMode  The tracking mode
+     *
+     * The default is \a Tracking_Detect_Every_Frame.
+     */
+    void setTrackingMode(enum TrackingMode trackingMode);
+
+    /*! \brief Set the face detection mode
+     * \param mode      The detection mode
+     * \param interval  In \a Detection_Asynchronous mode: hand a frame to the detector every
+     *                  \a interval frames (more often while no face is known)
+     *
+     * With \a Tracking_Landmarks, asynchronous detections replace the periodic safety check:
+     * a detection only replaces the tracked face rectangle if the two barely overlap.
+     * The default is \a Detection_Synchronous.
+     */
+    void setDetectionMode(enum DetectionMode mode, int interval = 5);
+
+    /*! \brief Set the pose solver
+     * \param poseSolver    The pose solver
+     *
+     * The default is \a PoseSolver_OpenCV.
+     */
+    void setPoseSolver(enum PoseSolver poseSolver);
+
+    /*! \brief Set the capture mode
+     * \param mode      The capture mode
+     *
+     * The default is \a Capture_Synchronous. This can be called before or after \a initWebcam().
+     */
+    void setCaptureMode(enum CaptureMode mode);
+
+    /*! \brief Set the execution mode
+     * \param mode      The execution mode
+     *
+     * In \a Execution_Pipelined mode, the pipeline starts with the next \a getNewFrame() after
+     * \a initPoseEstimator(), and replaces the capture thread of \a Capture_Threaded. Changing
+     * any setting other than the filter stops the pipeline, and the next \a getNewFrame() starts
+     * it again. A lost face is noticed a frame later than in \a Execution_Sequential mode, since
+     * the face and landmark detection of a frame may run before the pose fit of the previous
+     * frame has shown that the face was lost.
+     * The default is \a Execution_Sequential.
+     */
+    void setExecutionMode(enum ExecutionMode mode);
+
+    /*! \brief Set whether face and landmark detection work on grayscale frames
+     * \param grayscale Whether to use grayscale processing
+     *
+     * When enabled, each frame is converted to 8-bit grayscale exactly once, and both
+     * face detection and landmark detection work on that grayscale frame. Grayscale
+     * session recordings are then processed without any conversion. Color is only
+     * used for the debug window. The default is false.
+     */
+    void setGrayscaleProcessing(bool grayscale);
+
+    /*! \brief Set whether landmark detection starts from the landmarks of the previous frame
+     * \param warmStart Whether to warm-start landmark detection
+     *
+     * When enabled, the landmark regression starts from the previous frame's landmarks
+     * instead of the mean face shape, and runs only the last few (finest) stages of the
+     * cascade. If the face moved so much that this start is too far off, the full cascade
+     * runs instead. This saves most of the landmark detection time and reduces landmark
+     * jitter. The default is false.
+     */
+    void setLandmarkWarmStart(bool warmStart);
+
     /*! \brief Returns true if this tracker is ready to get a new frame and compute a new head pose
      *
      * This returns true once the tracker is successfully initialized.
-     * When \a Debug_Window is set, this can change to false when the user presses 'ESC'. */
+     * When \a Debug_Window is set, this can change to false when the user presses 'ESC'.
+     * It also changes to false when a replay frame source has no more frames. */
     bool isReady() const { return _isReady; }
 
-    /*! \brief Get a new frame from the webcam. */
+    /*! \brief Get a new frame from the webcam.
+     *
+     * In \a Capture_Threaded mode, this takes the newest frame that the capture thread
+     * has completed. Older frames that were never picked up are dropped. */
     void getNewFrame();
 
     /*! \brief Compute a new head pose.
@@ -184,6 +414,45 @@ public:
      */
     void getHeadOrientation(float* headOrientation) const;
 
+    /*! \brief Predict the head pose at the given time.
+     * \param targetTime        The time, on the clock of \a currentTime()
+     * \param headPosition      Receives the position, as in \a getHeadPosition()
+     * \param headOrientation   Receives the orientation, as in \a getHeadOrientation()
+     *
+     * This extrapolates the state of the current filter from the capture time of the
+     * last frame with a pose to the target time, e.g. to the time at which the next
+     * image will be displayed, to compensate for the latency of capturing and processing.
+     * The extrapolation is limited to 100 ms; \a Filter_None does not extrapolate.
+     * Returns false if there was no head pose yet.
+     *
+     * Unlike the other functions, this may be called from another thread
+     * while \a computeHeadPose() runs.
+     */
+    bool predictPose(double targetTime, float* headPosition, float* headOrientation) const;
+
+    /*! \brief The capture time in seconds of the frame from the last \a getNewFrame() */
+    double frameTimestamp() const { return _frameTimestamp; }
+
+    /*! \brief The number of the frame from the last \a getNewFrame(), counting the frames
+     *  read from the frame source from 1
+     *
+     * In \a Execution_Pipelined mode, the numbers of the frames that were skipped are missing. */
+    unsigned long long frameNumber() const { return _frameNumber; }
+
+    /*! \brief The current time in seconds, on the clock of the webcam frame timestamps
+     *
+     * Frames replayed from a session file carry their recorded timestamps instead. */
+    static double currentTime();
+
+    /*! \brief Get the landmark residuals of the last head pose.
+     *
+     * Returns the distances in pixels between the landmarks and the projected
+     * points of the head model, for the 9 points of the model: the left eye corner
+     * (twice), the right eye corner (twice), the sellion, the subnasale, the stomion,
+     * and the left and right tragion. Large values indicate mislocated landmarks.
+     */
+    void getLandmarkResiduals(float* residuals) const;
+
     static const std::wstring WindowName;
     static int WindowFeedAlpha;
     static bool FeedOpened;
@@ -191,10 +460,19 @@ public:
 private:
     unsigned int _debugOptions;
     bool _isReady;
-    // the webcam
-    cv::VideoCapture* _capture;
+    // the webcam (or other frame source)
+    FrameSource* _frameSource;
     cv::Mat* _frame;
-    cv::Mat* _frameGray;
+    double _frameTimestamp;
+    unsigned long long _frameNumber;
+    SessionRecorder* _recorder;
+    bool _grayscaleProcessing;
+    bool _landmarkWarmStart;
+    enum CaptureMode _captureMode;
+    CaptureWorker* _captureWorker;
+    enum ExecutionMode _executionMode;
+    TrackingPipeline* _pipeline;
+    FrameState* _pipelineFrame;     // the frame from the last getNewFrame() in pipelined mode
     // frame dimensions
     int _w, _h;
     // frame rate
@@ -204,21 +482,43 @@ private:
     float _cx, _cy;
     float _k1, _k2, _p1, _p2, _k3;
     // classifiers and detectors
-    cv::CascadeClassifier* _faceCascade;
-    dlib::shape_predictor* _faceModel;
+    FaceDetector* _faceDetector;
+    FaceLandmarkModel* _faceModel;
+    enum FaceSearch _faceSearch;
+    enum TrackingMode _trackingMode;
+    enum DetectionMode _detectionMode;
+    enum PoseSolver _poseSolver;
+    std::string _headModelFile;
+    HeadModelCalibration* _headModelCalibration;
+    bool _headModelCalibrated;
+    int _detectionInterval;
+    DetectionWorker* _detectionWorker;
     // filters
     enum Filter _filter;
-    cv::KalmanFilter* _kalmanFilter;
-    DoubleExponentialSmoothing* _despFilter;
+    std::string _filterConfigFile;
+    PoseFilter* _poseFilter;
+    // per-frame buffers of computeHeadPose()
+    PoseWorkspace* _workspace;
     // last known head pose
     float _headPosition[3];
     float _headOrientation[4];
 
+    // the stages of the head tracking
+    void _storeFrame(cv::Mat& frame, double timestamp);
+    void _prepareFrame(FrameState& f);
+    void _locateFace(FrameState& f);
+    void _solvePose(FrameState& f);
+    void _showPreview(const FrameState& f, const double* estimatedVec, const double* estimatedQuat);
+    void _startPipeline();
+    void _stopPipeline();
+
+#ifdef _WIN32
     std::wstring _windowClassName;
     HWND _windowHandle;
     WNDCLASS _wc;
 
     void _createWebcamFeedWindow();
+#endif
     void _loadFrameToWindow(cv::Mat frame);
 };
 
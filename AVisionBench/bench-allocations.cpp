@@ -0,0 +1,256 @@
+/*
+ * Allocation check.
+ *
+ * Heap allocations are counted in two places: in the global operator new of this
+ * program, and in a cv::MatAllocator that OpenCV uses for the data of every cv::Mat,
+ * also inside the OpenCV DLLs. The counts include all threads, so the worker threads
+ * of the tracker are counted as well.
+ *
+ * The tracker runs over the recording with grayscale processing, local face search,
+ * landmark tracking, landmark warm start, the robust head model solver and
+ * asynchronous face detection, in the sequential execution mode. The first frames
+ * size the buffers of the tracker; after them, getNewFrame() and computeHeadPose()
+ * must not allocate, or the check fails.
+ *
+ * The face detector runs on its worker thread, off the path of the frames, and the
+ * libraries behind it allocate on every call. Allocations while its detect() runs
+ * are counted separately and only reported.
+ *
+ * Allocations inside the OpenCV DLLs that do not hold cv::Mat data, e.g. of a
+ * std::vector, are not seen on Windows, where each DLL has its own operator new.
+ * Use a session file: its frames are views of the mapped file, while video decoders
+ * allocate on their own.
+ */
+
+#include "bench.hpp"
+#include "../AVision/frame-source.hpp"
+#include "../AVision/face-detector.hpp"
+#include "../AVision/webcam-head-tracker.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <cstdio>
+#include <cstdlib>
+#include <new>
+
+#include <opencv2/core/core.hpp>
+
+static std::atomic<unsigned long long> allocationCount(0);
+static std::atomic<unsigned long long> detectorAllocationCount(0);
+// set while the face detector runs on this thread
+static thread_local bool inFaceDetector = false;
+
+static void countAllocation()
+{
+    if (inFaceDetector)
+        detectorAllocationCount++;
+    else
+        allocationCount++;
+}
+
+void* operator new(std::size_t size)
+{
+    countAllocation();
+    void* p = std::malloc(size > 0 ? size : 1);
+    if (!p)
+        throw std::bad_alloc();
+    return p;
+}
+
+void* operator new[](std::size_t size)
+{
+    return operator new(size);
+}
+
+void* operator new(std::size_t size, const std::nothrow_t&) noexcept
+{
+    countAllocation();
+    return std::malloc(size > 0 ? size : 1);
+}
+
+void* operator new[](std::size_t size, const std::nothrow_t&) noexcept
+{
+    return operator new(size, std::nothrow);
+}
+
+void operator delete(void* p) noexcept
+{
+    std::free(p);
+}
+
+void operator delete[](void* p) noexcept
+{
+    std::free(p);
+}
+
+void operator delete(void* p, std::size_t) noexcept
+{
+    std::free(p);
+}
+
+void operator delete[](void* p, std::size_t) noexcept
+{
+    std::free(p);
+}
+
+void operator delete(void* p, const std::nothrow_t&) noexcept
+{
+    std::free(p);
+}
+
+void operator delete[](void* p, const std::nothrow_t&) noexcept
+{
+    std::free(p);
+}
+
+/* Counts the allocations of cv::Mat data, and leaves them to OpenCV's standard
+ * allocator. The data remembers that allocator, which also frees it. */
+class CountingMatAllocator : public cv::MatAllocator
+{
+private:
+    cv::MatAllocator* _allocator;
+
+public:
+    CountingMatAllocator(cv::MatAllocator* allocator) : _allocator(allocator)
+    {
+    }
+
+    cv::UMatData* allocate(int dims, const int* sizes, int type, void* data, size_t* step,
+        cv::AccessFlag flags, cv::UMatUsageFlags usageFlags) const override
+    {
+        if (!data)
+            countAllocation();
+        return _allocator->allocate(dims, sizes, type, data, step, flags, usageFlags);
+    }
+
+    bool allocate(cv::UMatData* data, cv::AccessFlag accessFlags, cv::UMatUsageFlags usageFlags) const override
+    {
+        return _allocator->allocate(data, accessFlags, usageFlags);
+    }
+
+    void deallocate(cv::UMatData* data) const override
+    {
+        _allocator->deallocate(data);
+    }
+};
+
+/* Runs a face detector, and marks the allocations of its detect() */
+class CountingFaceDetector : public FaceDetector
+{
+private:
+    FaceDetector* _detector;
+
+public:
+    CountingFaceDetector(FaceDetector* detector) : _detector(detector)
+    {
+    }
+
+    ~CountingFaceDetector()
+    {
+        delete _detector;
+    }
+
+    bool detect(const cv::Mat& frame, int minSize, int maxSize, cv::Rect& face) override
+    {
+        inFaceDetector = true;
+        bool found = _detector->detect(frame, minSize, maxSize, face);
+        inFaceDetector = false;
+        return found;
+    }
+};
+
+/* Frames that may allocate while the tracker sizes its buffers, finds the face
+ * and starts tracking it: one second of a 30 fps recording */
+static const int warmUpFrames = 30;
+
+static int runCheck(const std::string& recording)
+{
+    ReplayFrameSource* source = openRecording(recording);
+    if (!source) {
+        std::fprintf(stderr, "cannot open %s\n", recording.c_str());
+        return 1;
+    }
+    FaceDetector* faceDetector = FaceDetector::create(FaceDetector::Backend_Haar,
+        WebcamHeadTracker::filePathFrontalFaceXml());
+    if (!faceDetector) {
+        std::fprintf(stderr, "cannot load the face detector\n");
+        delete source;
+        return 1;
+    }
+    WebcamHeadTracker tracker;
+    tracker.setGrayscaleProcessing(true);
+    tracker.setLandmarkWarmStart(true);
+    tracker.setFaceSearch(WebcamHeadTracker::FaceSearch_Local);
+    tracker.setTrackingMode(WebcamHeadTracker::Tracking_Landmarks);
+    tracker.setPoseSolver(WebcamHeadTracker::PoseSolver_Head_Model_Robust);
+    tracker.setDetectionMode(WebcamHeadTracker::Detection_Asynchronous);
+    tracker.setFaceDetector(new CountingFaceDetector(faceDetector));
+    if (!tracker.initFrameSource(source) || !tracker.initPoseEstimator()) {
+        std::fprintf(stderr, "cannot load the face detector or landmark model\n");
+        return 1;
+    }
+
+    int frames = 0;
+    int poses = 0;
+    int allocatingFrames = 0;
+    unsigned long long maxAllocations = 0;
+    // Frames are measured one by one for the statistics, and the whole steady
+    // state at once, so that worker threads are also counted between frames.
+    unsigned long long steadyStart = 0;
+    unsigned long long detectorSteadyStart = 0;
+    while (tracker.isReady()) {
+        if (frames == warmUpFrames) {
+            steadyStart = allocationCount;
+            detectorSteadyStart = detectorAllocationCount;
+        }
+        unsigned long long before = allocationCount;
+        tracker.getNewFrame();
+        if (!tracker.isReady())
+            break;
+        bool posed = tracker.computeHeadPose();
+        unsigned long long n = allocationCount - before;
+        if (frames++ < warmUpFrames)
+            continue;
+        if (posed)
+            poses++;
+        if (n > 0) {
+            allocatingFrames++;
+            maxAllocations = std::max(maxAllocations, n);
+        }
+    }
+    if (frames <= warmUpFrames) {
+        std::printf("%s: only %d frames, not more than the %d warm-up frames\n", recording.c_str(),
+            frames, warmUpFrames);
+        return 1;
+    }
+    unsigned long long allocations = allocationCount - steadyStart;
+    unsigned long long detectorAllocations = detectorAllocationCount - detectorSteadyStart;
+
+    std::printf("%s, %d frames after %d warm-up frames, %d poses\n", recording.c_str(),
+        frames - warmUpFrames, warmUpFrames, poses);
+    if (poses == 0) {
+        std::printf("no poses: the steady state was not reached\n");
+        return 1;
+    }
+    std::printf("face detector %llu allocations (not checked)\n", detectorAllocations);
+    bool allocationFree = (allocations == 0);
+    std::printf("allocations  %llu in %d frames, max %llu per frame: %s\n", allocations, allocatingFrames,
+        maxAllocations, allocationFree ? "allocation-free" : "NOT allocation-free (limit: 0 per frame)");
+    return allocationFree ? 0 : 1;
+}
+
+int benchAllocations(int argc, char* argv[])
+{
+    std::string recording = argv[0];
+    if (argc > 1) {
+        std::fprintf(stderr, "allocations: invalid option %s\n", argv[1]);
+        return 1;
+    }
+    // parallel OpenCV functions allocate a job for their worker threads on each call
+    cv::setNumThreads(0);
+    CountingMatAllocator matAllocator(cv::Mat::getStdAllocator());
+    cv::Mat::setDefaultAllocator(&matAllocator);
+    int result = runCheck(recording);
+    cv::Mat::setDefaultAllocator(NULL);
+    return result;
+}
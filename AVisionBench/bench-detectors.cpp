@@ -0,0 +1,107 @@
+/*
+ * Face detector comparison.
+ *
+ * Each backend runs on every frame of the recording, with the same minimum
+ * face size as the head tracker. Only the detect() call is timed; reading
+ * and grayscale conversion are not.
+ */
+
+#include "bench.hpp"
+#include "../AVision/frame-source.hpp"
+#include "../AVision/face-detector.hpp"
+#include "../AVision/webcam-head-tracker.hpp"
+
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+
+#include <opencv2/core/core.hpp>
+#include <opencv2/imgproc/imgproc.hpp>
+
+struct DetectorRun
+{
+    enum FaceDetector::Backend backend;
+    std::string modelFile;
+};
+
+static bool runDetector(const std::string& recording, const DetectorRun& run, bool grayscale)
+{
+    const char* name = FaceDetector::backendName(run.backend);
+    FaceDetector* detector = FaceDetector::create(run.backend, run.modelFile);
+    if (!detector) {
+        std::fprintf(stderr, "%s: cannot load model %s\n", name, run.modelFile.c_str());
+        return false;
+    }
+    ReplayFrameSource* source = openRecording(recording);
+    if (!source) {
+        std::fprintf(stderr, "cannot open %s\n", recording.c_str());
+        delete detector;
+        return false;
+    }
+
+    const int minFaceSize = 80;
+    cv::Mat frame, gray;
+    double timestamp;
+    cv::Rect face;
+    std::vector<double> latencies;
+    size_t detections = 0;
+    while (source->read(frame, timestamp)) {
+        const cv::Mat* f = &frame;
+        if (grayscale && frame.channels() == 3) {
+            cv::cvtColor(frame, gray, cv::COLOR_BGR2GRAY);
+            f = &gray;
+        }
+        auto t0 = std::chrono::steady_clock::now();
+        bool found = detector->detect(*f, minFaceSize, 0, face);
+        auto t1 = std::chrono::steady_clock::now();
+        latencies.push_back(std::chrono::duration<double, std::milli>(t1 - t0).count());
+        if (found)
+            detections++;
+    }
+    size_t frames = latencies.size();
+    printLatencies(name, latencies);
+    std::printf("%-12s detection rate %5.1f%% (%zu of %zu frames)\n", "",
+        frames > 0 ? 100.0 * detections / frames : 0.0, detections, frames);
+
+    delete source;
+    delete detector;
+    return true;
+}
+
+int benchDetectors(int argc, char* argv[])
+{
+    std::string recording = argv[0];
+    bool grayscale = true;
+    std::vector<DetectorRun> runs;
+    for (int i = 1; i < argc; i++) {
+        if (std::strcmp(argv[i], "--haar") == 0 && i + 1 < argc) {
+            runs.push_back({ FaceDetector::Backend_Haar, argv[++i] });
+        }
+        else if (std::strcmp(argv[i], "--lbp") == 0 && i + 1 < argc) {
+            runs.push_back({ FaceDetector::Backend_LBP, argv[++i] });
+        }
+        else if (std::strcmp(argv[i], "--hog") == 0) {
+            runs.push_back({ FaceDetector::Backend_HOG, std::string() });
+        }
+        else if (std::strcmp(argv[i], "--yunet") == 0 && i + 1 < argc) {
+            runs.push_back({ FaceDetector::Backend_DNN, argv[++i] });
+        }
+        else if (std::strcmp(argv[i], "--color") == 0) {
+            grayscale = false;
+        }
+        else {
+            std::fprintf(stderr, "detectors: invalid option %s\n", argv[i]);
+            return 1;
+        }
+    }
+    if (runs.empty()) {
+        runs.push_back({ FaceDetector::Backend_Haar, WebcamHeadTracker::filePathFrontalFaceXml() });
+        runs.push_back({ FaceDetector::Backend_HOG, std::string() });
+    }
+
+    std::printf("%s, %s frames\n", recording.c_str(), grayscale ? "grayscale" : "color");
+    bool ok = true;
+    for (size_t i = 0; i < runs.size(); i++)
+        ok = runDetector(recording, runs[i], grayscale) && ok;
+    return ok ? 0 : 1;
+}
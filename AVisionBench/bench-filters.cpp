@@ -0,0 +1,107 @@
+/*
+ * Filter comparison.
+ *
+ * All filters run with the same parameters, the defaults or those of a filter
+ * configuration file, over the raw poses of the recordings. Each is scored by
+ * its jitter and lag (see bench-poses.cpp), and by its largest orientation
+ * error, which shows glitches such as those of Euler angles near their
+ * singularity. Then each filter runs over all poses again and again, and the
+ * time per step is measured.
+ */
+
+#include "bench.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+
+// Each filter runs over at least this many poses for the timing
+static const size_t timedSteps = 1000000;
+
+// Run a filter over all poses; returns the time per step in ns
+static double timeFilter(enum WebcamHeadTracker::Filter filter, const PoseFilterParameters& parameters,
+    const std::vector<PoseSequence>& sequences, double nominalFps)
+{
+    size_t steps = 0;
+    double checksum = 0.0;
+    auto t0 = std::chrono::steady_clock::now();
+    while (steps < timedSteps) {
+        for (const PoseSequence& s : sequences) {
+            PoseFilter poseFilter(nominalFps, parameters);
+            for (const PoseSample& p : s.poses) {
+                double vec[3], quat[4];
+                poseFilter.step(filter, p.timestamp, p.vec, p.quat, vec, quat);
+                checksum += quat[3];
+            }
+            steps += s.poses.size();
+        }
+    }
+    double ns = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - t0).count();
+    // use the results, so that the steps are not optimized away
+    if (checksum == 0.0)
+        std::printf(" ");
+    return ns / steps;
+}
+
+int benchFilters(int argc, char* argv[])
+{
+    std::vector<std::string> inputs;
+    std::string configFile;
+    bool savePoseFiles = false;
+    double lagWeight = 1.0;
+    double rotationWeight = 1.0;
+    for (int i = 0; i < argc; i++) {
+        if (std::strcmp(argv[i], "--config") == 0 && i + 1 < argc)
+            configFile = argv[++i];
+        else if (std::strcmp(argv[i], "--save-poses") == 0)
+            savePoseFiles = true;
+        else if (std::strcmp(argv[i], "--lag-weight") == 0 && i + 1 < argc)
+            lagWeight = std::atof(argv[++i]);
+        else if (std::strcmp(argv[i], "--rotation-weight") == 0 && i + 1 < argc)
+            rotationWeight = std::atof(argv[++i]);
+        else if (argv[i][0] == '-') {
+            std::fprintf(stderr, "filters: invalid option %s\n", argv[i]);
+            return 1;
+        }
+        else
+            inputs.push_back(argv[i]);
+    }
+    PoseFilterParameters parameters;
+    if (!configFile.empty()) {
+        enum WebcamHeadTracker::Filter configFilter;
+        if (!PoseFilter::load(configFile, configFilter, parameters)) {
+            std::fprintf(stderr, "cannot load %s\n", configFile.c_str());
+            return 1;
+        }
+    }
+
+    std::vector<PoseSequence> sequences;
+    double nominalFps;
+    if (!loadPoseSequences(inputs, savePoseFiles, sequences, nominalFps))
+        return 1;
+    size_t poseCount = 0;
+    for (const PoseSequence& s : sequences)
+        poseCount += s.poses.size();
+    std::printf("%zu poses, nominal frame rate %.1f fps\n\n", poseCount, nominalFps);
+
+    const enum WebcamHeadTracker::Filter filters[] = {
+        WebcamHeadTracker::Filter_None,
+        WebcamHeadTracker::Filter_Kalman,
+        WebcamHeadTracker::Filter_Quaternion_Kalman,
+        WebcamHeadTracker::Filter_Double_Exponential,
+        WebcamHeadTracker::Filter_OneEuro
+    };
+    std::printf("%-20s %8s %11s %8s %12s %9s %9s %9s\n", "filter", "score", "jitter mm", "lag mm",
+        "jitter deg", "lag deg", "max deg", "ns/step");
+    for (enum WebcamHeadTracker::Filter filter : filters) {
+        FilterScore s = scoreFilter(filter, parameters, sequences, nominalFps, lagWeight, rotationWeight);
+        double ns = timeFilter(filter, parameters, sequences, nominalFps);
+        std::printf("%-20s %8.3f %11.3f %8.3f %12.3f %9.3f %9.3f %9.1f\n", filterName(filter),
+            s.cost, s.positionJitter, s.positionLag, s.orientationJitter, s.orientationLag,
+            s.orientationMax, ns);
+    }
+    return 0;
+}
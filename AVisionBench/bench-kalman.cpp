@@ -0,0 +1,163 @@
+/*
+ * Kalman filter equivalence.
+ *
+ * PoseKalmanFilter works on six independent filters with three states each. It
+ * replaced one cv::KalmanFilter with 18 states and 6 measurements, and must give
+ * the same estimates. Both run over the same generated measurements: random walks
+ * of the three position coordinates and the three Euler angles, with noise added,
+ * at irregular frame intervals, for several settings of the noise parameters. The
+ * cv::KalmanFilter is set up as the tracker did it before, except that its
+ * transition and process noise follow the time step of each measurement, as in
+ * PoseKalmanFilter. Each filter is timed, and the check fails if any estimate
+ * differs by more than 1e-9 relative to its magnitude (or to 1, if that is larger).
+ */
+
+#include "bench.hpp"
+#include "../AVision/pose-kalman-filter.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <random>
+#include <vector>
+
+#include <opencv2/core/core.hpp>
+#include <opencv2/video/tracking.hpp>
+
+// The measurements: one sequence per noise setting, at 30 fps with jitter and missed frames
+static const int sequenceLength = 3000;
+static const double nominalInterval = 1.0 / 30.0;
+static const double initialError = 1.0;
+
+// The largest relative difference of equivalent filters, from floating point rounding
+static const double maxDifference = 1e-9;
+
+/* The reference: one cv::KalmanFilter for the position (states 0-8) and the
+ * Euler angles (states 9-17), each with value, velocity and acceleration */
+
+class ReferenceKalmanFilter
+{
+private:
+    cv::KalmanFilter _kalmanFilter;
+    cv::Mat _measurement;
+    double _nominalDt;
+    double _processNoise;
+
+public:
+    ReferenceKalmanFilter(double nominalDt, double processNoise, double measurementNoise) :
+        _measurement(6, 1, CV_64F),
+        _nominalDt(nominalDt),
+        _processNoise(processNoise)
+    {
+        _kalmanFilter.init(18, 6, 0, CV_64F);
+        cv::setIdentity(_kalmanFilter.measurementNoiseCov, cv::Scalar::all(measurementNoise));
+        cv::setIdentity(_kalmanFilter.errorCovPost, cv::Scalar::all(initialError));
+        for (int i = 0; i < 3; i++) {
+            _kalmanFilter.measurementMatrix.at<double>(i, i) = 1;
+            _kalmanFilter.measurementMatrix.at<double>(3 + i, 9 + i) = 1;
+        }
+    }
+
+    void step(double dt, const double* measurement, double* estimate)
+    {
+        for (int b = 0; b <= 9; b += 9) {
+            for (int i = 0; i < 3; i++) {
+                _kalmanFilter.transitionMatrix.at<double>(b + i, b + 3 + i) = dt;
+                _kalmanFilter.transitionMatrix.at<double>(b + 3 + i, b + 6 + i) = dt;
+                _kalmanFilter.transitionMatrix.at<double>(b + i, b + 6 + i) = 0.5 * dt * dt;
+            }
+        }
+        cv::setIdentity(_kalmanFilter.processNoiseCov, cv::Scalar::all(_processNoise * (dt / _nominalDt)));
+        for (int c = 0; c < 6; c++)
+            _measurement.at<double>(c) = measurement[c];
+        _kalmanFilter.predict();
+        const cv::Mat& estimation = _kalmanFilter.correct(_measurement);
+        for (int i = 0; i < 3; i++) {
+            estimate[i] = estimation.at<double>(i);
+            estimate[3 + i] = estimation.at<double>(9 + i);
+        }
+    }
+};
+
+/* Random walks of a head in front of the camera: positions in mm, angles in radians,
+ * and the time since the last measurement in seconds */
+static void generateMeasurements(std::mt19937& generator, std::vector<double>& intervals,
+    std::vector<double>& measurements)
+{
+    static const double start[6] = { 0.0, 0.0, 500.0, 3.0, 0.0, 0.0 };
+    static const double stepDeviation[6] = { 2.0, 2.0, 3.0, 0.01, 0.01, 0.01 };
+    static const double noiseDeviation[6] = { 1.0, 1.0, 5.0, 0.005, 0.005, 0.005 };
+    std::normal_distribution<double> normal;
+    std::uniform_real_distribution<double> jitter(0.7, 1.3);
+    std::uniform_int_distribution<int> missedFrames(-27, 3);
+    double value[6];
+    std::copy(start, start + 6, value);
+    intervals.resize(sequenceLength);
+    measurements.resize(6 * sequenceLength);
+    for (int i = 0; i < sequenceLength; i++) {
+        // the interval jitters by 30%, and about every tenth measurement follows one to three missed frames
+        intervals[i] = nominalInterval * (jitter(generator) + std::max(missedFrames(generator), 0));
+        for (int c = 0; c < 6; c++) {
+            value[c] += stepDeviation[c] * std::sqrt(intervals[i] / nominalInterval) * normal(generator);
+            measurements[6 * i + c] = value[c] + noiseDeviation[c] * normal(generator);
+        }
+    }
+}
+
+int benchKalman(int argc, char* argv[])
+{
+    if (argc > 0) {
+        std::fprintf(stderr, "kalman: invalid option %s\n", argv[0]);
+        return 1;
+    }
+    static const struct {
+        double processNoise;
+        double measurementNoise;
+    } noiseSettings[] = {
+        { 1e-3, 1e-1 },     // the tracker's defaults
+        { 1e-1, 1e-3 },     // following the measurements closely
+        { 1e-5, 1e+1 }      // smoothing strongly
+    };
+    const int settingCount = sizeof(noiseSettings) / sizeof(noiseSettings[0]);
+
+    std::mt19937 generator(2017);
+    std::vector<double> intervals, measurements;
+    std::vector<double> estimates(6 * sequenceLength), references(6 * sequenceLength);
+    double filterSeconds = 0.0, referenceSeconds = 0.0;
+    double maxRelativeDifference = 0.0;
+    for (int s = 0; s < settingCount; s++) {
+        generateMeasurements(generator, intervals, measurements);
+
+        auto t0 = std::chrono::steady_clock::now();
+        PoseKalmanFilter filter(nominalInterval, noiseSettings[s].processNoise,
+            noiseSettings[s].measurementNoise, initialError);
+        for (int i = 0; i < sequenceLength; i++)
+            filter.step(intervals[i], &measurements[6 * i], &estimates[6 * i]);
+        auto t1 = std::chrono::steady_clock::now();
+        ReferenceKalmanFilter referenceFilter(nominalInterval, noiseSettings[s].processNoise,
+            noiseSettings[s].measurementNoise);
+        for (int i = 0; i < sequenceLength; i++)
+            referenceFilter.step(intervals[i], &measurements[6 * i], &references[6 * i]);
+        auto t2 = std::chrono::steady_clock::now();
+        filterSeconds += std::chrono::duration<double>(t1 - t0).count();
+        referenceSeconds += std::chrono::duration<double>(t2 - t1).count();
+
+        for (size_t i = 0; i < estimates.size(); i++) {
+            double difference = std::fabs(estimates[i] - references[i]) / std::max(std::fabs(references[i]), 1.0);
+            // a NaN must fail the check
+            if (std::isnan(difference))
+                difference = HUGE_VAL;
+            maxRelativeDifference = std::max(maxRelativeDifference, difference);
+        }
+    }
+
+    int steps = settingCount * sequenceLength;
+    std::printf("%d steps with %d noise settings\n", steps, settingCount);
+    std::printf("%-12s %8.1f ns/step\n", "kalman", filterSeconds * 1e9 / steps);
+    std::printf("%-12s %8.1f ns/step\n", "OpenCV", referenceSeconds * 1e9 / steps);
+    bool equivalent = (maxRelativeDifference <= maxDifference);
+    std::printf("difference   max %.3g relative: %s\n", maxRelativeDifference,
+        equivalent ? "equivalent" : "NOT equivalent (limit: 1e-9)");
+    return equivalent ? 0 : 1;
+}
@@ -0,0 +1,180 @@
+/*
+ * Face landmark model equivalence.
+ *
+ * The face is detected on every frame of the recording, as in the tracker. Then
+ * dlib::shape_predictor and FaceLandmarkModel estimate the landmarks in the same
+ * face rectangle, from the same shape predictor file. dlib rounds the landmarks
+ * to whole pixels and FaceLandmarkModel does not, which moves a landmark by up to
+ * 0.71 pixels; the check fails if any landmark differs by more than 1 pixel.
+ * FaceLandmarkModel also runs with the subset of the seven landmarks of the pose
+ * fit, as in the tracker without the debug window, and must give exactly the
+ * same seven landmarks as without the subset. Both run with every evaluation
+ * kernel that the CPU supports, and each kernel must give exactly the same
+ * landmarks as the scalar kernel. Only the landmark calls are timed.
+ */
+
+#include "bench.hpp"
+#include "../AVision/frame-source.hpp"
+#include "../AVision/face-detector.hpp"
+#include "../AVision/face-landmarks.hpp"
+#include "../AVision/head-model.hpp"
+#include "../AVision/webcam-head-tracker.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include <opencv2/core/core.hpp>
+#include <opencv2/core/types_c.h>
+#include <opencv2/imgproc/imgproc.hpp>
+
+#include <dlib/opencv.h>
+#include <dlib/image_processing.h>
+
+// The largest distance of equivalent landmarks, from dlib's rounding
+static const double maxLandmarkDifference = 1.0;   // pixels
+
+static dlib::full_object_detection dlibLandmarks(dlib::shape_predictor& predictor,
+    const cv::Mat& frame, const cv::Rect& face)
+{
+    dlib::rectangle dlibRect(face.x, face.y, face.x + face.width - 1, face.y + face.height - 1);
+    // A temporary workaround for a Dlib/OpenCV incompatibility:
+    IplImage iplImg = cvIplImage(frame);
+    if (frame.channels() == 1) {
+        dlib::cv_image<unsigned char> dlibFrame(&iplImg); // does not copy data
+        return predictor(dlibFrame, dlibRect);
+    }
+    dlib::cv_image<dlib::bgr_pixel> dlibFrame(&iplImg); // does not copy data
+    return predictor(dlibFrame, dlibRect);
+}
+
+int benchLandmarks(int argc, char* argv[])
+{
+    std::string recording = argv[0];
+    bool grayscale = true;
+    for (int i = 1; i < argc; i++) {
+        if (std::strcmp(argv[i], "--color") == 0) {
+            grayscale = false;
+        }
+        else {
+            std::fprintf(stderr, "landmarks: invalid option %s\n", argv[i]);
+            return 1;
+        }
+    }
+    FaceDetector* detector = FaceDetector::create(FaceDetector::Backend_Haar,
+        WebcamHeadTracker::filePathFrontalFaceXml());
+    std::string landmarksDat = WebcamHeadTracker::filePathFaceLandmarksDat();
+    // both from the dlib file, without the precompiled cache
+    FaceLandmarkModel model;
+    dlib::shape_predictor predictor;
+    bool loaded = (detector && model.load(landmarksDat) && model.landmarkCount() == 68);
+    if (loaded) {
+        try {
+            dlib::deserialize(landmarksDat) >> predictor;
+        }
+        catch (dlib::serialization_error& e) {
+            loaded = false;
+        }
+    }
+    if (!loaded || predictor.num_parts() != 68) {
+        std::fprintf(stderr, "cannot load the face detector or landmark model\n");
+        delete detector;
+        return 1;
+    }
+    ReplayFrameSource* source = openRecording(recording);
+    if (!source) {
+        std::fprintf(stderr, "cannot open %s\n", recording.c_str());
+        delete detector;
+        return 1;
+    }
+
+    static const FaceLandmarkModel::Kernel allKernels[] = {
+        FaceLandmarkModel::Kernel_Scalar, FaceLandmarkModel::Kernel_SSE41, FaceLandmarkModel::Kernel_AVX2
+    };
+    // the scalar kernel first: it is the reference of the others
+    std::vector<FaceLandmarkModel::Kernel> kernels;
+    for (FaceLandmarkModel::Kernel kernel : allKernels) {
+        if (model.setKernel(kernel))
+            kernels.push_back(kernel);
+    }
+
+    std::vector<cv::Point2f> landmarks(68), kernelLandmarks(68), poseLandmarks(68);
+    cv::Mat frame, gray;
+    double timestamp;
+    cv::Rect face;
+    std::vector<double> dlibLatencies;
+    std::vector<std::vector<double>> modelLatencies(kernels.size()), subsetLatencies(kernels.size());
+    double maxDifference = 0.0, sumDifference = 0.0;
+    size_t kernelMismatches = 0, subsetMismatches = 0;
+    while (source->read(frame, timestamp)) {
+        const cv::Mat* f = &frame;
+        if (grayscale && frame.channels() == 3) {
+            cv::cvtColor(frame, gray, cv::COLOR_BGR2GRAY);
+            f = &gray;
+        }
+        if (!detector->detect(*f, 80, 0, face))
+            continue;
+        auto t0 = std::chrono::steady_clock::now();
+        dlib::full_object_detection shape = dlibLandmarks(predictor, *f, face);
+        auto t1 = std::chrono::steady_clock::now();
+        dlibLatencies.push_back(std::chrono::duration<double, std::milli>(t1 - t0).count());
+        for (size_t k = 0; k < kernels.size(); k++) {
+            model.setKernel(kernels[k]);
+            std::vector<cv::Point2f>& full = (k == 0 ? landmarks : kernelLandmarks);
+            auto t2 = std::chrono::steady_clock::now();
+            model.predict(*f, face, full.data());
+            auto t3 = std::chrono::steady_clock::now();
+            model.predict(*f, face, poseLandmarks.data(), poseLandmarkIndices, poseLandmarkCount);
+            auto t4 = std::chrono::steady_clock::now();
+            modelLatencies[k].push_back(std::chrono::duration<double, std::milli>(t3 - t2).count());
+            subsetLatencies[k].push_back(std::chrono::duration<double, std::milli>(t4 - t3).count());
+
+            // a NaN differs from everything, and fails the checks
+            for (int i = 0; k > 0 && i < 68; i++) {
+                if (full[i].x != landmarks[i].x || full[i].y != landmarks[i].y)
+                    kernelMismatches++;
+            }
+            for (int j = 0; j < poseLandmarkCount; j++) {
+                int i = poseLandmarkIndices[j];
+                if (poseLandmarks[i].x != full[i].x || poseLandmarks[i].y != full[i].y)
+                    subsetMismatches++;
+            }
+        }
+
+        for (int i = 0; i < 68; i++) {
+            double difference = std::hypot(landmarks[i].x - shape.part(i).x(), landmarks[i].y - shape.part(i).y());
+            // a NaN must fail the check
+            if (std::isnan(difference))
+                difference = HUGE_VAL;
+            maxDifference = std::max(maxDifference, difference);
+            sumDifference += difference;
+        }
+    }
+    delete source;
+    delete detector;
+
+    size_t faces = dlibLatencies.size();
+    std::printf("%s, %zu faces, %s frames\n", recording.c_str(), faces, grayscale ? "grayscale" : "color");
+    if (faces == 0)
+        return 1;
+    printLatencies("dlib", dlibLatencies);
+    for (size_t k = 0; k < kernels.size(); k++) {
+        std::string name = FaceLandmarkModel::kernelName(kernels[k]);
+        printLatencies(name.c_str(), modelLatencies[k]);
+        printLatencies((name + " pose").c_str(), subsetLatencies[k]);
+    }
+    bool equivalent = (maxDifference <= maxLandmarkDifference);
+    std::printf("difference   max %.3f px, mean %.3f px: %s\n", maxDifference, sumDifference / (68 * faces),
+        equivalent ? "equivalent" : "NOT equivalent (limit: 1 px)");
+    bool kernelsIdentical = (kernelMismatches == 0);
+    std::printf("kernels      %zu of %zu landmarks differ from scalar: %s\n", kernelMismatches,
+        68 * faces * (kernels.size() - 1), kernelsIdentical ? "identical" : "NOT identical");
+    bool identical = (subsetMismatches == 0);
+    std::printf("pose subset  %zu of %zu landmarks differ: %s\n", subsetMismatches,
+        poseLandmarkCount * faces * kernels.size(), identical ? "identical" : "NOT identical");
+    return equivalent && kernelsIdentical && identical ? 0 : 1;
+}
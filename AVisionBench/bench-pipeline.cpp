@@ -0,0 +1,99 @@
+/*
+ * Execution mode comparison.
+ *
+ * The tracker runs over the recording with all optional processing modes and
+ * asynchronous face detection, once in each execution mode. As fast as
+ * possible, the sequential mode processes every frame, while the pipelined
+ * mode skips the frames that arrive while its slowest stage is busy; the frame
+ * rate shows the throughput of each mode. With --real-time, the recording is
+ * replayed at its own pace, as from the webcam, and the latency from the time
+ * a frame is due to its filtered pose is measured as well.
+ */
+
+#include "bench.hpp"
+#include "../AVision/frame-source.hpp"
+
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <vector>
+
+static bool runMode(const std::string& recording, enum WebcamHeadTracker::ExecutionMode mode, bool realTime)
+{
+    ReplayFrameSource* source = openRecording(recording);
+    if (!source)
+        return false;
+    if (realTime)
+        source->setPacing(ReplayFrameSource::Pacing_Real_Time);
+    WebcamHeadTracker tracker;
+    tracker.setExecutionMode(mode);
+    tracker.setGrayscaleProcessing(true);
+    tracker.setLandmarkWarmStart(true);
+    tracker.setFaceSearch(WebcamHeadTracker::FaceSearch_Local);
+    tracker.setTrackingMode(WebcamHeadTracker::Tracking_Landmarks);
+    tracker.setPoseSolver(WebcamHeadTracker::PoseSolver_Head_Model_Robust);
+    tracker.setDetectionMode(WebcamHeadTracker::Detection_Asynchronous);
+    if (!tracker.initFrameSource(source) || !tracker.initPoseEstimator())
+        return false;
+
+    int frames = 0;
+    int poses = 0;
+    unsigned long long lastFrameNumber = 0;
+    double firstTimestamp = 0.0;
+    std::vector<double> latencies;
+    // the replay starts with the first read, in the first getNewFrame()
+    auto t0 = std::chrono::steady_clock::now();
+    while (tracker.isReady()) {
+        tracker.getNewFrame();
+        if (!tracker.isReady())
+            break;
+        if (tracker.frameNumber() == lastFrameNumber)
+            continue;
+        lastFrameNumber = tracker.frameNumber();
+        if (frames++ == 0)
+            firstTimestamp = tracker.frameTimestamp();
+        if (!tracker.computeHeadPose())
+            continue;
+        poses++;
+        if (realTime) {
+            double due = tracker.frameTimestamp() - firstTimestamp;
+            double now = std::chrono::duration<double>(std::chrono::steady_clock::now() - t0).count();
+            latencies.push_back((now - due) * 1e3);
+        }
+    }
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - t0).count();
+
+    const char* name = (mode == WebcamHeadTracker::Execution_Pipelined ? "pipelined" : "sequential");
+    std::printf("%-12s %6d frames %6d poses %6llu skipped %8.1f fps\n", name, frames, poses,
+        lastFrameNumber - frames, frames / seconds);
+    if (realTime)
+        printLatencies(name, latencies);
+    return true;
+}
+
+int benchPipeline(int argc, char* argv[])
+{
+    std::string recording = argv[0];
+    bool realTime = false;
+    for (int i = 1; i < argc; i++) {
+        if (std::strcmp(argv[i], "--real-time") == 0) {
+            realTime = true;
+        }
+        else {
+            std::fprintf(stderr, "pipeline: invalid option %s\n", argv[i]);
+            return 1;
+        }
+    }
+    const enum WebcamHeadTracker::ExecutionMode modes[] = {
+        WebcamHeadTracker::Execution_Sequential,
+        WebcamHeadTracker::Execution_Pipelined
+    };
+    for (enum WebcamHeadTracker::ExecutionMode mode : modes) {
+        if (!runMode(recording, mode, realTime)) {
+            std::fprintf(stderr, "cannot open %s, or cannot load the face detector or landmark model\n",
+                recording.c_str());
+            return 1;
+        }
+    }
+    return 0;
+}
@@ -0,0 +1,135 @@
+/*
+ * Pose solver comparison.
+ *
+ * The face is detected and its landmarks are computed on every frame of the
+ * recording, as in the tracker. Then both pose solvers fit the head model to
+ * the same landmarks, from the same initial guess as in the tracker, with the
+ * tracker's default camera. Only the solver calls are timed.
+ */
+
+#include "bench.hpp"
+#include "../AVision/frame-source.hpp"
+#include "../AVision/face-detector.hpp"
+#include "../AVision/face-landmarks.hpp"
+#include "../AVision/head-model.hpp"
+#include "../AVision/head-pose-solver.hpp"
+#include "../AVision/webcam-head-tracker.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <numeric>
+#include <vector>
+
+#include <opencv2/core/core.hpp>
+#include <opencv2/imgproc/imgproc.hpp>
+#include <opencv2/calib3d/calib3d.hpp>
+
+#ifndef M_PI
+#define M_PI 3.14159265358979323846
+#endif
+
+/* Angle in degrees between the rotations of two Rodrigues vectors */
+static double rotationDifference(const cv::Mat& r0, const cv::Mat& r1)
+{
+    cv::Mat R0, R1;
+    cv::Rodrigues(r0, R0);
+    cv::Rodrigues(r1, R1);
+    cv::Mat R = R0.t() * R1;
+    double c = 0.5 * (R.at<double>(0, 0) + R.at<double>(1, 1) + R.at<double>(2, 2) - 1.0);
+    return std::acos(std::max(-1.0, std::min(1.0, c))) * 180.0 / M_PI;
+}
+
+int benchPnP(int argc, char* argv[])
+{
+    std::string recording = argv[0];
+    if (argc > 1) {
+        std::fprintf(stderr, "pnp: invalid option %s\n", argv[1]);
+        return 1;
+    }
+    FaceDetector* detector = FaceDetector::create(FaceDetector::Backend_Haar,
+        WebcamHeadTracker::filePathFrontalFaceXml());
+    FaceLandmarkModel model;
+    std::string landmarksDat = WebcamHeadTracker::filePathFaceLandmarksDat();
+    if (!detector || !model.load(landmarksDat, landmarksDat + ".flat")
+        || model.landmarkCount() != 68) {
+        std::fprintf(stderr, "cannot load the face detector or landmark model\n");
+        delete detector;
+        return 1;
+    }
+    ReplayFrameSource* source = openRecording(recording);
+    if (!source) {
+        std::fprintf(stderr, "cannot open %s\n", recording.c_str());
+        delete detector;
+        return 1;
+    }
+
+    std::vector<cv::Point3f> modelPoints(modelLandmarkPositions, modelLandmarkPositions + modelLandmarkCount);
+    std::vector<cv::Point2f> landmarks(68);
+    std::vector<cv::Point2f> imagePoints(modelLandmarkCount);
+    HeadPoseSolver solver(modelLandmarkPositions);
+    cv::Mat frame, gray;
+    double timestamp;
+    cv::Rect face;
+    std::vector<double> openCVLatencies, solverLatencies;
+    std::vector<double> translationDifferences, rotationDifferences;
+    std::vector<double> iterations;
+    while (source->read(frame, timestamp)) {
+        if (frame.channels() == 3)
+            cv::cvtColor(frame, gray, cv::COLOR_BGR2GRAY);
+        else
+            gray = frame;
+        if (!detector->detect(gray, 80, 0, face))
+            continue;
+        model.predict(gray, face, landmarks.data());
+        for (int i = 0; i < modelLandmarkCount; i++)
+            imagePoints[i] = landmarks[modelLandmarkIndices[i]];
+
+        // the tracker's default camera and initial guess
+        CameraIntrinsics camera = { 0.9 * gray.cols, 0.9 * gray.cols, gray.cols / 2.0, gray.rows / 2.0,
+            0.0, 0.0, 0.0, 0.0, 0.0 };
+        cv::Matx33d cameraMatrix(camera.fx, 0.0, camera.cx, 0.0, camera.fy, camera.cy, 0.0, 0.0, 1.0);
+        cv::Mat distCoeffs = cv::Mat::zeros(1, 5, CV_64F);
+        cv::Mat rvec0 = (cv::Mat_<double>(3, 1) << M_PI, 0.0, 0.0);
+        cv::Mat tvec0 = (cv::Mat_<double>(3, 1) << 0.0, 0.0, 500.0);
+
+        cv::Mat rvec = rvec0.clone(), tvec = tvec0.clone();
+        auto t0 = std::chrono::steady_clock::now();
+        cv::solvePnP(modelPoints, imagePoints, cameraMatrix, distCoeffs, rvec, tvec, true, cv::SOLVEPNP_ITERATIVE);
+        auto t1 = std::chrono::steady_clock::now();
+        cv::Mat rvecSolver = rvec0.clone(), tvecSolver = tvec0.clone();
+        auto t2 = std::chrono::steady_clock::now();
+        bool solved = solver.solve(camera, imagePoints.data(), rvecSolver.ptr<double>(), tvecSolver.ptr<double>());
+        auto t3 = std::chrono::steady_clock::now();
+        if (!solved)
+            continue;
+
+        openCVLatencies.push_back(std::chrono::duration<double, std::milli>(t1 - t0).count());
+        solverLatencies.push_back(std::chrono::duration<double, std::milli>(t3 - t2).count());
+        translationDifferences.push_back(cv::norm(tvec, tvecSolver));
+        rotationDifferences.push_back(rotationDifference(rvec, rvecSolver));
+        iterations.push_back(solver.iterations());
+    }
+    delete source;
+    delete detector;
+
+    size_t poses = openCVLatencies.size();
+    std::printf("%s, %zu poses\n", recording.c_str(), poses);
+    if (poses == 0)
+        return 1;
+    printLatencies("OpenCV", openCVLatencies);
+    printLatencies("head model", solverLatencies);
+    // the latencies are sorted now
+    double openCVMedian = openCVLatencies[poses / 2];
+    double solverMedian = solverLatencies[poses / 2];
+    std::printf("%-12s %.1fx faster (median), %.1f iterations (mean)\n", "",
+        openCVMedian / std::max(solverMedian, 1e-9),
+        std::accumulate(iterations.begin(), iterations.end(), 0.0) / poses);
+    double maxTranslation = *std::max_element(translationDifferences.begin(), translationDifferences.end());
+    double maxRotation = *std::max_element(rotationDifferences.begin(), rotationDifferences.end());
+    bool equivalent = (maxTranslation <= 0.1 && maxRotation <= 0.1);
+    std::printf("difference   max %.4f mm, max %.4f deg: %s\n", maxTranslation, maxRotation,
+        equivalent ? "equivalent" : "NOT equivalent (limits: 0.1 mm, 0.1 deg)");
+    return equivalent ? 0 : 1;
+}
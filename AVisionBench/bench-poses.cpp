@@ -0,0 +1,317 @@
+/*
+ * Raw head poses of recordings, and the scoring of the pose filters on them.
+ *
+ * The tracker runs without a filter over each recording, single-threaded with
+ * all optional processing modes, which gives the raw head poses and their capture
+ * times. Pose files written with --save-poses skip this step. A filter runs over
+ * these poses and is compared to a zero-phase (non-causal) Gaussian smoothing of
+ * the raw poses:
+ *  - lag: the RMS distance to the reference, which grows with the delay;
+ *  - jitter: the RMS change of that distance from one pose to the next, which
+ *    is what the user sees as shaking.
+ * The cost is jitter + lag weight * lag, for the position in mm plus the
+ * rotation weight times that for the orientation in degrees.
+ */
+
+#include "bench.hpp"
+#include "../AVision/frame-source.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+
+#include <opencv2/core/core.hpp>
+
+#ifndef M_PI
+#define M_PI 3.14159265358979323846
+#endif
+
+/* The reference smoothing, and the gap in seconds after which a new segment
+ * begins. The first and last samples of a segment, within two standard deviations
+ * of the smoothing, are not scored, since the reference is biased there. */
+static const double referenceSigma = 0.05;
+static const double maxGap = 0.25;
+
+/* Poses */
+
+// Inverse of the conversion to the external representation in the tracker
+static void toInternalPose(const float* position, const float* orientation, PoseSample& sample)
+{
+    sample.vec[0] = -position[0] * 1000.0;
+    sample.vec[1] = -position[1] * 1000.0;
+    sample.vec[2] = position[2] * 1000.0;
+    sample.quat[0] = -orientation[3];
+    sample.quat[1] = orientation[2];
+    sample.quat[2] = -orientation[1];
+    sample.quat[3] = orientation[0];
+}
+
+static bool extractPoses(const std::string& recording, std::vector<PoseSample>& poses)
+{
+    ReplayFrameSource* source = openRecording(recording);
+    if (!source)
+        return false;
+    WebcamHeadTracker tracker;
+    tracker.setGrayscaleProcessing(true);
+    tracker.setLandmarkWarmStart(true);
+    tracker.setFaceSearch(WebcamHeadTracker::FaceSearch_Local);
+    tracker.setTrackingMode(WebcamHeadTracker::Tracking_Landmarks);
+    tracker.setPoseSolver(WebcamHeadTracker::PoseSolver_Head_Model_Robust);
+    tracker.setFilter(WebcamHeadTracker::Filter_None);
+    if (!tracker.initFrameSource(source) || !tracker.initPoseEstimator())
+        return false;
+    while (tracker.isReady()) {
+        tracker.getNewFrame();
+        if (!tracker.isReady())
+            break;
+        if (!tracker.computeHeadPose())
+            continue;
+        float position[3], orientation[4];
+        tracker.getHeadPosition(position);
+        tracker.getHeadOrientation(orientation);
+        PoseSample sample;
+        sample.timestamp = tracker.frameTimestamp();
+        toInternalPose(position, orientation, sample);
+        poses.push_back(sample);
+    }
+    return true;
+}
+
+static bool loadPoses(const std::string& fileName, std::vector<PoseSample>& poses)
+{
+    cv::Mat m;
+    try {
+        cv::FileStorage fs(fileName, cv::FileStorage::READ);
+        if (!fs.isOpened())
+            return false;
+        fs["poses"] >> m;
+    }
+    catch (cv::Exception& e) {
+        return false;
+    }
+    if (m.cols != 8 || m.type() != CV_64F)
+        return false;
+    for (int i = 0; i < m.rows; i++) {
+        const double* row = m.ptr<double>(i);
+        PoseSample sample = { row[0], { row[1], row[2], row[3] }, { row[4], row[5], row[6], row[7] } };
+        poses.push_back(sample);
+    }
+    return true;
+}
+
+static bool savePoses(const std::string& fileName, const std::vector<PoseSample>& poses)
+{
+    cv::Mat m(static_cast<int>(poses.size()), 8, CV_64F);
+    for (size_t i = 0; i < poses.size(); i++) {
+        double* row = m.ptr<double>(static_cast<int>(i));
+        row[0] = poses[i].timestamp;
+        std::copy(poses[i].vec, poses[i].vec + 3, row + 1);
+        std::copy(poses[i].quat, poses[i].quat + 4, row + 4);
+    }
+    try {
+        cv::FileStorage fs(fileName, cv::FileStorage::WRITE);
+        if (!fs.isOpened())
+            return false;
+        fs << "poses" << m;
+    }
+    catch (cv::Exception& e) {
+        return false;
+    }
+    return true;
+}
+
+static bool isPoseFile(const std::string& path)
+{
+    size_t dot = path.rfind('.');
+    return dot != std::string::npos && (path.compare(dot, std::string::npos, ".yml") == 0
+        || path.compare(dot, std::string::npos, ".yaml") == 0);
+}
+
+/* Reference: Gaussian smoothing within each segment. Quaternions are averaged
+ * after flipping them to the side of the center sample, and normalized. */
+static void computeReference(PoseSequence& s)
+{
+    size_t n = s.poses.size();
+    s.reference = s.poses;
+    s.scored.assign(n, 0);
+    s.segmentStart.assign(n, 0);
+    size_t begin = 0;
+    while (begin < n) {
+        size_t end = begin + 1;
+        while (end < n && s.poses[end].timestamp - s.poses[end - 1].timestamp < maxGap)
+            end++;
+        s.segmentStart[begin] = 1;
+        double tBegin = s.poses[begin].timestamp;
+        double tEnd = s.poses[end - 1].timestamp;
+        size_t windowBegin = begin;
+        for (size_t i = begin; i < end; i++) {
+            const PoseSample& center = s.poses[i];
+            double weightSum = 0.0;
+            double vec[3] = { 0.0, 0.0, 0.0 };
+            double quat[4] = { 0.0, 0.0, 0.0, 0.0 };
+            // the window covers three standard deviations on each side
+            while (center.timestamp - s.poses[windowBegin].timestamp > 3.0 * referenceSigma)
+                windowBegin++;
+            for (size_t j = windowBegin; j < end && s.poses[j].timestamp - center.timestamp <= 3.0 * referenceSigma; j++) {
+                double d = (s.poses[j].timestamp - center.timestamp) / referenceSigma;
+                double w = std::exp(-0.5 * d * d);
+                const PoseSample& p = s.poses[j];
+                double sign = (p.quat[0] * center.quat[0] + p.quat[1] * center.quat[1]
+                    + p.quat[2] * center.quat[2] + p.quat[3] * center.quat[3] < 0.0 ? -1.0 : 1.0);
+                for (int k = 0; k < 3; k++)
+                    vec[k] += w * p.vec[k];
+                for (int k = 0; k < 4; k++)
+                    quat[k] += w * sign * p.quat[k];
+                weightSum += w;
+            }
+            double quatLength = std::sqrt(quat[0] * quat[0] + quat[1] * quat[1] + quat[2] * quat[2] + quat[3] * quat[3]);
+            for (int k = 0; k < 3; k++)
+                s.reference[i].vec[k] = vec[k] / weightSum;
+            for (int k = 0; k < 4; k++)
+                s.reference[i].quat[k] = quat[k] / quatLength;
+            s.scored[i] = (center.timestamp - tBegin >= 2.0 * referenceSigma
+                && tEnd - center.timestamp >= 2.0 * referenceSigma);
+        }
+        begin = end;
+    }
+}
+
+/* Loading */
+
+bool loadPoseSequences(const std::vector<std::string>& inputs, bool savePoseFiles,
+    std::vector<PoseSequence>& sequences, double& nominalFps)
+{
+    std::vector<double> intervals;
+    for (const std::string& input : inputs) {
+        PoseSequence s;
+        s.name = input;
+        if (isPoseFile(input)) {
+            if (!loadPoses(input, s.poses)) {
+                std::fprintf(stderr, "cannot load poses from %s\n", input.c_str());
+                return false;
+            }
+        }
+        else {
+            if (!extractPoses(input, s.poses)) {
+                std::fprintf(stderr, "cannot open %s, or cannot load the face detector or landmark model\n",
+                    input.c_str());
+                return false;
+            }
+            if (savePoseFiles && !savePoses(input + ".poses.yml", s.poses))
+                std::fprintf(stderr, "cannot write %s.poses.yml\n", input.c_str());
+        }
+        std::printf("%s: %zu poses\n", input.c_str(), s.poses.size());
+        if (s.poses.empty())
+            continue;
+        for (size_t i = 1; i < s.poses.size(); i++) {
+            double dt = s.poses[i].timestamp - s.poses[i - 1].timestamp;
+            if (dt > 0.0 && dt < maxGap)
+                intervals.push_back(dt);
+        }
+        computeReference(s);
+        sequences.push_back(s);
+    }
+    if (intervals.empty()) {
+        std::fprintf(stderr, "not enough poses\n");
+        return false;
+    }
+    std::nth_element(intervals.begin(), intervals.begin() + intervals.size() / 2, intervals.end());
+    nominalFps = 1.0 / intervals[intervals.size() / 2];
+    return true;
+}
+
+const char* filterName(enum WebcamHeadTracker::Filter filter)
+{
+    switch (filter) {
+    case WebcamHeadTracker::Filter_None:
+        return "none";
+    case WebcamHeadTracker::Filter_Kalman:
+        return "kalman";
+    case WebcamHeadTracker::Filter_Double_Exponential:
+        return "double exponential";
+    case WebcamHeadTracker::Filter_OneEuro:
+        return "one euro";
+    case WebcamHeadTracker::Filter_Quaternion_Kalman:
+        return "quaternion kalman";
+    }
+    return "";
+}
+
+/* Evaluation */
+
+// Rotation vector in degrees of q * conj(r)
+static void rotationDifference(const double* q, const double* r, double* e)
+{
+    double d[4] = {
+        r[3] * q[0] - q[3] * r[0] - q[1] * r[2] + q[2] * r[1],
+        r[3] * q[1] - q[3] * r[1] - q[2] * r[0] + q[0] * r[2],
+        r[3] * q[2] - q[3] * r[2] - q[0] * r[1] + q[1] * r[0],
+        r[3] * q[3] + q[0] * r[0] + q[1] * r[1] + q[2] * r[2]
+    };
+    if (d[3] < 0.0) {
+        d[0] = -d[0]; d[1] = -d[1]; d[2] = -d[2]; d[3] = -d[3];
+    }
+    double sinHalfAngle = std::sqrt(d[0] * d[0] + d[1] * d[1] + d[2] * d[2]);
+    double factor = (sinHalfAngle > 0.0 ? 2.0 * std::atan2(sinHalfAngle, d[3]) / sinHalfAngle : 2.0)
+        * 180.0 / M_PI;
+    e[0] = factor * d[0];
+    e[1] = factor * d[1];
+    e[2] = factor * d[2];
+}
+
+static double squaredDistance(const double* a, const double* b)
+{
+    return (a[0] - b[0]) * (a[0] - b[0]) + (a[1] - b[1]) * (a[1] - b[1]) + (a[2] - b[2]) * (a[2] - b[2]);
+}
+
+FilterScore scoreFilter(enum WebcamHeadTracker::Filter filter, const PoseFilterParameters& parameters,
+    const std::vector<PoseSequence>& sequences, double nominalFps, double lagWeight, double rotationWeight)
+{
+    static const double zero[3] = { 0.0, 0.0, 0.0 };
+    double positionJitter = 0.0, positionLag = 0.0;
+    double orientationJitter = 0.0, orientationLag = 0.0, orientationMax = 0.0;
+    size_t lagSamples = 0, jitterSamples = 0;
+    for (const PoseSequence& s : sequences) {
+        PoseFilter poseFilter(nominalFps, parameters);
+        double lastPositionError[3], lastOrientationError[3];
+        bool lastScored = false;
+        for (size_t i = 0; i < s.poses.size(); i++) {
+            const PoseSample& p = s.poses[i];
+            double vec[3], quat[4];
+            poseFilter.step(filter, p.timestamp, p.vec, p.quat, vec, quat);
+            if (!s.scored[i]) {
+                lastScored = false;
+                continue;
+            }
+            double positionError[3] = {
+                vec[0] - s.reference[i].vec[0], vec[1] - s.reference[i].vec[1], vec[2] - s.reference[i].vec[2]
+            };
+            double orientationError[3];
+            rotationDifference(quat, s.reference[i].quat, orientationError);
+            positionLag += squaredDistance(positionError, zero);
+            orientationLag += squaredDistance(orientationError, zero);
+            orientationMax = std::max(orientationMax, squaredDistance(orientationError, zero));
+            lagSamples++;
+            if (lastScored && !s.segmentStart[i]) {
+                positionJitter += squaredDistance(positionError, lastPositionError);
+                orientationJitter += squaredDistance(orientationError, lastOrientationError);
+                jitterSamples++;
+            }
+            std::copy(positionError, positionError + 3, lastPositionError);
+            std::copy(orientationError, orientationError + 3, lastOrientationError);
+            lastScored = true;
+        }
+    }
+    FilterScore score;
+    score.positionJitter = std::sqrt(positionJitter / std::max(jitterSamples, size_t(1)));
+    score.positionLag = std::sqrt(positionLag / std::max(lagSamples, size_t(1)));
+    score.orientationJitter = std::sqrt(orientationJitter / std::max(jitterSamples, size_t(1)));
+    score.orientationLag = std::sqrt(orientationLag / std::max(lagSamples, size_t(1)));
+    score.orientationMax = std::sqrt(orientationMax);
+    score.cost = score.positionJitter + lagWeight * score.positionLag
+        + rotationWeight * (score.orientationJitter + lagWeight * score.orientationLag);
+    // a filter that produced invalid poses is worse than any other
+    if (!std::isfinite(score.cost))
+        score.cost = HUGE_VAL;
+    return score;
+}
@@ -0,0 +1,235 @@
+/*
+ * Filter parameter tuning.
+ *
+ * Every filter runs with every candidate parameter set over the raw poses of the
+ * recordings, and is scored by its jitter and lag (see bench-poses.cpp). Each
+ * filter is searched on a coarse grid, which is then refined twice around its
+ * best point.
+ * The candidates are independent and are evaluated in parallel on all cores.
+ * The best filter and its parameters are written for
+ * WebcamHeadTracker::setFilterConfigFile().
+ */
+
+#include "bench.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <thread>
+#include <vector>
+
+struct Candidate
+{
+    enum WebcamHeadTracker::Filter filter;
+    PoseFilterParameters parameters;
+};
+
+struct Dimension
+{
+    const char* name;
+    double PoseFilterParameters::* value;
+    double min, max;
+    int count;
+    bool logarithmic;
+};
+
+/* Search */
+
+static double gridValue(const Dimension& d, int i)
+{
+    if (d.count == 1)
+        return d.min;
+    double f = double(i) / (d.count - 1);
+    return d.logarithmic ? d.min * std::pow(d.max / d.min, f) : d.min + f * (d.max - d.min);
+}
+
+static void addGrid(enum WebcamHeadTracker::Filter filter, const std::vector<Dimension>& dims,
+    std::vector<Candidate>& candidates)
+{
+    int total = 1;
+    for (const Dimension& d : dims)
+        total *= d.count;
+    for (int index = 0; index < total; index++) {
+        Candidate c = { filter, PoseFilterParameters() };
+        int rest = index;
+        for (const Dimension& d : dims) {
+            c.parameters.*d.value = gridValue(d, rest % d.count);
+            rest /= d.count;
+        }
+        candidates.push_back(c);
+    }
+}
+
+// A grid of 5 values per dimension within one grid step around the best value
+static std::vector<Dimension> refineGrid(const std::vector<Dimension>& dims,
+    const std::vector<Dimension>& bounds, const PoseFilterParameters& best)
+{
+    std::vector<Dimension> refined = dims;
+    for (size_t k = 0; k < dims.size(); k++) {
+        const Dimension& d = dims[k];
+        Dimension& r = refined[k];
+        double v = best.*d.value;
+        if (d.count > 1) {
+            if (d.logarithmic) {
+                double step = std::pow(d.max / d.min, 1.0 / (d.count - 1));
+                r.min = std::max(v / step, bounds[k].min);
+                r.max = std::min(v * step, bounds[k].max);
+            }
+            else {
+                double step = (d.max - d.min) / (d.count - 1);
+                r.min = std::max(v - step, bounds[k].min);
+                r.max = std::min(v + step, bounds[k].max);
+            }
+            r.count = 5;
+        }
+    }
+    return refined;
+}
+
+static void evaluateAll(const std::vector<Candidate>& candidates, std::vector<FilterScore>& scores,
+    const std::vector<PoseSequence>& sequences, double nominalFps,
+    double lagWeight, double rotationWeight, int threadCount)
+{
+    scores.resize(candidates.size());
+    std::atomic<size_t> next(0);
+    auto work = [&]() {
+        size_t i;
+        while ((i = next++) < candidates.size())
+            scores[i] = scoreFilter(candidates[i].filter, candidates[i].parameters, sequences,
+                nominalFps, lagWeight, rotationWeight);
+    };
+    std::vector<std::thread> threads;
+    for (int t = 1; t < threadCount; t++)
+        threads.emplace_back(work);
+    work();
+    for (std::thread& t : threads)
+        t.join();
+}
+
+int benchTune(int argc, char* argv[])
+{
+    std::vector<std::string> inputs;
+    std::string outFile = "filters.yml";
+    bool savePoseFiles = false;
+    double lagWeight = 1.0;
+    double rotationWeight = 1.0;
+    int threadCount = std::max(1, static_cast<int>(std::thread::hardware_concurrency()));
+    for (int i = 0; i < argc; i++) {
+        if (std::strcmp(argv[i], "--out") == 0 && i + 1 < argc)
+            outFile = argv[++i];
+        else if (std::strcmp(argv[i], "--save-poses") == 0)
+            savePoseFiles = true;
+        else if (std::strcmp(argv[i], "--lag-weight") == 0 && i + 1 < argc)
+            lagWeight = std::atof(argv[++i]);
+        else if (std::strcmp(argv[i], "--rotation-weight") == 0 && i + 1 < argc)
+            rotationWeight = std::atof(argv[++i]);
+        else if (std::strcmp(argv[i], "--threads") == 0 && i + 1 < argc)
+            threadCount = std::max(1, std::atoi(argv[++i]));
+        else if (argv[i][0] == '-') {
+            std::fprintf(stderr, "tune: invalid option %s\n", argv[i]);
+            return 1;
+        }
+        else
+            inputs.push_back(argv[i]);
+    }
+
+    /* Raw poses */
+    std::vector<PoseSequence> sequences;
+    double nominalFps;
+    if (!loadPoseSequences(inputs, savePoseFiles, sequences, nominalFps))
+        return 1;
+    size_t poseCount = 0;
+    for (const PoseSequence& s : sequences)
+        poseCount += s.poses.size();
+    std::printf("%zu poses, nominal frame rate %.1f fps, %d threads\n", poseCount, nominalFps, threadCount);
+
+    /* Search each filter */
+    struct Search {
+        enum WebcamHeadTracker::Filter filter;
+        std::vector<Dimension> dims;
+    };
+    std::vector<Search> searches = {
+        { WebcamHeadTracker::Filter_None, {} },
+        { WebcamHeadTracker::Filter_Kalman, {
+            { "process noise", &PoseFilterParameters::kalmanProcessNoise, 1e-6, 1.0, 13, true },
+            { "measurement noise", &PoseFilterParameters::kalmanMeasurementNoise, 1e-3, 10.0, 9, true } } },
+        { WebcamHeadTracker::Filter_Quaternion_Kalman, {
+            { "process noise", &PoseFilterParameters::quaternionKalmanProcessNoise, 1e-6, 1.0, 13, true },
+            { "measurement noise", &PoseFilterParameters::quaternionKalmanMeasurementNoise, 1e-3, 10.0, 9, true } } },
+        { WebcamHeadTracker::Filter_Double_Exponential, {
+            { "alpha", &PoseFilterParameters::despAlpha, 0.05, 0.9, 18, false },
+            { "tau", &PoseFilterParameters::despTau, 0.0, 3.0, 13, false } } },
+        { WebcamHeadTracker::Filter_OneEuro, {
+            { "min cutoff", &PoseFilterParameters::oneEuroMinCutoff, 0.1, 10.0, 11, true },
+            { "position beta", &PoseFilterParameters::oneEuroPositionBeta, 1e-4, 1.0, 9, true },
+            { "orientation beta", &PoseFilterParameters::oneEuroOrientationBeta, 0.1, 100.0, 10, true } } }
+    };
+    const int refinements = 2;
+    std::vector<std::vector<Dimension>> bounds;
+    for (const Search& search : searches)
+        bounds.push_back(search.dims);
+    auto t0 = std::chrono::steady_clock::now();
+    size_t evaluations = 0;
+    std::vector<Candidate> best(searches.size());
+    std::vector<FilterScore> bestScores(searches.size());
+    for (int round = 0; round <= refinements; round++) {
+        std::vector<Candidate> candidates;
+        std::vector<size_t> firstCandidate;
+        for (size_t k = 0; k < searches.size(); k++) {
+            firstCandidate.push_back(candidates.size());
+            if (round > 0 && searches[k].dims.empty())
+                continue;
+            addGrid(searches[k].filter, searches[k].dims, candidates);
+        }
+        firstCandidate.push_back(candidates.size());
+        std::vector<FilterScore> scores;
+        evaluateAll(candidates, scores, sequences, nominalFps, lagWeight, rotationWeight, threadCount);
+        evaluations += candidates.size();
+        for (size_t k = 0; k < searches.size(); k++) {
+            for (size_t i = firstCandidate[k]; i < firstCandidate[k + 1]; i++) {
+                if ((round == 0 && i == firstCandidate[k]) || scores[i].cost < bestScores[k].cost) {
+                    best[k] = candidates[i];
+                    bestScores[k] = scores[i];
+                }
+            }
+        }
+        if (round < refinements) {
+            for (size_t k = 0; k < searches.size(); k++)
+                searches[k].dims = refineGrid(searches[k].dims, bounds[k], best[k].parameters);
+        }
+    }
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - t0).count();
+    std::printf("%zu evaluations in %.1f s\n\n", evaluations, seconds);
+
+    /* Results */
+    std::printf("%-20s %8s %11s %8s %12s %9s %9s\n", "filter", "score", "jitter mm", "lag mm", "jitter deg", "lag deg",
+        "max deg");
+    size_t bestFilter = 0;
+    for (size_t k = 0; k < searches.size(); k++) {
+        const FilterScore& s = bestScores[k];
+        std::printf("%-20s %8.3f %11.3f %8.3f %12.3f %9.3f %9.3f  ", filterName(searches[k].filter),
+            s.cost, s.positionJitter, s.positionLag, s.orientationJitter, s.orientationLag, s.orientationMax);
+        for (const Dimension& d : searches[k].dims)
+            std::printf(" %s %.4g", d.name, best[k].parameters.*d.value);
+        std::printf("\n");
+        if (s.cost < bestScores[bestFilter].cost)
+            bestFilter = k;
+    }
+
+    // all filters get their best parameters, the best filter is selected
+    PoseFilterParameters parameters;
+    for (size_t k = 0; k < searches.size(); k++) {
+        for (const Dimension& d : searches[k].dims)
+            parameters.*d.value = best[k].parameters.*d.value;
+    }
+    if (!PoseFilter::save(outFile, searches[bestFilter].filter, parameters)) {
+        std::fprintf(stderr, "cannot write %s\n", outFile.c_str());
+        return 1;
+    }
+    std::printf("\nwrote %s: %s\n", outFile.c_str(), filterName(searches[bestFilter].filter));
+    return 0;
+}
@@ -0,0 +1,111 @@
+/*
+ * AVisionBench: offline benchmarks for the head tracker.
+ *
+ * All benchmarks run over recorded sessions (see WebcamHeadTracker::startRecording())
+ * or other recordings, as fast as possible, so that results are reproducible and
+ * independent of the webcam.
+ */
+
+#include "bench.hpp"
+#include "../AVision/frame-source.hpp"
+#include "../AVision/session-file.hpp"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+
+ReplayFrameSource* openRecording(const std::string& path)
+{
+    ReplayFrameSource* source = new SessionFrameSource(path);
+    if (!source->isOpened()) {
+        delete source;
+        source = new VideoFileFrameSource(path);
+    }
+    if (!source->isOpened()) {
+        delete source;
+        source = new ImageSequenceFrameSource(path);
+    }
+    if (!source->isOpened()) {
+        delete source;
+        return NULL;
+    }
+    source->setPacing(ReplayFrameSource::Pacing_As_Fast_As_Possible);
+    return source;
+}
+
+static double percentile(const std::vector<double>& sorted, double p)
+{
+    size_t i = std::min(sorted.size() - 1, size_t(p * (sorted.size() - 1) + 0.5));
+    return sorted[i];
+}
+
+void printLatencies(const char* name, std::vector<double>& ms)
+{
+    if (ms.empty()) {
+        std::printf("%-12s no samples\n", name);
+        return;
+    }
+    std::sort(ms.begin(), ms.end());
+    std::printf("%-12s p50 %7.2f ms  p90 %7.2f ms  p99 %7.2f ms  max %7.2f ms\n", name,
+        percentile(ms, 0.5), percentile(ms, 0.9), percentile(ms, 0.99), ms.back());
+}
+
+static void usage()
+{
+    std::fprintf(stderr,
+        "Usage: AVisionBench <benchmark> <recording> [options]\n"
+        "\n"
+        "A recording is a session file, a video file, or a directory of images.\n"
+        "\n"
+        "Benchmarks:\n"
+        "  detectors   Compare face detector backends: latency and detection rate\n"
+        "              Options: --haar <xml> --lbp <xml> --hog --yunet <onnx> --color\n"
+        "  landmarks   Compare the landmark model with dlib's shape predictor: latency\n"
+        "              and equivalence, also of the pose landmark subset and of each\n"
+        "              evaluation kernel\n"
+        "              Options: --color\n"
+        "  pnp         Compare the pose solvers: latency and equivalence\n"
+        "  tune        Find the filter and parameters with the best jitter/lag trade-off\n"
+        "              over one or more recordings, or pose files (.yml) saved before\n"
+        "              Options: --out <yml> --save-poses --lag-weight <w>\n"
+        "                       --rotation-weight <mm per degree> --threads <n>\n"
+        "  filters     Compare the filters with the same parameters: jitter, lag,\n"
+        "              largest orientation error and time per step, over recordings\n"
+        "              or pose files\n"
+        "              Options: --config <yml> --save-poses --lag-weight <w>\n"
+        "                       --rotation-weight <mm per degree>\n"
+        "  pipeline    Compare the sequential and the pipelined execution mode: frame rate,\n"
+        "              and with --real-time, the latency at the recording's own pace\n"
+        "              Options: --real-time\n"
+        "  kalman      Check that the Kalman filter gives the estimates of the cv::KalmanFilter\n"
+        "              it replaced, on generated measurements (no recording)\n"
+        "  allocations Check that the tracker does not allocate memory on a frame\n"
+        "              once it tracks the face\n");
+}
+
+int main(int argc, char* argv[])
+{
+    // the Kalman filter check generates its own measurements
+    if (argc >= 2 && std::strcmp(argv[1], "kalman") == 0)
+        return benchKalman(argc - 2, argv + 2);
+    if (argc < 3) {
+        usage();
+        return 1;
+    }
+    if (std::strcmp(argv[1], "detectors") == 0)
+        return benchDetectors(argc - 2, argv + 2);
+    if (std::strcmp(argv[1], "landmarks") == 0)
+        return benchLandmarks(argc - 2, argv + 2);
+    if (std::strcmp(argv[1], "pnp") == 0)
+        return benchPnP(argc - 2, argv + 2);
+    if (std::strcmp(argv[1], "tune") == 0)
+        return benchTune(argc - 2, argv + 2);
+    if (std::strcmp(argv[1], "filters") == 0)
+        return benchFilters(argc - 2, argv + 2);
+    if (std::strcmp(argv[1], "pipeline") == 0)
+        return benchPipeline(argc - 2, argv + 2);
+    if (std::strcmp(argv[1], "allocations") == 0)
+        return benchAllocations(argc - 2, argv + 2);
+    usage();
+    return 1;
+}
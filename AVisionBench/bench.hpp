@@ -0,0 +1,91 @@
+#ifndef BENCH_HPP
+#define BENCH_HPP
+
+#include <string>
+#include <vector>
+
+#include "../AVision/pose-filter.hpp"
+#include "../AVision/webcam-head-tracker.hpp"
+
+class ReplayFrameSource;
+
+/*! \brief Open a recording for replay as fast as possible
+ * \param path      A session file, a video file, or a directory of images
+ *
+ * Returns NULL if the recording cannot be opened. */
+ReplayFrameSource* openRecording(const std::string& path);
+
+/*! \brief Print the median, 90th and 99th percentile and maximum of a set of
+ * latencies in milliseconds. The vector is sorted in place. */
+void printLatencies(const char* name, std::vector<double>& ms);
+
+/*! \brief A head pose in the representation of \a PoseFilter, with its capture time in seconds */
+struct PoseSample
+{
+    double timestamp;
+    double vec[3];
+    double quat[4];
+};
+
+/*! \brief The raw poses of a recording, and the reference that filters are scored against */
+struct PoseSequence
+{
+    std::string name;
+    std::vector<PoseSample> poses;
+    std::vector<PoseSample> reference;
+    std::vector<unsigned char> scored;
+    std::vector<unsigned char> segmentStart;
+};
+
+/*! \brief Jitter and lag of a filter over pose sequences (see bench-poses.cpp) */
+struct FilterScore
+{
+    double positionJitter, positionLag;                         // mm
+    double orientationJitter, orientationLag, orientationMax;   // degrees
+    double cost;
+};
+
+/*! \brief Get the raw poses of recordings, or load them from pose files (.yml)
+ * \param inputs        Recordings or pose files
+ * \param savePoseFiles Save the poses of each recording as `<recording>.poses.yml`
+ * \param sequences     Receives the pose sequences
+ * \param nominalFps    Receives the median frame rate
+ *
+ * Returns false, after printing the reason, if an input cannot be read or there are too few poses. */
+bool loadPoseSequences(const std::vector<std::string>& inputs, bool savePoseFiles,
+    std::vector<PoseSequence>& sequences, double& nominalFps);
+
+/*! \brief Run a filter over pose sequences and score it
+ * \param lagWeight         Weight of the lag relative to the jitter
+ * \param rotationWeight    Weight of the orientation in degrees relative to the position in mm */
+FilterScore scoreFilter(enum WebcamHeadTracker::Filter filter, const PoseFilterParameters& parameters,
+    const std::vector<PoseSequence>& sequences, double nominalFps, double lagWeight, double rotationWeight);
+
+/*! \brief A readable name of a filter */
+const char* filterName(enum WebcamHeadTracker::Filter filter);
+
+/*! \brief Face detector comparison: `detectors <recording> [options]` */
+int benchDetectors(int argc, char* argv[]);
+
+/*! \brief Landmark model equivalence to dlib::shape_predictor: `landmarks <recording> [--color]` */
+int benchLandmarks(int argc, char* argv[]);
+
+/*! \brief Pose solver comparison: `pnp <recording>` */
+int benchPnP(int argc, char* argv[]);
+
+/*! \brief Filter parameter tuning: `tune <recording or poses>... [options]` */
+int benchTune(int argc, char* argv[]);
+
+/*! \brief Filter comparison: `filters <recording or poses>... [options]` */
+int benchFilters(int argc, char* argv[]);
+
+/*! \brief Execution mode comparison: `pipeline <recording> [--real-time]` */
+int benchPipeline(int argc, char* argv[]);
+
+/*! \brief Kalman filter equivalence to cv::KalmanFilter: `kalman` */
+int benchKalman(int argc, char* argv[]);
+
+/*! \brief Allocation check of a steady-state frame: `allocations <recording>` */
+int benchAllocations(int argc, char* argv[]);
+
+#endif